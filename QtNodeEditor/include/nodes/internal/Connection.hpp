@@ -12,7 +12,7 @@
 #include "ConnectionGeometry.hpp"
 #include "ConnectionStyle.hpp"
 #include "TypeConverter.hpp"
-#include "QUuidStdHash.hpp"
+#include "SlotMap.hpp"
 #include "Export.hpp"
 #include "memory.hpp"
 
@@ -61,9 +61,14 @@ public:
 
 public:
 
-  QUuid
+  /// Unique within the process, assigned in creation order.
+  std::uint64_t
   id() const;
 
+  /// Handle of the connection in the FlowScene storage.
+  SlotHandle
+  handle() const { return _handle; }
+
   /// Remembers the end being dragged.
   /// Invalidates Node address.
   /// Grabs mouse.
@@ -124,10 +129,7 @@ public:
       return _style;
   }
 
-  void setStyle(ConnectionStyle style)
-  {
-      _style = style;
-  }
+  void setStyle(ConnectionStyle style);
 
 public: // data propagation
 
@@ -139,9 +141,12 @@ public: // data propagation
 
 private:
 
-  QUuid _uid;
+  std::uint64_t _id;
+  SlotHandle _handle;
   ConnectionStyle _style;
 
+  friend class FlowScene;
+
 private:
 
   Node* _outNode = nullptr;
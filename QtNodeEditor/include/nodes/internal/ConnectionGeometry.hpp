@@ -4,6 +4,7 @@
 
 #include <QtCore/QPointF>
 #include <QtCore/QRectF>
+#include <QtGui/QPainterPath>
 
 #include <iostream>
 
@@ -33,6 +34,17 @@ public:
   std::pair<QPointF, QPointF>
   pointsC1C2() const;
 
+  /// Cubic spline between source and sink, rebuilt lazily only after
+  /// one of the end points or the port layout changed.
+  QPainterPath const&
+  cubicPath() const;
+
+  /// Wide stroke around the cubic spline, used as the hit-test shape.
+  /// Built separately from the path, only when asked for: moving an end
+  /// point during a drag doesn't need it.
+  QPainterPath const&
+  strokeShape() const;
+
   QPointF
   source() const { return _out; }
   QPointF
@@ -60,5 +72,17 @@ private:
   bool _hovered;
 
   PortLayout _ports_layout;
+
+  void
+  invalidateCache() { _cacheDirty = true; _strokeDirty = true; }
+
+  void
+  updateCache() const;
+
+  mutable bool _cacheDirty;
+  mutable bool _strokeDirty;
+  mutable QPainterPath _cubicPath;
+  mutable QPainterPath _strokeShape;
+  mutable QRectF _boundingRect;
 };
 }
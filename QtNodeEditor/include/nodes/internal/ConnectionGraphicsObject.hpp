@@ -50,6 +50,12 @@ public:
   void
   move();
 
+  /// Schedules a repaint of this item or, if the scene draws the
+  /// connections with a single layer, of that layer. For a restyle: move()
+  /// takes care of the geometry.
+  void
+  repaint();
+
   void
   lock(bool locked);
 
@@ -4,10 +4,14 @@
 #include <QtWidgets/QGraphicsScene>
 
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include <tuple>
 #include <functional>
+#include <exception>
 
 #include "QUuidStdHash.hpp"
+#include "SlotMap.hpp"
 #include "Export.hpp"
 #include "DataModelRegistry.hpp"
 #include "TypeConverter.hpp"
@@ -22,6 +26,7 @@ class Node;
 class NodeGraphicsObject;
 class Connection;
 class ConnectionGraphicsObject;
+class ConnectionLayer;
 class NodeStyle;
 
 /// Scene holds connections and nodes.
@@ -77,11 +82,81 @@ public:
   void setNodePosition(Node& node, const QPointF& pos) const;
 
   QSizeF getNodeSize(const Node& node) const;
+
+  /// Opens a batch of node moves (layout, group drag). While a batch is
+  /// open, moving a node only marks its connections as dirty; the outermost
+  /// endConnectionBatch() recomputes every dirty connection exactly once.
+  void beginConnectionBatch();
+
+  void endConnectionBatch();
+
+  bool isConnectionBatchOpen() const { return _connectionBatchDepth > 0; }
+
+  /// Called by ConnectionGraphicsObject::move() while a batch is open.
+  void markConnectionDirty(Connection const& connection);
+
+  /// Starts a bulk construction of the scene (loading a file, expanding a
+  /// large tree). Until the matching endBulkBuild():
+  ///  - nodeCreated and connectionCreated are queued instead of emitted;
+  ///  - a connection batch is open, see beginConnectionBatch().
+  /// Calls can be nested, only the outermost endBulkBuild() publishes.
+  void beginBulkBuild();
+
+  /// Updates the dirty connections and emits the queued signals,
+  /// in creation order.
+  void endBulkBuild();
+
+  /// Same as endBulkBuild(), for a construction that failed: the outermost
+  /// call drops the queued signals instead, the listeners never see the
+  /// half-built content.
+  void cancelBulkBuild();
+
+  bool isBulkBuilding() const { return _bulkBuildDepth > 0; }
+
+  /// When enabled, all the connections are drawn by a single scene item,
+  /// grouped by colour, and the per-connection items are hidden (so they
+  /// are neither painted nor hovered). Meant for locked scenes, where the
+  /// connections are not interactive.
+  void setConnectionLayerEnabled(bool enabled);
+
+  bool connectionLayerEnabled() const { return _connectionLayer != nullptr; }
+
+  /// Schedules a repaint of the connection layer, if enabled. Enough when a
+  /// connection was only restyled.
+  void updateConnectionLayer();
+
+  /// Same, when a connection was moved, added or removed: the bounds of the
+  /// layer are recomputed too.
+  void invalidateConnectionLayer();
+
+  /// Changes whenever nodes or connections are added, removed or moved.
+  /// Values are unique among all the scenes: two equal revisions mean
+  /// that the scene is unchanged.
+  std::uint64_t revision() const { return _revision; }
+
+  /// Same as revision(), but not changed by nodes that were only moved.
+  std::uint64_t contentRevision() const { return _contentRevision; }
+
+  /// For changes the scene can't see, e.g. in the node data models.
+  /// Changes both revisions.
+  void bumpRevision();
+
+  /// A node moved: only revision() changes.
+  void bumpPositionRevision();
+
 public:
 
-  std::unordered_map<QUuid, std::unique_ptr<Node> > const &nodes() const;
+  /// Nodes in a deterministic order: creation order, except that removing
+  /// a node moves the last one into its place.
+  SlotMap<std::unique_ptr<Node> > const &nodes() const;
 
-  std::unordered_map<QUuid, std::shared_ptr<Connection> > const &connections() const;
+  SlotMap<std::shared_ptr<Connection> > const &connections() const;
+
+  /// Returns nullptr if the node was removed.
+  Node* node(SlotHandle handle) const;
+
+  /// Returns nullptr if the connection was deleted.
+  Connection* connection(SlotHandle handle) const;
 
   std::vector<Node*>selectedNodes() const;
 
@@ -115,6 +190,10 @@ signals:
 
   void nodeMoved(Node& n, const QPointF& newLocation);
 
+  /// Emitted for every change of position, also when the node is moved by
+  /// code; nodeMoved() is emitted only when the user drops a node.
+  void nodePositionChanged(Node& n);
+
   void nodeDoubleClicked(Node& n);
 
   void connectionHovered(Connection& c, QPoint screenPos);
@@ -132,12 +211,92 @@ private:
   using SharedConnection = std::shared_ptr<Connection>;
   using UniqueNode       = std::unique_ptr<Node>;
 
-  std::unordered_map<QUuid, SharedConnection> _connections;
-  std::unordered_map<QUuid, UniqueNode>       _nodes;
-  std::shared_ptr<DataModelRegistry>          _registry;
+  SlotMap<SharedConnection>          _connections;
+  SlotMap<UniqueNode>                _nodes;
+  std::shared_ptr<DataModelRegistry> _registry;
 
   QtNodes::PortLayout _layout;
 
+  int _connectionBatchDepth;
+  std::unordered_set<SlotHandle> _dirtyConnections;
+
+  int _bulkBuildDepth;
+  bool _bulkBuildCancelled;
+
+  std::unique_ptr<ConnectionLayer> _connectionLayer;
+
+  std::uint64_t _revision;
+  std::uint64_t _contentRevision;
+
+  std::vector<SlotHandle> _bulkCreatedNodes;
+  std::vector<SlotHandle> _bulkCreatedConnections;
+
+  void publishNodeCreated(Node& node);
+
+  void closeBulkBuild(bool cancelled);
+
+  void publishConnectionCreated(Connection& connection);
+
+  std::shared_ptr<Connection>
+  restoreConnection(QJsonObject const &connectionJson,
+                    std::unordered_map<QUuid, Node*> const &nodesByUuid);
+};
+
+/// Scoped FlowScene::beginConnectionBatch() / endConnectionBatch().
+class NODE_EDITOR_PUBLIC ConnectionBatchGuard
+{
+public:
+
+  explicit ConnectionBatchGuard(FlowScene& scene)
+    : _scene(scene)
+  {
+    _scene.beginConnectionBatch();
+  }
+
+  ~ConnectionBatchGuard()
+  {
+    _scene.endConnectionBatch();
+  }
+
+  ConnectionBatchGuard(ConnectionBatchGuard const&) = delete;
+
+  ConnectionBatchGuard&
+  operator=(ConnectionBatchGuard const&) = delete;
+
+private:
+
+  FlowScene& _scene;
+};
+
+/// Scoped FlowScene::beginBulkBuild() / endBulkBuild(). When the guard is
+/// destroyed by an exception, the bulk build is cancelled instead, see
+/// FlowScene::cancelBulkBuild().
+class NODE_EDITOR_PUBLIC BulkBuildGuard
+{
+public:
+
+  explicit BulkBuildGuard(FlowScene& scene)
+    : _scene(scene)
+  {
+    _scene.beginBulkBuild();
+  }
+
+  ~BulkBuildGuard()
+  {
+    if (std::uncaught_exception())
+      _scene.cancelBulkBuild();
+    else
+      _scene.endBulkBuild();
+  }
+
+  BulkBuildGuard(BulkBuildGuard const&) = delete;
+
+  BulkBuildGuard&
+  operator=(BulkBuildGuard const&) = delete;
+
+private:
+
+  FlowScene& _scene;
 };
 
 Node*
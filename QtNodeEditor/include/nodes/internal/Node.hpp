@@ -15,6 +15,7 @@
 #include "NodeGraphicsObject.hpp"
 #include "ConnectionGraphicsObject.hpp"
 #include "Serializable.hpp"
+#include "SlotMap.hpp"
 #include "memory.hpp"
 
 namespace QtNodes
@@ -49,9 +50,24 @@ public:
 
 public:
 
-  QUuid
+  /// Unique within the process, assigned in creation order.
+  std::uint64_t
   id() const;
 
+  /// Persistent identifier, used only by the JSON serialization.
+  /// Generated on first use, unless restored from JSON.
+  QUuid
+  uuid() const;
+
+  /// Gives the node a known UUID, e.g. to build it again as it was before.
+  /// Only until the scene publishes the node, see BulkBuildGuard.
+  void
+  setUuid(QUuid const& uuid);
+
+  /// Handle of the node in the FlowScene storage.
+  SlotHandle
+  handle() const { return _handle; }
+
   void reactToPossibleConnection(PortType,
                                  NodeDataType const &,
                                  QPointF const & scenePoint);
@@ -105,7 +121,13 @@ private:
 
   // addressing
 
-  QUuid _uid;
+  std::uint64_t _id;
+
+  mutable QUuid _uuid;
+
+  SlotHandle _handle;
+
+  friend class FlowScene;
 
   // data
 
@@ -2,6 +2,7 @@
 
 #include <QtCore/QRectF>
 #include <QtCore/QPointF>
+#include <QtCore/QSize>
 #include <QtGui/QTransform>
 #include <QtGui/QFontMetrics>
 
@@ -85,10 +86,18 @@ public:
   void
   recalculateSize() const;
 
-  /// Updates size if the QFontMetrics is changed
+  /// Updates size if the font, the number of ports, the embedded widget or
+  /// the validation changed, or if the geometry was invalidated since the
+  /// last update. Cheap enough to be called on every paint.
   void
   recalculateSize(QFont const &font) const;
 
+  /// Marks the size as outdated; it will be recomputed lazily by the next
+  /// recalculateSize(QFont) call. Needed only for the changes that
+  /// recalculateSize(QFont) can not see, e.g. a renamed port.
+  void
+  invalidate() { _dirty = true; }
+
   // TODO removed default QTransform()
   QPointF
   portScenePosition(PortIndex index,
@@ -147,8 +156,22 @@ private:
 
   std::unique_ptr<NodeDataModel> const &_dataModel;
 
-  mutable QFontMetrics _fontMetrics;
-  mutable QFontMetrics _boldFontMetrics;
+  // shared with the process-wide FontMetricsCache
+  mutable std::shared_ptr<QFontMetrics const> _fontMetrics;
+  mutable std::shared_ptr<QFontMetrics const> _boldFontMetrics;
+
+  mutable QFont _font;
+  mutable bool _dirty;
+
+  // what the size was computed from, besides the font
+  bool
+  outdated() const;
+
+  mutable unsigned int _nSinks;
+  mutable unsigned int _nSources;
+  mutable QSize _widgetSize;
+  mutable bool _valid;
+  mutable QString _validationMessage;
 
   PortLayout _ports_layout;
 };
@@ -1,9 +1,8 @@
 #pragma once
 
 #include <vector>
-#include <unordered_map>
 
-#include <QtCore/QUuid>
+#include <QtCore/QVarLengthArray>
 
 #include "Export.hpp"
 
@@ -34,18 +33,22 @@ public:
 
 public:
 
-  using ConnectionPtrSet =
-          std::unordered_map<QUuid, Connection*>;
+  /// Connections of a single port, in the order they were made.
+  /// A few of them are stored inline, so that most ports never allocate.
+  using ConnectionPtrSet = QVarLengthArray<Connection*, 4>;
 
-  /// Returns vector of connections ID.
-  /// Some of them can be empty (null)
+  /// Returns the connections of every port.
+  /// Some of them can be empty
   std::vector<ConnectionPtrSet> const&
   getEntries(PortType) const;
 
   std::vector<ConnectionPtrSet> &
   getEntries(PortType);
 
-  ConnectionPtrSet
+  /// The returned reference is invalidated when connections are
+  /// added to or removed from the node; copy it to iterate while
+  /// connecting or disconnecting.
+  ConnectionPtrSet const &
   connections(PortType portType, PortIndex portIndex) const;
 
   void
@@ -56,7 +59,7 @@ public:
   void
   eraseConnection(PortType portType,
                   PortIndex portIndex,
-                  QUuid id);
+                  Connection const& connection);
 
   ReactToConnectionState
   reaction() const;
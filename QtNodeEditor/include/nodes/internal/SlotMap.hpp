@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace QtNodes
+{
+
+/// Handle to an element of a SlotMap. It stays valid while the element
+/// lives; once the element is erased, the generation of its slot changes
+/// and the old handle no longer resolves, even if the slot is reused.
+struct SlotHandle
+{
+  std::uint32_t index = 0;
+  std::uint32_t generation = 0;   // 0 is never a live generation
+
+  bool
+  isValid() const { return generation != 0; }
+
+  bool
+  operator==(SlotHandle const& other) const
+  {
+    return index == other.index && generation == other.generation;
+  }
+
+  bool
+  operator!=(SlotHandle const& other) const
+  {
+    return !(*this == other);
+  }
+};
+
+
+/// Dense storage with stable handles.
+///
+/// The values are kept contiguous in a vector, so that iterating them is
+/// cheap and happens in a deterministic order: insertion order, except
+/// that erasing an element moves the last one into its place.
+/// Insertion, erasure and lookup by handle are O(1).
+template <typename T>
+class SlotMap
+{
+public:
+
+  using iterator       = typename std::vector<T>::iterator;
+  using const_iterator = typename std::vector<T>::const_iterator;
+
+  SlotHandle
+  insert(T&& value)
+  {
+    std::uint32_t slotIndex;
+
+    if (_freeSlots.empty())
+    {
+      slotIndex = static_cast<std::uint32_t>(_slots.size());
+      _slots.push_back(Slot());
+    }
+    else
+    {
+      slotIndex = _freeSlots.back();
+      _freeSlots.pop_back();
+    }
+
+    Slot& slot = _slots[slotIndex];
+    slot.valueIndex = static_cast<std::uint32_t>(_values.size());
+
+    _values.push_back(std::move(value));
+    _valueSlots.push_back(slotIndex);
+
+    SlotHandle handle;
+    handle.index = slotIndex;
+    handle.generation = slot.generation;
+    return handle;
+  }
+
+  /// Returns false if the handle doesn't refer to a live element.
+  bool
+  erase(SlotHandle handle)
+  {
+    if (!contains(handle))
+      return false;
+
+    Slot& slot = _slots[handle.index];
+    std::uint32_t const hole = slot.valueIndex;
+    std::uint32_t const last = static_cast<std::uint32_t>(_values.size() - 1);
+
+    // the erased value is destroyed only after the storage is consistent
+    // again, its destructor may well look into this container
+    T erased = std::move(_values[hole]);
+
+    if (hole != last)
+    {
+      _values[hole] = std::move(_values[last]);
+      _valueSlots[hole] = _valueSlots[last];
+      _slots[_valueSlots[hole]].valueIndex = hole;
+    }
+
+    _values.pop_back();
+    _valueSlots.pop_back();
+
+    // skip 0 on wrap-around, it marks invalid handles
+    if (++slot.generation == 0)
+      slot.generation = 1;
+
+    _freeSlots.push_back(handle.index);
+
+    return true;
+  }
+
+  bool
+  contains(SlotHandle handle) const
+  {
+    return handle.isValid() &&
+           handle.index < _slots.size() &&
+           _slots[handle.index].generation == handle.generation;
+  }
+
+  /// Returns nullptr if the handle doesn't refer to a live element.
+  T*
+  find(SlotHandle handle)
+  {
+    return contains(handle) ? &_values[_slots[handle.index].valueIndex] : nullptr;
+  }
+
+  T const*
+  find(SlotHandle handle) const
+  {
+    return contains(handle) ? &_values[_slots[handle.index].valueIndex] : nullptr;
+  }
+
+  std::size_t
+  size() const { return _values.size(); }
+
+  bool
+  empty() const { return _values.empty(); }
+
+  void
+  reserve(std::size_t n)
+  {
+    _values.reserve(n);
+    _valueSlots.reserve(n);
+    _slots.reserve(n);
+  }
+
+  T&
+  back() { return _values.back(); }
+
+  T const&
+  back() const { return _values.back(); }
+
+  iterator
+  begin() { return _values.begin(); }
+
+  iterator
+  end() { return _values.end(); }
+
+  const_iterator
+  begin() const { return _values.begin(); }
+
+  const_iterator
+  end() const { return _values.end(); }
+
+private:
+
+  struct Slot
+  {
+    std::uint32_t valueIndex = 0;
+    std::uint32_t generation = 1;
+  };
+
+  std::vector<T>             _values;
+  std::vector<std::uint32_t> _valueSlots; // value index => slot index
+  std::vector<Slot>          _slots;
+  std::vector<std::uint32_t> _freeSlots;
+};
+}
+
+namespace std
+{
+template<>
+struct hash<QtNodes::SlotHandle>
+{
+  inline
+  std::size_t
+  operator()(QtNodes::SlotHandle const& handle) const
+  {
+    return std::hash<std::uint64_t>()((std::uint64_t(handle.generation) << 32) |
+                                      handle.index);
+  }
+};
+}
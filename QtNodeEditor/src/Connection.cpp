@@ -1,5 +1,6 @@
 #include "Connection.hpp"
 
+#include <atomic>
 #include <cmath>
 #include <utility>
 
@@ -30,11 +31,13 @@ using QtNodes::ConnectionGraphicsObject;
 using QtNodes::ConnectionGeometry;
 using QtNodes::TypeConverter;
 
+static std::atomic<std::uint64_t> lastConnectionId(0);
+
 Connection::
 Connection(PortType portType,
            Node& node,
            PortIndex portIndex)
-  : _uid(QUuid::createUuid())
+  : _id(++lastConnectionId)
   , _style(QtNodes::StyleCollection::connectionStyle())
   , _outPortIndex(INVALID)
   , _inPortIndex(INVALID)
@@ -52,7 +55,7 @@ Connection(Node& nodeIn,
            Node& nodeOut,
            PortIndex portIndexOut,
            TypeConverter typeConverter)
-  : _uid(QUuid::createUuid())
+  : _id(++lastConnectionId)
   , _outNode(&nodeOut)
   , _inNode(&nodeIn)
   , _outPortIndex(portIndexOut)
@@ -90,10 +93,10 @@ save() const
 
   if (_inNode && _outNode)
   {
-    connectionJson["in_id"] = _inNode->id().toString();
+    connectionJson["in_id"] = _inNode->uuid().toString();
     connectionJson["in_index"] = _inPortIndex;
 
-    connectionJson["out_id"] = _outNode->id().toString();
+    connectionJson["out_id"] = _outNode->uuid().toString();
     connectionJson["out_index"] = _outPortIndex;
 
     if (_converter)
@@ -121,11 +124,11 @@ save() const
 }
 
 
-QUuid
+std::uint64_t
 Connection::
 id() const
 {
-  return _uid;
+  return _id;
 }
 
 
@@ -153,6 +156,19 @@ setRequiredPort(PortType dragging)
 }
 
 
+void
+Connection::
+setStyle(ConnectionStyle style)
+{
+  _style = style;
+
+  if (_connectionGraphicsObject)
+  {
+    _connectionGraphicsObject->repaint();
+  }
+}
+
+
 PortType
 Connection::
 requiredPort() const
@@ -249,10 +265,10 @@ Connection::
 removeFromNodes() const
 {
   if (_inNode)
-    _inNode->nodeState().eraseConnection(PortType::In, _inPortIndex, id());
+    _inNode->nodeState().eraseConnection(PortType::In, _inPortIndex, *this);
 
   if (_outNode)
-    _outNode->nodeState().eraseConnection(PortType::Out, _outPortIndex, id());
+    _outNode->nodeState().eraseConnection(PortType::Out, _outPortIndex, *this);
 }
 
 
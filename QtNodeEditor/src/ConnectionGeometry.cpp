@@ -16,6 +16,8 @@ ConnectionGeometry()
   , _lineWidth(3.0)
   , _hovered(false)
   , _ports_layout( PortLayout::Horizontal )
+  , _cacheDirty(true)
+  , _strokeDirty(true)
 { }
 
 QPointF const&
@@ -37,16 +39,21 @@ setEndPoint(PortType portType, QPointF const& point)
   switch (portType)
   {
     case PortType::Out:
+      if (_out == point)
+        return;
       _out = point;
       break;
 
     case PortType::In:
+      if (_in == point)
+        return;
       _in = point;
       break;
 
     default:
-      break;
+      return;
   }
+  invalidateCache();
 }
 
 
@@ -65,8 +72,9 @@ moveEndPoint(PortType portType, QPointF const &offset)
       break;
 
     default:
-      break;
+      return;
   }
+  invalidateCache();
 }
 
 
@@ -74,8 +82,64 @@ QRectF
 ConnectionGeometry::
 boundingRect() const
 {
+  updateCache();
+  return _boundingRect;
+}
+
+
+QPainterPath const&
+ConnectionGeometry::
+cubicPath() const
+{
+  updateCache();
+  return _cubicPath;
+}
+
+
+QPainterPath const&
+ConnectionGeometry::
+strokeShape() const
+{
+  if (!_strokeDirty)
+    return _strokeShape;
+
+  _strokeDirty = false;
+
+  // the hit-test shape is a polyline approximation of the spline,
+  // widened by a stroker
+  QPainterPath const& path = cubicPath();
+  QPainterPath polyline(_out);
+
+  unsigned const segments = 20;
+
+  for (auto i = 0ul; i < segments; ++i)
+  {
+    double ratio = double(i + 1) / segments;
+    polyline.lineTo(path.pointAtPercent(ratio));
+  }
+
+  QPainterPathStroker stroker; stroker.setWidth(10.0);
+
+  _strokeShape = stroker.createStroke(polyline);
+  return _strokeShape;
+}
+
+
+void
+ConnectionGeometry::
+updateCache() const
+{
+  if (!_cacheDirty)
+    return;
+
+  _cacheDirty = false;
+
   auto points = pointsC1C2();
 
+  // cubic spline
+  _cubicPath = QPainterPath(_out);
+  _cubicPath.cubicTo(points.first, points.second, _in);
+
   QRectF basicRect = QRectF(_out, _in).normalized();
 
   QRectF c1c2Rect = QRectF(points.first, points.second).normalized();
@@ -92,7 +156,7 @@ boundingRect() const
   commonRect.setTopLeft(commonRect.topLeft() - cornerOffset);
   commonRect.setBottomRight(commonRect.bottomRight() + 2 * cornerOffset);
 
-  return commonRect;
+  _boundingRect = commonRect;
 }
 
 
@@ -138,5 +202,8 @@ pointsC1C2() const
 
 void ConnectionGeometry::setPortLayout(QtNodes::PortLayout layout)
 {
+  if (_ports_layout == layout)
+    return;
   _ports_layout = layout;
+  invalidateCache();
 }
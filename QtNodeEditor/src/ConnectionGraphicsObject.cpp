@@ -41,6 +41,12 @@ ConnectionGraphicsObject(FlowScene &scene,
   // addGraphicsEffect();
 
   setZValue(-1.0);
+
+  // drawn by the scene ConnectionLayer instead
+  if (_scene.connectionLayerEnabled())
+  {
+    setVisible(false);
+  }
 }
 
 
@@ -100,6 +106,16 @@ void
 ConnectionGraphicsObject::
 move()
 {
+  if (_scene.isConnectionBatchOpen())
+  {
+    // recomputed once, when the batch is closed
+    _scene.markConnectionDirty(_connection);
+    return;
+  }
+
+  // the bounding rect is about to change
+  setGeometryChanged();
+
   for(PortType portType: { PortType::In, PortType::Out } )
   {
     if (auto node = _connection.getNode(portType))
@@ -119,12 +135,32 @@ move()
 
       _connection.connectionGeometry().setEndPoint(portType,
                                                    connectionPos);
-
-      _connection.connectionGraphicsObject().setGeometryChanged();
-      _connection.connectionGraphicsObject().update();
     }
   }
 
+  if (_scene.connectionLayerEnabled())
+  {
+    _scene.invalidateConnectionLayer();
+  }
+  else
+  {
+    update();
+  }
+}
+
+
+void
+ConnectionGraphicsObject::
+repaint()
+{
+  if (_scene.connectionLayerEnabled())
+  {
+    _scene.updateConnectionLayer();
+  }
+  else
+  {
+    update();
+  }
 }
 
 void ConnectionGraphicsObject::lock(bool locked)
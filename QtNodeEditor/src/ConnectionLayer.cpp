@@ -0,0 +1,151 @@
+#include "ConnectionLayer.hpp"
+
+#include <vector>
+
+#include <QtGui/QPainter>
+#include <QtWidgets/QStyleOptionGraphicsItem>
+
+#include "FlowScene.hpp"
+#include "Connection.hpp"
+#include "ConnectionGeometry.hpp"
+#include "ConnectionGraphicsObject.hpp"
+
+using QtNodes::ConnectionLayer;
+using QtNodes::FlowScene;
+using QtNodes::Connection;
+using QtNodes::ConnectionGeometry;
+
+namespace
+{
+
+struct PathGroup
+{
+  QPen   pen;
+  QBrush brush;
+  QPainterPath path;
+};
+
+QPainterPath&
+groupPath(std::vector<PathGroup>& groups, QPen const& pen, QBrush const& brush)
+{
+  // a tree uses very few different styles, a linear search is enough
+  for (auto& group : groups)
+  {
+    if (group.pen == pen && group.brush == brush)
+      return group.path;
+  }
+
+  groups.push_back( PathGroup{ pen, brush, QPainterPath() } );
+  return groups.back().path;
+}
+
+}
+
+
+ConnectionLayer::
+ConnectionLayer(FlowScene &scene)
+  : _scene(scene)
+  , _boundsDirty(true)
+{
+  _scene.addItem(this);
+
+  setAcceptedMouseButtons(Qt::NoButton);
+  setAcceptHoverEvents(false);
+
+  // same as ConnectionGraphicsObject: below the nodes
+  setZValue(-1.0);
+}
+
+
+ConnectionLayer::
+~ConnectionLayer()
+{
+  _scene.removeItem(this);
+}
+
+
+QRectF
+ConnectionLayer::
+boundingRect() const
+{
+  if (_boundsDirty)
+  {
+    _boundsDirty = false;
+    _boundingRect = QRectF();
+
+    for (auto const & stored : _scene.connections())
+    {
+      Connection const& connection = *stored;
+
+      QPointF offset = connection.connectionGraphicsObject().pos();
+
+      _boundingRect |= connection.connectionGeometry().boundingRect().translated(offset);
+    }
+  }
+
+  return _boundingRect;
+}
+
+
+void
+ConnectionLayer::
+invalidate()
+{
+  if (!_boundsDirty)
+  {
+    prepareGeometryChange();
+    _boundsDirty = true;
+  }
+
+  update();
+}
+
+
+void
+ConnectionLayer::
+paint(QPainter* painter,
+      QStyleOptionGraphicsItem const* option,
+      QWidget*)
+{
+  painter->setClipRect(option->exposedRect);
+
+  std::vector<PathGroup> lines;
+  std::vector<PathGroup> points;
+
+  for (auto const & stored : _scene.connections())
+  {
+    Connection const& connection = *stored;
+
+    // connections being dragged are never drawn by the layer
+    if (connection.connectionState().requiresPort())
+      continue;
+
+    ConnectionGeometry const& geom = connection.connectionGeometry();
+
+    QPointF offset = connection.connectionGraphicsObject().pos();
+
+    auto const connectionStyle = connection.style();
+
+    QPen linePen(connectionStyle.normalColor(), connectionStyle.lineWidth());
+
+    groupPath(lines, linePen, Qt::NoBrush).addPath(geom.cubicPath().translated(offset));
+
+    // end points
+    QColor const pointColor = connectionStyle.constructionColor();
+    double const pointRadius = connectionStyle.pointDiameter() / 2.0;
+
+    QPainterPath& pointPath = groupPath(points, QPen(pointColor), QBrush(pointColor));
+    pointPath.addEllipse(geom.source() + offset, pointRadius, pointRadius);
+    pointPath.addEllipse(geom.sink() + offset, pointRadius, pointRadius);
+  }
+
+  for (auto const & groups : { &lines, &points })
+  {
+    for (auto const & group : *groups)
+    {
+      painter->setPen(group.pen);
+      painter->setBrush(group.brush);
+      painter->drawPath(group.path);
+    }
+  }
+}
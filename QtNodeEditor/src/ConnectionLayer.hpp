@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QtWidgets/QGraphicsItem>
+
+namespace QtNodes
+{
+
+class FlowScene;
+
+/// Single graphics item drawing all the connections of a FlowScene.
+/// Used instead of the per-connection ConnectionGraphicsObject when the
+/// connections are not interactive (locked scenes): the connections are
+/// grouped by pen and each group is drawn with a single QPainterPath.
+/// Adds itself to the scene.
+class ConnectionLayer
+  : public QGraphicsItem
+{
+public:
+
+  ConnectionLayer(FlowScene &scene);
+
+  virtual
+  ~ConnectionLayer();
+
+  enum { Type = UserType + 3 };
+  int
+  type() const override { return Type; }
+
+public:
+
+  QRectF
+  boundingRect() const override;
+
+  /// To be called when a connection was moved, added or removed: the
+  /// bounding rect is recomputed. A restyled connection only needs update().
+  void
+  invalidate();
+
+protected:
+
+  void
+  paint(QPainter* painter,
+        QStyleOptionGraphicsItem const* option,
+        QWidget* widget = 0) override;
+
+private:
+
+  FlowScene & _scene;
+
+  mutable bool _boundsDirty;
+
+  mutable QRectF _boundingRect;
+};
+}
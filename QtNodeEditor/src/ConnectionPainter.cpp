@@ -17,44 +17,11 @@ using QtNodes::ConnectionGeometry;
 using QtNodes::Connection;
 
 
-static
-QPainterPath
-cubicPath(ConnectionGeometry const& geom)
-{
-  QPointF const& source = geom.source();
-  QPointF const& sink   = geom.sink();
-
-  auto c1c2 = geom.pointsC1C2();
-
-  // cubic spline
-  QPainterPath cubic(source);
-
-  cubic.cubicTo(c1c2.first, c1c2.second, sink);
-
-  return cubic;
-}
-
-
 QPainterPath
 ConnectionPainter::
 getPainterStroke(ConnectionGeometry const& geom)
 {
-  auto cubic = cubicPath(geom);
-
-  QPointF const& source = geom.source();
-  QPainterPath result(source);
-
-  unsigned segments = 20;
-
-  for (auto i = 0ul; i < segments; ++i)
-  {
-    double ratio = double(i + 1) / segments;
-    result.lineTo(cubic.pointAtPercent(ratio));
-  }
-
-  QPainterPathStroker stroker; stroker.setWidth(10.0);
-
-  return stroker.createStroke(result);
+  return geom.strokeShape();
 }
 
 
@@ -86,7 +53,7 @@ debugDrawing(QPainter * painter,
 
     painter->setBrush(Qt::NoBrush);
 
-    painter->drawPath(cubicPath(geom));
+    painter->drawPath(geom.cubicPath());
   }
 
   {
@@ -122,9 +89,8 @@ drawSketchLine(QPainter * painter,
     using QtNodes::ConnectionGeometry;
     ConnectionGeometry const& geom = connection.connectionGeometry();
 
-    auto cubic = cubicPath(geom);
     // cubic spline
-    painter->drawPath(cubic);
+    painter->drawPath(geom.cubicPath());
   }
 }
 
@@ -160,8 +126,7 @@ drawHoveredOrSelected(QPainter * painter,
     painter->setBrush(Qt::NoBrush);
 
     // cubic spline
-    auto cubic = cubicPath(geom);
-    painter->drawPath(cubic);
+    painter->drawPath(geom.cubicPath());
   }
 }
 
@@ -218,7 +183,7 @@ drawNormalLine(QPainter * painter,
   bool const selected = graphicsObject.isSelected();
 
 
-  auto cubic = cubicPath(geom);
+  QPainterPath const& cubic = geom.cubicPath();
   if (gradientColor)
   {
     painter->setBrush(Qt::NoBrush);
@@ -1,5 +1,6 @@
 #include "FlowScene.hpp"
 
+#include <atomic>
 #include <stdexcept>
 #include <utility>
 
@@ -23,6 +24,7 @@
 #include "ConnectionGraphicsObject.hpp"
 
 #include "Connection.hpp"
+#include "ConnectionLayer.hpp"
 
 #include "FlowView.hpp"
 #include "DataModelRegistry.hpp"
@@ -37,12 +39,19 @@ using QtNodes::PortType;
 using QtNodes::PortIndex;
 using QtNodes::TypeConverter;
 
+static std::atomic<std::uint64_t> lastRevision(0);
+
 
 FlowScene::
 FlowScene(std::shared_ptr<DataModelRegistry> registry,
           QObject * parent)
   : QGraphicsScene(parent)
   , _registry(std::move(registry))
+  , _connectionBatchDepth(0)
+  , _bulkBuildDepth(0)
+  , _bulkBuildCancelled(false)
+  , _revision(++lastRevision)
+  , _contentRevision(_revision)
 {
   setItemIndexMethod(QGraphicsScene::NoIndex);
 }
@@ -58,6 +67,7 @@ FlowScene::
 ~FlowScene()
 {
   clearScene();
+  _connectionLayer.reset();
 }
 
 
@@ -78,7 +88,8 @@ createConnection(PortType connectedPort,
 
   connection->connectionGeometry().setPortLayout( layout() );
 
-  _connections[connection->id()] = connection;
+  connection->_handle = _connections.insert(SharedConnection(connection));
+  bumpRevision();
 
   return connection;
 }
@@ -124,9 +135,10 @@ createConnection(Node& nodeIn,
   // trigger data propagation
   nodeOut.onDataUpdated(portIndexOut);
 
-  _connections[connection->id()] = connection;
+  connection->_handle = _connections.insert(SharedConnection(connection));
+  bumpRevision();
 
-  connectionCreated(*connection);
+  publishConnectionCreated(*connection);
 
   return connection;
 }
@@ -135,6 +147,21 @@ createConnection(Node& nodeIn,
 std::shared_ptr<Connection>
 FlowScene::
 restoreConnection(QJsonObject const &connectionJson)
+{
+  std::unordered_map<QUuid, Node*> nodesByUuid;
+  nodesByUuid.reserve(_nodes.size());
+
+  for (auto const & node : _nodes)
+    nodesByUuid[node->uuid()] = node.get();
+
+  return restoreConnection(connectionJson, nodesByUuid);
+}
+
+
+std::shared_ptr<Connection>
+FlowScene::
+restoreConnection(QJsonObject const &connectionJson,
+                  std::unordered_map<QUuid, Node*> const &nodesByUuid)
 {
   QUuid nodeInId  = QUuid(connectionJson["in_id"].toString());
   QUuid nodeOutId = QUuid(connectionJson["out_id"].toString());
@@ -142,8 +169,14 @@ restoreConnection(QJsonObject const &connectionJson)
   PortIndex portIndexIn  = connectionJson["in_index"].toInt();
   PortIndex portIndexOut = connectionJson["out_index"].toInt();
 
-  auto nodeIn  = _nodes[nodeInId].get();
-  auto nodeOut = _nodes[nodeOutId].get();
+  auto findNode = [&](QUuid const& uuid) -> Node*
+  {
+    auto it = nodesByUuid.find(uuid);
+    return (it != nodesByUuid.end()) ? it->second : nullptr;
+  };
+
+  auto nodeIn  = findNode(nodeInId);
+  auto nodeOut = findNode(nodeOutId);
 
   auto getConverter = [&]()
   {
@@ -182,7 +215,7 @@ restoreConnection(QJsonObject const &connectionJson)
                      *nodeOut, portIndexOut,
                      getConverter());
 
-  connectionCreated(*connection);
+  publishConnectionCreated(*connection);
 
   connection->connectionGeometry().setPortLayout( layout() );
   return connection;
@@ -193,8 +226,15 @@ void
 FlowScene::
 deleteConnection(Connection& connection)
 {
+  // keep the connection alive until the listeners have been notified
+  SharedConnection keepAlive;
+  if (auto stored = _connections.find(connection.handle()))
+    keepAlive = *stored;
+
   connection.removeFromNodes();
-  _connections.erase(connection.id());
+  _connections.erase(connection.handle());
+  bumpRevision();
+  invalidateConnectionLayer();
   connectionDeleted(connection);
 }
 
@@ -210,10 +250,10 @@ createNode(std::unique_ptr<NodeDataModel> && dataModel)
 
   auto nodePtr = node.get();
   nodePtr->nodeGeometry().setPortLayout( layout() );
-  auto id = node->id();
-  _nodes[id] = std::move(node);
+  nodePtr->_handle = _nodes.insert(std::move(node));
+  bumpRevision();
 
-  nodeCreated(*nodePtr);
+  publishNodeCreated(*nodePtr);
   return *nodePtr;
 }
 
@@ -240,13 +280,15 @@ restoreNode(QJsonObject const& nodeJson)
 
   node->nodeState().getEntries(PortType::In).resize( node->nodeDataModel()->nPorts(PortType::In));
   node->nodeState().getEntries(PortType::Out).resize( node->nodeDataModel()->nPorts(PortType::Out));
+  // the number of ports may depend on the restored state
+  node->nodeGeometry().invalidate();
 
   auto nodePtr = node.get();
   nodePtr->nodeGeometry().setPortLayout( layout() );
-  auto id = node->id();
-  _nodes[ id ] = std::move(node);
+  nodePtr->_handle = _nodes.insert(std::move(node));
+  bumpRevision();
 
-  nodeCreated(*nodePtr);
+  publishNodeCreated(*nodePtr);
   return *nodePtr;
 }
 
@@ -258,19 +300,26 @@ removeNode(Node& node)
   // call signal
   nodeDeleted(node);
 
+  // deleting a connection removes it from the entries (and the listeners
+  // may delete others): work on a copy of the handles
+  std::vector<SlotHandle> connectionHandles;
   for(auto portType: {PortType::In,PortType::Out})
   {
-    auto nodeState = node.nodeState();
-    auto const & nodeEntries = nodeState.getEntries(portType);
-
-    for (auto &connections : nodeEntries)
+    for (auto const &connections : node.nodeState().getEntries(portType))
     {
-      for (auto const &pair : connections)
-        deleteConnection(*pair.second);
+      for (Connection* connection : connections)
+        connectionHandles.push_back(connection->handle());
     }
   }
 
-  _nodes.erase(node.id());
+  for (auto const &handle : connectionHandles)
+  {
+    if (Connection* stillThere = connection(handle))
+      deleteConnection(*stillThere);
+  }
+
+  _nodes.erase(node.handle());
+  bumpRevision();
 }
 
 
@@ -296,7 +345,7 @@ iterateOverNodes(std::function<void(Node*)> const & visitor)
 {
   for (const auto& _node : _nodes)
   {
-    visitor(_node.second.get());
+    visitor(_node.get());
   }
 }
 
@@ -307,7 +356,7 @@ iterateOverNodeData(std::function<void(NodeDataModel*)> const & visitor)
 {
   for (const auto& _node : _nodes)
   {
-    visitor(_node.second->nodeDataModel());
+    visitor(_node->nodeDataModel());
   }
 }
 
@@ -316,7 +365,7 @@ void
 FlowScene::
 iterateOverNodeDataDependentOrder(std::function<void(NodeDataModel*)> const & visitor)
 {
-  std::set<QUuid> visitedNodesSet;
+  std::unordered_set<std::uint64_t> visitedNodesSet;
 
   //A leaf node is a node with no input ports, or all possible input ports empty
   auto isNodeLeaf =
@@ -324,8 +373,7 @@ iterateOverNodeDataDependentOrder(std::function<void(NodeDataModel*)> const & vi
     {
       for (unsigned int i = 0; i < model.nPorts(PortType::In); ++i)
       {
-        auto connections = node.nodeState().connections(PortType::In, i);
-        if (!connections.empty())
+        if (!node.nodeState().connections(PortType::In, i).empty())
         {
           return false;
         }
@@ -335,10 +383,9 @@ iterateOverNodeDataDependentOrder(std::function<void(NodeDataModel*)> const & vi
     };
 
   //Iterate over "leaf" nodes
-  for (auto const &_node : _nodes)
+  for (auto const &node : _nodes)
   {
-    auto const &node = _node.second;
-    auto model       = node->nodeDataModel();
+    auto model = node->nodeDataModel();
 
     if (isNodeLeaf(*node, *model))
     {
@@ -352,11 +399,9 @@ iterateOverNodeDataDependentOrder(std::function<void(NodeDataModel*)> const & vi
     {
       for (size_t i = 0; i < model.nPorts(PortType::In); ++i)
       {
-        auto connections = node.nodeState().connections(PortType::In, i);
-
-        for (auto& conn : connections)
+        for (Connection* conn : node.nodeState().connections(PortType::In, i))
         {
-          if (visitedNodesSet.find(conn.second->getNode(PortType::Out)->id()) == visitedNodesSet.end())
+          if (visitedNodesSet.find(conn->getNode(PortType::Out)->id()) == visitedNodesSet.end())
           {
             return false;
           }
@@ -369,9 +414,8 @@ iterateOverNodeDataDependentOrder(std::function<void(NodeDataModel*)> const & vi
   //Iterate over dependent nodes
   while (_nodes.size() != visitedNodesSet.size())
   {
-    for (auto const &_node : _nodes)
+    for (auto const &node : _nodes)
     {
-      auto const &node = _node.second;
       if (visitedNodesSet.find(node->id()) != visitedNodesSet.end())
         continue;
 
@@ -399,8 +443,9 @@ void
 FlowScene::
 setNodePosition(Node& node, const QPointF& pos) const
 {
+  // the connections follow from NodeGraphicsObject::itemChange(), at once
+  // or at the end of the connection batch
   node.nodeGraphicsObject().setPos(pos);
-  node.nodeGraphicsObject().moveConnections();
 }
 
 
@@ -413,7 +458,208 @@ getNodeSize(const Node& node) const
 }
 
 
-std::unordered_map<QUuid, std::unique_ptr<Node> > const &
+void
+FlowScene::
+beginConnectionBatch()
+{
+  _connectionBatchDepth++;
+}
+
+
+void
+FlowScene::
+endConnectionBatch()
+{
+  Q_ASSERT(_connectionBatchDepth > 0);
+
+  if (--_connectionBatchDepth > 0)
+    return;
+
+  std::unordered_set<SlotHandle> dirty;
+  dirty.swap(_dirtyConnections);
+
+  for (auto const & handle : dirty)
+  {
+    // the connection may have been deleted in the meantime
+    if (auto conn = connection(handle))
+    {
+      conn->connectionGraphicsObject().move();
+    }
+  }
+}
+
+
+void
+FlowScene::
+markConnectionDirty(Connection const& connection)
+{
+  _dirtyConnections.insert(connection.handle());
+}
+
+
+void
+FlowScene::
+beginBulkBuild()
+{
+  _bulkBuildDepth++;
+  beginConnectionBatch();
+}
+
+
+void
+FlowScene::
+endBulkBuild()
+{
+  closeBulkBuild(false);
+}
+
+
+void
+FlowScene::
+cancelBulkBuild()
+{
+  closeBulkBuild(true);
+}
+
+
+void
+FlowScene::
+closeBulkBuild(bool cancelled)
+{
+  Q_ASSERT(_bulkBuildDepth > 0);
+
+  endConnectionBatch();
+
+  // a nested build that failed spoils the whole one
+  _bulkBuildCancelled = _bulkBuildCancelled || cancelled;
+
+  if (--_bulkBuildDepth > 0)
+    return;
+
+  // the containers are swapped out, a slot may start another bulk build
+  std::vector<SlotHandle> createdNodes;
+  std::vector<SlotHandle> createdConnections;
+  createdNodes.swap(_bulkCreatedNodes);
+  createdConnections.swap(_bulkCreatedConnections);
+
+  if (_bulkBuildCancelled)
+  {
+    _bulkBuildCancelled = false;
+    return;
+  }
+
+  for (auto const & handle : createdNodes)
+  {
+    // skip what was removed in the meantime
+    if (auto createdNode = node(handle))
+    {
+      nodeCreated(*createdNode);
+    }
+  }
+
+  for (auto const & handle : createdConnections)
+  {
+    if (auto createdConnection = connection(handle))
+    {
+      connectionCreated(*createdConnection);
+    }
+  }
+}
+
+
+void
+FlowScene::
+setConnectionLayerEnabled(bool enabled)
+{
+  if (enabled == connectionLayerEnabled())
+    return;
+
+  if (enabled)
+  {
+    _connectionLayer = detail::make_unique<ConnectionLayer>(*this);
+  }
+  else
+  {
+    _connectionLayer.reset();
+  }
+
+  for (auto const & conn : _connections)
+  {
+    conn->connectionGraphicsObject().setVisible(!enabled);
+  }
+}
+
+
+void
+FlowScene::
+bumpRevision()
+{
+  _revision = ++lastRevision;
+  _contentRevision = _revision;
+}
+
+
+void
+FlowScene::
+bumpPositionRevision()
+{
+  _revision = ++lastRevision;
+}
+
+
+void
+FlowScene::
+updateConnectionLayer()
+{
+  if (_connectionLayer)
+  {
+    _connectionLayer->update();
+  }
+}
+
+
+void
+FlowScene::
+invalidateConnectionLayer()
+{
+  if (_connectionLayer)
+  {
+    _connectionLayer->invalidate();
+  }
+}
+
+
+void
+FlowScene::
+publishNodeCreated(Node& node)
+{
+  if (isBulkBuilding())
+  {
+    _bulkCreatedNodes.push_back(node.handle());
+  }
+  else
+  {
+    nodeCreated(node);
+  }
+}
+
+
+void
+FlowScene::
+publishConnectionCreated(Connection& connection)
+{
+  if (isBulkBuilding())
+  {
+    _bulkCreatedConnections.push_back(connection.handle());
+  }
+  else
+  {
+    connectionCreated(connection);
+  }
+}
+
+
+SlotMap<std::unique_ptr<Node> > const &
 FlowScene::
 nodes() const
 {
@@ -421,7 +667,7 @@ nodes() const
 }
 
 
-std::unordered_map<QUuid, std::shared_ptr<Connection> > const &
+SlotMap<std::shared_ptr<Connection> > const &
 FlowScene::
 connections() const
 {
@@ -429,6 +675,24 @@ connections() const
 }
 
 
+Node*
+FlowScene::
+node(SlotHandle handle) const
+{
+  auto stored = _nodes.find(handle);
+  return stored ? stored->get() : nullptr;
+}
+
+
+Connection*
+FlowScene::
+connection(SlotHandle handle) const
+{
+  auto stored = _connections.find(handle);
+  return stored ? stored->get() : nullptr;
+}
+
+
 std::vector<Node*>
 FlowScene::
 selectedNodes() const
@@ -461,14 +725,15 @@ clearScene()
   //Manual node cleanup. Simply clearing the holding datastructures doesn't work, the code crashes when
   // there are both nodes and connections in the scene. (The data propagation internal logic tries to propagate
   // data through already freed connections.)
+  // removing from the back never moves the remaining elements
   while (_connections.size() > 0)
   {
-    deleteConnection( *_connections.begin()->second );
+    deleteConnection( *_connections.back() );
   }
 
   while (_nodes.size() > 0)
   {
-    removeNode( *_nodes.begin()->second );
+    removeNode( *_nodes.back() );
   }
 }
 
@@ -533,9 +798,8 @@ saveToMemory() const
 
   QJsonArray nodesJsonArray;
 
-  for (auto const & pair : _nodes)
+  for (auto const & node : _nodes)
   {
-    const FlowScene::UniqueNode &node = pair.second;
     if(node)
     {
       nodesJsonArray.append(node->save());
@@ -548,9 +812,8 @@ saveToMemory() const
   sceneJson["nodes"] = nodesJsonArray;
 
   QJsonArray connectionJsonArray;
-  for (auto const & pair : _connections)
+  for (auto const & connection : _connections)
   {
-    auto const &connection = pair.second;
     if(connection)
     {
       QJsonObject connectionJson = connection->save();
@@ -577,18 +840,26 @@ loadFromMemory(const QByteArray& data)
   QString layout = jsonDocument["layout"].toString();
   setLayout( (layout == "Horizontal") ? PortLayout::Horizontal : PortLayout::Vertical );
 
+  BulkBuildGuard bulkBuild(*this);
+
   QJsonArray nodesJsonArray = jsonDocument["nodes"].toArray();
 
+  // connections refer to the nodes by the UUIDs stored in the file
+  std::unordered_map<QUuid, Node*> nodesByUuid;
+  nodesByUuid.reserve(nodesJsonArray.size());
+  _nodes.reserve(_nodes.size() + nodesJsonArray.size());
+
   for (QJsonValueRef node : nodesJsonArray)
   {
-    restoreNode(node.toObject());
+    Node& restored = restoreNode(node.toObject());
+    nodesByUuid[restored.uuid()] = &restored;
   }
 
   QJsonArray connectionJsonArray = jsonDocument["connections"].toArray();
 
   for (QJsonValueRef connection : connectionJsonArray)
   {
-    restoreConnection(connection.toObject());
+    restoreConnection(connection.toObject(), nodesByUuid);
   }
 }
 
@@ -598,11 +869,11 @@ void FlowScene::setLayout( QtNodes::PortLayout layout)
   _layout = layout;
   for(auto& node: nodes() )
   {
-    node.second->nodeGeometry().setPortLayout(layout);
+    node->nodeGeometry().setPortLayout(layout);
   }
   for(auto& conn: connections() )
   {
-    conn.second->connectionGeometry().setPortLayout(layout);
+    conn->connectionGeometry().setPortLayout(layout);
   }
 }
 
@@ -0,0 +1,41 @@
+#include "FontMetricsCache.hpp"
+
+#include <map>
+
+using QtNodes::FontMetricsCache;
+
+FontMetricsCache::SharedMetrics
+FontMetricsCache::
+metrics(QFont const& font)
+{
+  static std::map<QString, SharedMetrics> cache;
+
+  auto it = cache.find(font.key());
+
+  if (it != cache.end())
+  {
+    return it->second;
+  }
+
+  // zooming with many font sizes must not grow the cache forever
+  if (cache.size() >= MaxFonts)
+  {
+    cache.clear();
+  }
+
+  SharedMetrics metrics = std::make_shared<QFontMetrics const>(font);
+  cache.emplace(font.key(), metrics);
+
+  return metrics;
+}
+
+
+FontMetricsCache::SharedMetrics
+FontMetricsCache::
+boldMetrics(QFont const& font)
+{
+  QFont boldFont = font;
+  boldFont.setPointSize(12);
+
+  return metrics(boldFont);
+}
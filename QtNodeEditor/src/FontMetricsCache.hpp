@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QtGui/QFont>
+#include <QtGui/QFontMetrics>
+
+#include <memory>
+
+namespace QtNodes
+{
+
+/// Process-wide cache of QFontMetrics, shared by all the nodes.
+/// Building a QFontMetrics is not free and every NodeGeometry used to own
+/// its private pair; since all the nodes of a scene are painted with the
+/// same fonts, a single instance per font is enough.
+/// The cache holds at most MaxFonts entries and is emptied when it grows
+/// past that; the metrics are shared, so the geometries still holding
+/// them are not affected.
+/// Must be used from the GUI thread only.
+class FontMetricsCache
+{
+public:
+
+  using SharedMetrics = std::shared_ptr<QFontMetrics const>;
+
+  static
+  SharedMetrics
+  metrics(QFont const& font);
+
+  /// Metrics of the font used for the validation messages.
+  static
+  SharedMetrics
+  boldMetrics(QFont const& font);
+
+private:
+
+  static constexpr std::size_t MaxFonts = 32;
+
+  FontMetricsCache() = delete;
+};
+}
@@ -2,6 +2,7 @@
 
 #include <QtCore/QObject>
 
+#include <atomic>
 #include <utility>
 #include <iostream>
 
@@ -23,9 +24,11 @@ using QtNodes::NodeGraphicsObject;
 using QtNodes::PortIndex;
 using QtNodes::PortType;
 
+static std::atomic<std::uint64_t> lastNodeId(0);
+
 Node::
 Node(std::unique_ptr<NodeDataModel> && dataModel)
-  : _uid(QUuid::createUuid())
+  : _id(++lastNodeId)
   , _nodeDataModel(std::move(dataModel))
   , _nodeState(_nodeDataModel)
   , _nodeGeometry(_nodeDataModel)
@@ -51,7 +54,7 @@ save() const
 {
   QJsonObject nodeJson;
 
-  nodeJson["id"] = _uid.toString();
+  nodeJson["id"] = uuid().toString();
 
   nodeJson["model"] = _nodeDataModel->save();
 
@@ -70,7 +73,7 @@ void
 Node::
 restore(QJsonObject const& json)
 {
-  _uid = QUuid(json["id"].toString());
+  _uuid = QUuid(json["id"].toString());
   _nodeDataModel->restore(json["model"].toObject());
 
   double width = _nodeGraphicsObject->boundingRect().width();
@@ -83,11 +86,31 @@ restore(QJsonObject const& json)
 }
 
 
-QUuid
+std::uint64_t
 Node::
 id() const
 {
-  return _uid;
+  return _id;
+}
+
+
+QUuid
+Node::
+uuid() const
+{
+  if (_uuid.isNull())
+  {
+    _uuid = QUuid::createUuid();
+  }
+  return _uuid;
+}
+
+
+void
+Node::
+setUuid(QUuid const& uuid)
+{
+  _uuid = uuid;
 }
 
 
@@ -207,11 +230,11 @@ onDataUpdated(PortIndex index)
 {
   auto nodeData = _nodeDataModel->outData(index);
 
-  auto connections =
+  auto const & connections =
     _nodeState.connections(PortType::Out, index);
 
-  for (auto const & c : connections)
-    c.second->propagateData(nodeData);
+  for (Connection* c : connections)
+    c->propagateData(nodeData);
 }
 
 void
@@ -237,9 +260,8 @@ onNodeSizeUpdated()
     {
         for(auto& conn_set : nodeState().getEntries(type))
         {
-            for(auto& pair: conn_set)
+            for(Connection* conn: conn_set)
             {
-                Connection* conn = pair.second;
                 conn->connectionGraphicsObject().move();
             }
         }
@@ -11,6 +11,7 @@
 #include "NodeGraphicsObject.hpp"
 
 #include "StyleCollection.hpp"
+#include "FontMetricsCache.hpp"
 
 using QtNodes::NodeGeometry;
 using QtNodes::NodeDataModel;
@@ -18,6 +19,7 @@ using QtNodes::PortIndex;
 using QtNodes::PortType;
 using QtNodes::PortLayout;
 using QtNodes::Node;
+using QtNodes::FontMetricsCache;
 
 NodeGeometry::
 NodeGeometry(std::unique_ptr<NodeDataModel> const &dataModel)
@@ -30,13 +32,14 @@ NodeGeometry(std::unique_ptr<NodeDataModel> const &dataModel)
   , _hovered(false)
   , _draggingPos(-1000, -1000)
   , _dataModel(dataModel)
-  , _fontMetrics(QFont())
-  , _boldFontMetrics(QFont())
+  , _fontMetrics(FontMetricsCache::metrics(QFont()))
+  , _boldFontMetrics(FontMetricsCache::boldMetrics(QFont()))
+  , _dirty(true)
+  , _nSinks(0)
+  , _nSources(0)
+  , _valid(true)
   , _ports_layout(PortLayout::Vertical  )
 {
-  QFont f;
-  f.setPointSize(12);
-  _boldFontMetrics = QFontMetrics(f);
 }
 
 unsigned int
@@ -83,7 +86,14 @@ void
 NodeGeometry::
 recalculateSize() const
 {
-  _entryHeight = _fontMetrics.height();
+  _dirty = false;
+  _nSinks   = nSinks();
+  _nSources = nSources();
+  _widgetSize = QSize();
+  _valid = _dataModel->validationState() == NodeValidationState::Valid;
+  _validationMessage = _valid ? QString() : _dataModel->validationMessage();
+
+  _entryHeight = _fontMetrics->height();
 
   {
     unsigned int maxNumOfEntries = std::max(nSinks(), nSources());
@@ -106,6 +116,7 @@ recalculateSize() const
   if (auto w = _dataModel->embeddedWidget())
   {
     _width += w->width();
+    _widgetSize = w->size();
   }
 
   if (_dataModel->validationState() != NodeValidationState::Valid)
@@ -120,21 +131,47 @@ void
 NodeGeometry::
 recalculateSize(QFont const & font) const
 {
-  QFontMetrics fontMetrics(font);
-  QFont boldFont = font;
-  boldFont.setPointSize(12);
+  if (font != _font)
+  {
+    _font = font;
 
-  QFontMetrics boldFontMetrics(boldFont);
+    auto fontMetrics     = FontMetricsCache::metrics(font);
+    auto boldFontMetrics = FontMetricsCache::boldMetrics(font);
 
-  if (_boldFontMetrics != boldFontMetrics)
+    if (fontMetrics != _fontMetrics || boldFontMetrics != _boldFontMetrics)
+    {
+      _fontMetrics     = fontMetrics;
+      _boldFontMetrics = boldFontMetrics;
+      _dirty = true;
+    }
+  }
+
+  if (_dirty || outdated())
   {
-    _fontMetrics     = fontMetrics;
-    _boldFontMetrics = boldFontMetrics;
     recalculateSize();
   }
 }
 
 
+bool
+NodeGeometry::
+outdated() const
+{
+  if (nSinks() != _nSinks || nSources() != _nSources)
+    return true;
+
+  auto w = _dataModel->embeddedWidget();
+  if ((w ? w->size() : QSize()) != _widgetSize)
+    return true;
+
+  bool valid = _dataModel->validationState() == NodeValidationState::Valid;
+  if (valid != _valid)
+    return true;
+
+  return !valid && _dataModel->validationMessage() != _validationMessage;
+}
+
+
 QPointF
 NodeGeometry::
 portScenePosition(PortIndex index,
@@ -238,7 +275,7 @@ NodeGeometry::
 validationHeight() const
 {
   QString msg = _dataModel->validationMessage();
-  return _boldFontMetrics.boundingRect(msg).height();
+  return _boldFontMetrics->boundingRect(msg).height();
 }
 
 
@@ -247,7 +284,7 @@ NodeGeometry::
 validationWidth() const
 {
   QString msg = _dataModel->validationMessage();
-  return _boldFontMetrics.boundingRect(msg).width();
+  return _boldFontMetrics->boundingRect(msg).width();
 }
 
 
@@ -283,7 +320,7 @@ portWidth(PortType portType) const
   for (auto i = 0ul; i < _dataModel->nPorts(portType); ++i)
   {
     QString name = _dataModel->dataType(portType, i).name;
-    width = std::max(unsigned(_fontMetrics.width(name)), width);
+    width = std::max(unsigned(_fontMetrics->width(name)), width);
   }
 
   return width;
@@ -146,8 +146,8 @@ moveConnections() const
 
     for (auto const & connections : connectionEntries)
     {
-      for (auto & con : connections)
-        con.second->connectionGraphicsObject().move();
+      for (Connection* con : connections)
+        con->connectionGraphicsObject().move();
     }
   };
 }
@@ -177,9 +177,12 @@ QVariant
 NodeGraphicsObject::
 itemChange(GraphicsItemChange change, const QVariant &value)
 {
-  if (change == ItemPositionChange && scene())
+  // ItemPositionChange would be too early: the new position isn't set yet
+  if (change == ItemPositionHasChanged && scene())
   {
     moveConnections();
+    _scene.bumpPositionRevision();
+    _scene.nodePositionChanged(_node);
   }
 
   return QGraphicsItem::itemChange(change, value);
@@ -211,13 +214,13 @@ mousePressEvent(QGraphicsSceneMouseEvent * event)
     {
       NodeState const & nodeState = _node.nodeState();
 
-      std::unordered_map<QUuid, Connection*> connections =
+      NodeState::ConnectionPtrSet const & connections =
           nodeState.connections(portToCheck, portIndex);
 
       // start dragging existing connection
       if (!connections.empty() && portToCheck == PortType::In)
       {
-        auto con = connections.begin()->second;
+        auto con = connections.front();
 
         NodeConnectionInteraction interaction(_node, *con, _scene);
 
@@ -231,7 +234,7 @@ mousePressEvent(QGraphicsSceneMouseEvent * event)
           if (!connections.empty() &&
               outPolicy == NodeDataModel::ConnectionPolicy::One)
           {
-            _scene.deleteConnection( *connections.begin()->second );
+            _scene.deleteConnection( *connections.front() );
           }
 
           // todo add to FlowScene
@@ -298,10 +301,11 @@ mouseMoveEvent(QGraphicsSceneMouseEvent * event)
   }
   else
   {
-    QGraphicsObject::mouseMoveEvent(event);
+    // all the selected nodes are moved by the base class: itemChange()
+    // marks their connections, updated once at the end of this event
+    ConnectionBatchGuard connectionBatch(_scene);
 
-    if (event->lastPos() != event->pos())
-      moveConnections();
+    QGraphicsObject::mouseMoveEvent(event);
 
     event->ignore();
   }
@@ -237,6 +237,8 @@ drawEntryLabels(QPainter * painter,
                 NodeState const & state,
                 NodeDataModel const * model)
 {
+  // the metrics of the paint device: they differ from the screen ones when
+  // exporting to SVG/PNG or on HiDPI displays
   QFontMetrics const & metrics =
     painter->fontMetrics();
 
@@ -354,7 +356,7 @@ drawValidationRect(QPainter * painter,
 
     QFont f = painter->font();
 
-    QFontMetrics metrics(f);
+    QFontMetrics const & metrics = painter->fontMetrics();
 
     auto rect = metrics.boundingRect(errorMsg);
 
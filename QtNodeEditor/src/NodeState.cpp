@@ -1,5 +1,7 @@
 #include "NodeState.hpp"
 
+#include <algorithm>
+
 #include "NodeDataModel.hpp"
 
 #include "Connection.hpp"
@@ -43,14 +45,16 @@ getEntries(PortType portType)
 }
 
 
-NodeState::ConnectionPtrSet
+NodeState::ConnectionPtrSet const &
 NodeState::
 connections(PortType portType, PortIndex portIndex) const
 {
+  static const ConnectionPtrSet noConnections;
+
   auto const &connections = getEntries(portType);
   if( portIndex < 0 || static_cast<unsigned long>(portIndex) >= connections.size() )
   {
-    return NodeState::ConnectionPtrSet();
+    return noConnections;
   }
   return connections[portIndex];
 }
@@ -62,10 +66,12 @@ setConnection(PortType portType,
               PortIndex portIndex,
               Connection& connection)
 {
-  auto &connections = getEntries(portType);
+  auto &connections = getEntries(portType).at(portIndex);
 
-  connections.at(portIndex).insert(std::make_pair(connection.id(),
-                                               &connection));
+  if (std::find(connections.begin(), connections.end(), &connection) == connections.end())
+  {
+    connections.append(&connection);
+  }
 }
 
 
@@ -73,9 +79,15 @@ void
 NodeState::
 eraseConnection(PortType portType,
                 PortIndex portIndex,
-                QUuid id)
+                Connection const& connection)
 {
-  getEntries(portType)[portIndex].erase(id);
+  auto &connections = getEntries(portType)[portIndex];
+
+  auto it = std::find(connections.begin(), connections.end(), &connection);
+  if (it != connections.end())
+  {
+    connections.remove(static_cast<int>(it - connections.begin()));
+  }
 }
 
 
@@ -3,10 +3,11 @@
 
 #include "models/SubtreeNodeModel.hpp"
 #include <behaviortree_cpp_v3/basic_types.h>
-#include <behaviortree_cpp_v3/xml_parsing.h>
 #include <QMessageBox>
 #include <QtDebug>
 #include <QLineEdit>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
 #include <unordered_map>
 
 using namespace QtNodes;
@@ -81,134 +82,380 @@ NodeModel buildTreeNodeModelFromXML(const QDomElement& node)
 
 //------------------------------------------------------------------
 
-NodeModels ReadTreeNodesModel(const QDomElement &root)
+namespace
 {
-    NodeModels models;
-    using QtNodes::DataModelRegistry;
 
-    auto model_root = root.firstChildElement("TreeNodesModel");
+bool isPortAttribute(const QXmlStreamAttribute& attr)
+{
+    return attr.name() != QLatin1String("ID") && attr.name() != QLatin1String("name");
+}
+
+// Same as buildTreeNodeModelFromXML(). Called at the start of a child
+// of <TreeNodesModel>; reads until its end.
+NodeModel ReadModelElement(QXmlStreamReader& xml)
+{
+    const QString tag_name = xml.name().toString();
+    const QXmlStreamAttributes attributes = xml.attributes();
 
-    if( !model_root.isNull() )
+    NodeModel model;
+    model.type = BT::convertFromString<BT::NodeType>(tag_name.toStdString());
+    model.registration_ID = attributes.hasAttribute("ID") ?
+                                attributes.value("ID").toString() : tag_name;
+
+    for(const QXmlStreamAttribute& attr: attributes)
     {
-        for( QDomElement node = model_root.firstChildElement();
-             !node.isNull();
-             node = node.nextSiblingElement() )
+        if( isPortAttribute(attr) )
         {
-            auto model = buildTreeNodeModelFromXML(node);
-            models.insert( {model.registration_ID, model} );
+            model.ports.insert( { attr.name().toString(), PortModel() } );
         }
     }
 
-    std::function<void(QDomElement)> recursiveStep;
-    recursiveStep = [&](QDomElement node)
+    while( xml.readNextStartElement() )
     {
-        auto model = buildTreeNodeModelFromXML(node);
-        if( model.type != NodeType::UNDEFINED &&
-            model.registration_ID.isEmpty() == false &&
-            models.count(model.registration_ID) == 0)
+        PortModel port_model;
+        if( xml.name() == QLatin1String("input_port") )
+        {
+            port_model.direction = PortDirection::INPUT;
+        }
+        else if( xml.name() == QLatin1String("output_port") )
         {
-            models.insert( {model.registration_ID, model} );
+            port_model.direction = PortDirection::OUTPUT;
         }
+        else if( xml.name() == QLatin1String("inout_port") )
+        {
+            port_model.direction = PortDirection::INOUT;
+        }
+        else{
+            xml.skipCurrentElement();
+            continue;
+        }
+
+        const QXmlStreamAttributes port_attributes = xml.attributes();
+        port_model.type_name = port_attributes.value("type").toString();
+        port_model.default_value = port_attributes.value("default").toString();
+        port_model.description = xml.readElementText( QXmlStreamReader::IncludeChildElements );
 
-        for( QDomElement child = node.firstChildElement();
-             !child.isNull();
-             child = child.nextSiblingElement() )
+        if( port_attributes.hasAttribute("name") )
         {
-            recursiveStep(child);
+            model.ports.insert( { port_attributes.value("name").toString(), std::move(port_model)} );
         }
-    };
+    }
+    return model;
+}
 
-    for( QDomElement bt_root = root.firstChildElement("BehaviorTree");
-         !bt_root.isNull();
-         bt_root = bt_root.nextSiblingElement("BehaviorTree") )
+// Called at the start of a node of a <BehaviorTree>; reads it and its
+// children. A model that isn't in <TreeNodesModel> is inferred from the
+// first node that uses it, and added to found_models.
+void ReadTreeNode(QXmlStreamReader& xml, AbsBehaviorTree& tree,
+                  AbstractTreeNode* parent, NodeModels& found_models)
+{
+    const QString tag_name = xml.name().toString();
+    const QXmlStreamAttributes attributes = xml.attributes();
+
+    AbstractTreeNode tree_node;
+    const QString ID = attributes.hasAttribute("ID") ? attributes.value("ID").toString() : tag_name;
+    // only the ID for now: <TreeNodesModel> may come after the trees
+    NodeModel unresolved;
+    unresolved.type = NodeType::UNDEFINED;
+    unresolved.registration_ID = ID;
+    tree_node.model = InternNodeModel( unresolved );
+    tree_node.instance_name = attributes.hasAttribute("name") ?
+                                  attributes.value("name").toString() : ID;
+
+    for(const QXmlStreamAttribute& attr: attributes)
     {
-        auto first_child = bt_root.firstChildElement();
-        if( first_child.tagName() == "Root")
+        if( isPortAttribute(attr) )
         {
-            first_child = first_child.firstChildElement();
+            tree_node.ports_mapping.insert( { attr.name().toString(), attr.value().toString() } );
         }
-        recursiveStep( bt_root.firstChildElement() );
     }
-    return models;
+
+    if( found_models.count(ID) == 0 )
+    {
+        const auto node_type = BT::convertFromString<BT::NodeType>(tag_name.toStdString());
+        if( node_type != NodeType::UNDEFINED )
+        {
+            PortModels ports;
+            for(const auto& port_it: tree_node.ports_mapping)
+            {
+                ports.insert( { port_it.first, PortModel() } );
+            }
+            found_models.insert( { ID, { node_type, ID, ports } } );
+        }
+    }
+
+    auto added_node = tree.addNode(parent, std::move(tree_node));
+
+    while( xml.readNextStartElement() )
+    {
+        ReadTreeNode(xml, tree, added_node, found_models);
+    }
 }
 
+void ReadRootNode(QXmlStreamReader& xml, AbsBehaviorTree& tree,
+                  const QString& tree_name, NodeModels& found_models)
+{
+    if( tree.nodesCount() > 0 )
+    {
+        throw std::runtime_error( QString("The tree \"%1\" has more than one root node")
+                                  .arg(tree_name).toStdString() );
+    }
+    ReadTreeNode(xml, tree, nullptr, found_models);
+}
+
+// Called at the start of a <BehaviorTree>; reads until its end.
+void ReadBehaviorTree(QXmlStreamReader& xml, AbsBehaviorTree& tree,
+                      const QString& tree_name, NodeModels& found_models,
+                      std::vector<QString>& warnings)
+{
+    while( xml.readNextStartElement() )
+    {
+        if( xml.name() == QLatin1String("Root") )
+        {
+            warnings.push_back( "Please remove the node <Root> from your <BehaviorTree>" );
+            while( xml.readNextStartElement() )
+            {
+                ReadRootNode(xml, tree, tree_name, found_models);
+            }
+        }
+        else{
+            ReadRootNode(xml, tree, tree_name, found_models);
+        }
+    }
 
+    if( !xml.hasError() && tree.nodesCount() == 0 )
+    {
+        throw std::runtime_error( QString("The tree \"%1\" is empty").arg(tree_name).toStdString() );
+    }
+}
 
-void RecursivelyCreateXml(const FlowScene &scene, QDomDocument &doc, QDomElement& parent_element, const Node *node)
+// All the nodes with the same ID share the same model, see InternNodeModel().
+void ResolveModels(AbsBehaviorTree& tree,
+                   const NodeModels& registered_models,
+                   const NodeModels& file_models,
+                   std::map<QString, NodeModelPtr>& resolved)
 {
+    for(auto& node: tree.nodes())
+    {
+        const QString ID = node.model->registration_ID;
+        auto resolved_it = resolved.find(ID);
+        if( resolved_it == resolved.end() )
+        {
+            auto model_it = registered_models.find(ID);
+            if( model_it == registered_models.end() )
+            {
+                model_it = file_models.find(ID);
+                if( model_it == file_models.end() )
+                {
+                    throw std::runtime_error( (QString("This model has not been registered: ") + ID).toStdString() );
+                }
+            }
+            resolved_it = resolved.insert( { ID, InternNodeModel( model_it->second ) } ).first;
+        }
+        node.model = resolved_it->second;
+    }
+}
 
-    const QtNodes::NodeDataModel* node_model = node->nodeDataModel();
-    const std::string model_name = node_model->name().toStdString();
+} // end namespace
 
-    const auto* bt_node = dynamic_cast<const BehaviorTreeDataModel*>(node_model);
+XMLTreeFile ReadXMLTrees(const QString &xml_text, const NodeModels &registered_models)
+{
+    XMLTreeFile file;
+    NodeModels found_models;
 
-    QString registration_name = bt_node->registrationName();
-    QDomElement element;
+    QXmlStreamReader xml(xml_text);
 
-    if( BuiltinNodeModels().count(registration_name) != 0)
+    if( xml.readNextStartElement() )
     {
-        element = doc.createElement( registration_name.toStdString().c_str() );
+        file.main_tree = xml.attributes().value("main_tree_to_execute").toString();
+
+        while( xml.readNextStartElement() )
+        {
+            if( xml.name() == QLatin1String("TreeNodesModel") )
+            {
+                while( xml.readNextStartElement() )
+                {
+                    NodeModel model = ReadModelElement(xml);
+                    if( model.type != NodeType::UNDEFINED )
+                    {
+                        file.models.insert( {model.registration_ID, std::move(model)} );
+                    }
+                }
+            }
+            else if( xml.name() == QLatin1String("BehaviorTree") )
+            {
+                const QString tree_name = xml.attributes().value("ID").toString();
+                file.trees.emplace_back( tree_name, AbsBehaviorTree() );
+                ReadBehaviorTree(xml, file.trees.back().second,
+                                 tree_name.isEmpty() ? QString("BehaviorTree") : tree_name,
+                                 found_models, file.warnings);
+            }
+            else{
+                xml.skipCurrentElement();
+            }
+        }
     }
-    else{
-        element = doc.createElement( QString::fromStdString(toStr(bt_node->nodeType())) );
-        element.setAttribute("ID", registration_name.toStdString().c_str() );
+
+    if( xml.hasError() )
+    {
+        throw std::runtime_error( QString("Error parsing XML (line %1): %2")
+                                  .arg(xml.lineNumber()).arg(xml.errorString()).toStdString() );
     }
 
+    // the models of <TreeNodesModel> take precedence over the inferred ones
+    file.models.insert( found_models.begin(), found_models.end() );
 
-    bool is_subtree_expanded = false;
-    if( auto subtree = dynamic_cast<const SubtreeNodeModel*>(node_model)  )
+    std::map<QString, NodeModelPtr> resolved;
+    for(auto& it: file.trees)
     {
-        is_subtree_expanded = subtree->expanded();
+        ResolveModels(it.second, registered_models, file.models, resolved);
     }
+    return file;
+}
+
+//------------------------------------------------------------------
 
-    if( bt_node->instanceName() != registration_name )
+namespace
+{
+
+// "ID" and "name" are merged into the ports remapping, already sorted, so
+// that the attributes come out in the same order as from a QMap.
+void WriteNodeAttributes(QXmlStreamWriter& stream,
+                         bool write_ID, const QString& ID,
+                         bool write_name, const QString& name,
+                         const PortsMapping& ports_mapping)
+{
+    const QString ID_KEY("ID");
+    const QString NAME_KEY("name");
+
+    for(const auto& port_it: ports_mapping)
     {
-        element.setAttribute("name", bt_node->instanceName().toStdString().c_str() );
+        const QString& key = port_it.first;
+        if( write_ID && !(key < ID_KEY) )
+        {
+            if( key != ID_KEY )
+            {
+                stream.writeAttribute( ID_KEY, ID );
+            }
+            write_ID = false;
+        }
+        if( write_name && !(key < NAME_KEY) )
+        {
+            if( key != NAME_KEY )
+            {
+                stream.writeAttribute( NAME_KEY, name );
+            }
+            write_name = false;
+        }
+        stream.writeAttribute( key, port_it.second );
+    }
+    if( write_ID )
+    {
+        stream.writeAttribute( ID_KEY, ID );
     }
+    if( write_name )
+    {
+        stream.writeAttribute( NAME_KEY, name );
+    }
+}
+
+} // end namespace
 
-    auto port_mapping = bt_node->getCurrentPortMapping();
-    for(const auto& port_it: port_mapping)
+void WriteTreeNodeXml(QXmlStreamWriter& stream,
+                      const AbsBehaviorTree& tree,
+                      const AbstractTreeNode& node)
+{
+    const QString& registration_name = node.model->registration_ID;
+    const bool is_builtin = BuiltinNodeModels().count(registration_name) != 0;
+
+    if( is_builtin )
     {
-        element.setAttribute( port_it.first, port_it.second );
+        stream.writeStartElement( registration_name );
+    }
+    else{
+        stream.writeStartElement( QString::fromStdString(toStr(node.model->type)) );
     }
 
-    parent_element.appendChild( element );
+    WriteNodeAttributes( stream,
+                         !is_builtin, registration_name,
+                         node.instance_name != registration_name, node.instance_name,
+                         node.ports_mapping );
+
+    bool is_subtree_expanded = false;
+    if( node.graphic_node )
+    {
+        auto subtree = dynamic_cast<const SubtreeNodeModel*>( node.graphic_node->nodeDataModel() );
+        is_subtree_expanded = subtree && subtree->expanded();
+    }
 
     if( !is_subtree_expanded )
     {
-        auto node_children = getChildren(scene, *node, true );
-        for(const QtNodes::Node* child : node_children)
+        for(int child_index: node.children_index)
         {
-            RecursivelyCreateXml(scene, doc, element, child );
+            WriteTreeNodeXml( stream, tree, *tree.node(child_index) );
         }
     }
+    stream.writeEndElement();
 }
 
-bool VerifyXML(QDomDocument &doc,
-               const std::vector<QString>& registered_ID,
-               std::vector<QString>& error_messages)
+void WritePortModelXml(QXmlStreamWriter& stream, const QString& port_name, const PortModel& port)
 {
-    error_messages.clear();
-    try {
-        std::string xml_text = doc.toString().toStdString();
-        std::unordered_map<std::string, BT::NodeType> registered_nodes;
-        
-        BT::NodeType node_type; 
-        for(const auto& str: registered_ID)
-        {
-            node_type = BT::convertFromString<BT::NodeType>(str.toStdString());
-            registered_nodes.insert( {str.toStdString(),  node_type});
-        }
+    switch (port.direction)
+    {
+    case PortDirection::INPUT:
+        stream.writeStartElement("input_port");
+        break;
+    case PortDirection::OUTPUT:
+        stream.writeStartElement("output_port");
+        break;
+    case PortDirection::INOUT:
+        stream.writeStartElement("inout_port");
+        break;
+    }
+
+    // sorted by name
+    if (port.default_value.isEmpty() == false)
+    {
+        stream.writeAttribute("default", port.default_value);
+    }
+    stream.writeAttribute("name", port_name);
+    if (port.type_name.isEmpty() == false)
+    {
+        stream.writeAttribute("type", port.type_name);
+    }
 
-        BT::VerifyXML(xml_text, registered_nodes); // may throw
-    } catch (std::exception& ex)
+    if (!port.description.isEmpty())
     {
-        error_messages.push_back(ex.what());
+        stream.writeCharacters(port.description);
     }
-    return true;
+    stream.writeEndElement();
 }
 
+void WriteNodeModelsXml(QXmlStreamWriter& stream, const NodeModels& models)
+{
+    stream.writeStartElement("TreeNodesModel");
+
+    for(const auto& model_it: models)
+    {
+        const auto& ID    = model_it.first;
+        const auto& model = model_it.second;
+
+        if( BuiltinNodeModels().count(ID) != 0 )
+        {
+            continue;
+        }
 
+        stream.writeStartElement( QString::fromStdString(toStr(model.type)) );
+        stream.writeAttribute("ID", ID);
+
+        for(const auto& port_it: model.ports)
+        {
+            WritePortModelXml(stream, port_it.first, port_it.second);
+        }
+        stream.writeEndElement();
+    }
+    stream.writeEndElement();
+}
 
 QDomElement writePortModel(const QString& port_name, const PortModel& port, QDomDocument& doc)
 {
@@ -2,6 +2,7 @@
 #define XMLPARSERS_HPP
 
 #include <QDomDocument>
+#include <QXmlStreamWriter>
 #include "bt_editor_base.h"
 
 #include <nodes/Node>
@@ -10,16 +11,39 @@
 #include <nodes/DataModelRegistry>
 
 
-NodeModels ReadTreeNodesModel(const QDomElement& root);
-
-void RecursivelyCreateXml(const QtNodes::FlowScene &scene,
-                          QDomDocument& doc,
-                          QDomElement& parent_element,
-                          const QtNodes::Node* node);
-
-bool VerifyXML(QDomDocument& doc,
-               const std::vector<QString> &registered_ID,
-               std::vector<QString> &error_messages);
+// Content of a file, see ReadXMLTrees()
+struct XMLTreeFile
+{
+    // attribute main_tree_to_execute, empty if missing
+    QString main_tree;
+    // models of <TreeNodesModel> and the ones found in the trees
+    NodeModels models;
+    // the name is empty if the <BehaviorTree> has no ID
+    std::vector<std::pair<QString, AbsBehaviorTree>> trees;
+    // problems that don't prevent loading the file
+    std::vector<QString> warnings;
+};
+
+// Reads the models and the trees of a file in a single pass of
+// QXmlStreamReader, without building a QDomDocument. The nodes take their
+// model from registered_models first, then from the file.
+// Throws std::runtime_error if the XML is malformed, if a tree doesn't have
+// exactly one root node or if one of its models is unknown.
+XMLTreeFile ReadXMLTrees(const QString& xml_text, const NodeModels& registered_models);
+
+// The XML is written straight to the stream, with the attributes of every
+// element sorted by name, so that saving the same trees always gives the
+// same text.
+void WriteTreeNodeXml(QXmlStreamWriter& stream,
+                      const AbsBehaviorTree& tree,
+                      const AbstractTreeNode& node);
+
+void WritePortModelXml(QXmlStreamWriter& stream,
+                       const QString& port_name,
+                       const PortModel& port);
+
+// <TreeNodesModel>, without the builtin models
+void WriteNodeModelsXml(QXmlStreamWriter& stream, const NodeModels& models);
 
 NodeModel buildTreeNodeModelFromXML(const QDomElement &node);
 
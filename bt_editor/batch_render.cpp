@@ -0,0 +1,321 @@
+#include "batch_render.h"
+#include "graphic_container.h"
+#include "XML_utilities.hpp"
+#include "utils.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QProcess>
+#include <QSet>
+#include <QTextStream>
+#include <QWidget>
+#include <QXmlStreamReader>
+#include <QtConcurrent>
+#include <algorithm>
+#include <iostream>
+#include <memory>
+
+namespace
+{
+
+// Only letters, digits, '-', '_' and '.' (not first): tree IDs and file
+// names can contain separators or characters the file system refuses.
+QString SafeFileName(const QString& name)
+{
+    QString safe = name;
+    for(int i = 0; i < safe.size(); i++)
+    {
+        const QChar c = safe[i];
+        const bool allowed = ( c < QChar(0x80) && c.isLetterOrNumber() ) ||
+                c == '-' || c == '_' || ( c == '.' && i > 0 );
+        if( !allowed )
+        {
+            safe[i] = '_';
+        }
+    }
+    return safe.isEmpty() ? QString("BehaviorTree") : safe;
+}
+
+// Throws on error.
+XMLTreeFile ReadTreeFile(const QString& path)
+{
+    QFile xml_file(path);
+    if( !xml_file.open(QIODevice::ReadOnly) )
+    {
+        throw std::runtime_error("Cannot open file");
+    }
+    const QString xml_text = QTextStream(&xml_file).readAll();
+
+    XMLTreeFile file = ReadXMLTrees( xml_text, BuiltinNodeModels() );
+    if( file.trees.empty() )
+    {
+        throw std::runtime_error("There is no BehaviorTree in the file");
+    }
+    return file;
+}
+
+// Indexes of the trees to render.
+std::vector<size_t> SelectTrees(const XMLTreeFile& file, const RenderOptions& options)
+{
+    // same choice of the main tree as MainWindow::loadFromXML()
+    std::vector<size_t> selected;
+    for(size_t i = 0; i < file.trees.size(); i++)
+    {
+        if( options.all_trees || file.trees[i].first == file.main_tree )
+        {
+            selected.push_back(i);
+        }
+    }
+    if( selected.empty() )
+    {
+        selected.push_back(0);
+    }
+    return selected;
+}
+
+// IDs of all the trees of the file, in order, without building them. Empty
+// if the file can't be read: that is reported when rendering it.
+QStringList ReadTreeIDs(const QString& path)
+{
+    QStringList IDs;
+    QFile xml_file(path);
+    if( !xml_file.open(QIODevice::ReadOnly) )
+    {
+        return IDs;
+    }
+    QXmlStreamReader xml(&xml_file);
+    if( xml.readNextStartElement() )
+    {
+        while( xml.readNextStartElement() )
+        {
+            if( xml.name() == QLatin1String("BehaviorTree") )
+            {
+                IDs.push_back( xml.attributes().value("ID").toString() );
+            }
+            xml.skipCurrentElement();
+        }
+    }
+    return xml.hasError() ? QStringList() : IDs;
+}
+
+// Names of the images of the trees with these IDs, in the same order (the
+// IDs are not used without all_trees). Two trees whose IDs differ only by
+// unsafe characters get a "_2", "_3"... suffix.
+QStringList ImageNames(const QString& path, const QStringList& tree_IDs,
+                       const RenderOptions& options)
+{
+    const QString base_name = SafeFileName( QFileInfo(path).completeBaseName() );
+    const QString suffix = ( options.format == "tiles" ) ? QString("_tiles") : "." + options.format;
+
+    QStringList names;
+    QSet<QString> used;
+    for(const QString& ID: tree_IDs)
+    {
+        QString name = base_name;
+        if( options.all_trees )
+        {
+            name += "_" + SafeFileName( ID );
+        }
+        QString unique_name = name;
+        for(int count = 2; used.contains( unique_name.toLower() ); count++)
+        {
+            unique_name = QString("%1_%2").arg(name).arg(count);
+        }
+        used.insert( unique_name.toLower() );
+        names.push_back( unique_name + suffix );
+    }
+    return names;
+}
+
+// False, after telling which ones, if two files would write the same image
+// (e.g. the same name in two directories). Case is ignored, for the file
+// systems that do.
+bool CheckImageNames(const QStringList& files, const RenderOptions& options)
+{
+    // a single image per file, whatever the content, or one per tree: only
+    // the IDs are read, all the files at once
+    QList<QStringList> tree_IDs;
+    if( options.all_trees )
+    {
+        tree_IDs = QtConcurrent::blockingMapped<QList<QStringList>>( files, ReadTreeIDs );
+    }
+
+    QHash<QString, QString> writer_of;
+    bool ok = true;
+    for(int i = 0; i < files.size(); i++)
+    {
+        const QString& path = files[i];
+        const QStringList names = ImageNames( path, options.all_trees ? tree_IDs[i] : QStringList( QString() ),
+                                              options );
+        for(const QString& name: names)
+        {
+            auto it = writer_of.find( name.toLower() );
+            if( it != writer_of.end() && it.value() != path )
+            {
+                std::cout << it.value().toStdString() << " and " << path.toStdString()
+                          << " would both write " << name.toStdString() << std::endl;
+                ok = false;
+            }
+            writer_of.insert( name.toLower(), path );
+        }
+    }
+    return ok;
+}
+
+// Returns the number of images written; throws on error.
+int RenderFile(const QString& path, const RenderOptions& options)
+{
+    XMLTreeFile file = ReadTreeFile( path );
+
+    NodeModels models = BuiltinNodeModels();
+    models.insert( file.models.begin(), file.models.end() );
+    auto registry = CreateModelRegistry( models );
+
+    const std::vector<size_t> selected = SelectTrees( file, options );
+    QStringList selected_IDs;
+    for(size_t index: selected)
+    {
+        selected_IDs.push_back( file.trees[index].first );
+    }
+    const QStringList image_names = ImageNames( path, selected_IDs, options );
+    const QDir output_dir( options.output_dir );
+
+    for(size_t i = 0; i < selected.size(); i++)
+    {
+        const auto& tree = file.trees[ selected[i] ];
+        const QString image_path = output_dir.filePath( image_names[int(i)] );
+
+        // owns the scene and the view, that are never shown
+        QWidget host;
+        GraphicContainer container( registry, &host );
+        container.loadSceneFromTree( tree.second );
+
+        if( options.format == "png" )
+        {
+            if( !container.fitsInPngFile() )
+            {
+                throw std::runtime_error( QString("%1 would be too large, use --format tiles")
+                                          .arg(image_path).toStdString() );
+            }
+            if( !container.savePngFile( image_path ) )
+            {
+                throw std::runtime_error( QString("Cannot write %1").arg(image_path).toStdString() );
+            }
+        }
+        else if( options.format == "tiles" )
+        {
+            if( !container.savePngTiles( image_path ) )
+            {
+                throw std::runtime_error( QString("Cannot write %1").arg(image_path).toStdString() );
+            }
+        }
+        else{
+            container.saveSvgFile( image_path );
+        }
+    }
+    return int( selected.size() );
+}
+
+int RenderInProcess(const QStringList& files, const RenderOptions& options)
+{
+    int failed = 0;
+    for(const QString& path: files)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        try{
+            const int images = RenderFile( path, options );
+            std::cout << path.toStdString() << ": " << images << " image(s) in "
+                      << timer.elapsed() << " ms" << std::endl;
+        }
+        catch( std::exception& err )
+        {
+            std::cout << path.toStdString() << ": FAILED after " << timer.elapsed()
+                      << " ms: " << err.what() << std::endl;
+            failed++;
+        }
+    }
+    return failed;
+}
+
+} // end namespace
+
+
+int RenderFiles(const QStringList &files, const RenderOptions &options)
+{
+    if( options.format != "svg" && options.format != "png" && options.format != "tiles" )
+    {
+        std::cout << "unknown image format: " << options.format.toStdString()
+                  << ". Use one of these: svg / png / tiles" << std::endl;
+        return 1;
+    }
+    if( !QDir().mkpath( options.output_dir ) )
+    {
+        std::cout << "Cannot create the directory " << options.output_dir.toStdString() << std::endl;
+        return 1;
+    }
+    // before the files are split among the workers, who can't see it
+    if( !CheckImageNames( files, options ) )
+    {
+        std::cout << "Rename the files or render them to different directories" << std::endl;
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const int jobs = std::min( options.jobs, files.size() );
+    if( jobs <= 1 )
+    {
+        const int failed = RenderInProcess( files, options );
+        if( files.size() > 1 )
+        {
+            std::cout << files.size() << " file(s) in " << timer.elapsed() << " ms" << std::endl;
+        }
+        return failed == 0 ? 0 : 1;
+    }
+
+    // the same executable renders its share of the files
+    std::vector<std::unique_ptr<QProcess>> workers;
+    for(int job = 0; job < jobs; job++)
+    {
+        QStringList arguments;
+        arguments << "--render" << options.output_dir
+                  << "--format" << options.format
+                  << "--jobs" << "1";
+        if( options.all_trees )
+        {
+            arguments << "--all-trees";
+        }
+        for(int i = job; i < files.size(); i += jobs)
+        {
+            arguments << files[i];
+        }
+
+        std::unique_ptr<QProcess> worker( new QProcess );
+        worker->setProcessChannelMode( QProcess::ForwardedChannels );
+        worker->start( QCoreApplication::applicationFilePath(), arguments );
+        workers.push_back( std::move(worker) );
+    }
+
+    int exit_code = 0;
+    for(auto& worker: workers)
+    {
+        if( !worker->waitForFinished(-1) )
+        {
+            std::cout << "worker failed: " << worker->errorString().toStdString() << std::endl;
+            exit_code = 1;
+        }
+        else if( worker->exitStatus() != QProcess::NormalExit || worker->exitCode() != 0 )
+        {
+            exit_code = 1;
+        }
+    }
+    std::cout << files.size() << " file(s) in " << timer.elapsed() << " ms, "
+              << jobs << " workers" << std::endl;
+    return exit_code;
+}
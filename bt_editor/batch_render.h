@@ -0,0 +1,37 @@
+#ifndef BATCH_RENDER_H
+#define BATCH_RENDER_H
+
+#include <QString>
+#include <QStringList>
+
+struct RenderOptions
+{
+    RenderOptions(): format("svg"), all_trees(false), jobs(1) {}
+
+    QString output_dir;
+    // "svg", "png" or "tiles", see SaveSceneTiles()
+    QString format;
+    // otherwise only the main tree of each file
+    bool all_trees;
+    // number of worker processes
+    int jobs;
+};
+
+// Renders the trees of the given XML files to images in options.output_dir,
+// without MainWindow: every tree is built in a scene that is never shown, so
+// it works with the offscreen platform (QT_QPA_PLATFORM=offscreen).
+//
+// The main tree of "dir/tree.xml" is written to "tree.svg", with all_trees
+// every tree is written to "tree_<ID>.svg" (tiles go to a "tree_tiles"
+// directory instead). Characters other than letters, digits, '-', '_' and
+// '.' become '_'. Nothing is rendered if two files would write the same
+// image, e.g. files with the same name in different directories.
+//
+// With more than one job, the files are split among worker processes, i.e.
+// this same executable started again with jobs = 1. The time spent on each
+// file is written to stdout.
+//
+// Returns the exit code: 0 if every file was rendered.
+int RenderFiles(const QStringList& files, const RenderOptions& options);
+
+#endif // BATCH_RENDER_H
@@ -1,9 +1,389 @@
 #include "bt_editor_base.h"
 #include <behaviortree_cpp_v3/decorators/subtree_node.h>
 #include <QDebug>
+#include <QHash>
+#include <QMultiHash>
+#include <QSet>
+#include <algorithm>
+#include <mutex>
+
+namespace
+{
+
+bool IdenticalModels(const NodeModel& a, const NodeModel& b)
+{
+    return a.type == b.type && a.registration_ID == b.registration_ID && a.ports == b.ports;
+}
+
+} // end namespace
+
+NodeModelPtr InternNodeModel(const NodeModel &model)
+{
+    static std::mutex mutex;
+    // the models no longer used by anyone are dropped, see below
+    static QMultiHash<QString, std::weak_ptr<const NodeModel>> models;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = models.find( model.registration_ID );
+    while( it != models.end() && it.key() == model.registration_ID )
+    {
+        NodeModelPtr shared = it.value().lock();
+        if( !shared )
+        {
+            it = models.erase( it );
+            continue;
+        }
+        if( IdenticalModels( *shared, model ) )
+        {
+            return shared;
+        }
+        ++it;
+    }
+
+    NodeModel copy = model;
+    copy.registration_ID = InternString( model.registration_ID );
+    PortModels ports;
+    for(const auto& port_it: model.ports)
+    {
+        ports.insert( { InternString( port_it.first ), port_it.second } );
+    }
+    copy.ports = std::move(ports);
+
+    NodeModelPtr shared = std::make_shared<const NodeModel>( std::move(copy) );
+    models.insert( model.registration_ID, shared );
+    return shared;
+}
+
+QString InternString(const QString &str)
+{
+    static std::mutex mutex;
+    static QSet<QString> strings;
+    // size of the set after the last pruning
+    static int kept = 0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = strings.find( str );
+    if( it != strings.end() )
+    {
+        return *it;
+    }
+
+    // the strings no longer used by anyone else are dropped every time the
+    // set doubles, so that the cost stays constant on average
+    if( strings.size() >= std::max( 2 * kept, 1024 ) )
+    {
+        for(auto prune = strings.begin(); prune != strings.end(); )
+        {
+            if( prune->isDetached() )
+            {
+                prune = strings.erase( prune );
+            }
+            else{
+                ++prune;
+            }
+        }
+        kept = strings.size();
+    }
+    return *strings.insert( str );
+}
+
+namespace
+{
+
+// A shared name is most likely the interned copy already, or the name of a
+// port of a model: only the new ones need InternString() and its lock.
+QString InternPortName(const QString& name)
+{
+    return name.isDetached() ? InternString( name ) : name;
+}
+
+} // end namespace
+
+quint64 HashString(const QString& str)
+{
+    return ( quint64( qHash(str, 0) ) << 32 ) | quint64( qHash(str, 0x9e3779b9) );
+}
+
+PortsMapping::const_iterator PortsMapping::find(const QString &name) const
+{
+    auto it = std::lower_bound( _ports.begin(), _ports.end(), name,
+                                [](const value_type& port, const QString& key)
+    {
+        return port.first < key;
+    });
+    return ( it != _ports.end() && it->first == name ) ? const_iterator(it) : end();
+}
+
+std::vector<PortsMapping::value_type>::iterator PortsMapping::lowerBound(const QString &name)
+{
+    return std::lower_bound( _ports.begin(), _ports.end(), name,
+                             [](const value_type& port, const QString& key)
+    {
+        return port.first < key;
+    });
+}
+
+std::pair<PortsMapping::const_iterator, bool> PortsMapping::insert(const value_type &port)
+{
+    auto it = lowerBound( port.first );
+    if( it != _ports.end() && it->first == port.first )
+    {
+        return { it, false };
+    }
+    it = _ports.insert( it, value_type( InternPortName( port.first ), port.second ) );
+    return { it, true };
+}
+
+void PortsMapping::set(const QString &name, const QString &value)
+{
+    auto it = lowerBound( name );
+    if( it != _ports.end() && it->first == name )
+    {
+        it->second = value;
+    }
+    else{
+        _ports.insert( it, value_type( InternPortName( name ), value ) );
+    }
+}
+
+AbstractTreeNode::AbstractTreeNode() :
+    index(-1),
+    status(NodeStatus::IDLE),
+    graphic_node(nullptr)
+{
+    static const NodeModelPtr undefined_model = []()
+    {
+        NodeModel undefined;
+        undefined.type = NodeType::UNDEFINED;
+        return InternNodeModel( undefined );
+    }();
+    model = undefined_model;
+}
+
+struct AbsBehaviorTree::Index
+{
+    QHash<QString, std::vector<int>> by_name;
+    QHash<QString, std::vector<int>> by_ID;
+    std::vector<int> parent;
+    std::vector<quint64> node_hash;
+    // node_hash and the indexes of the children, to detect the changes
+    std::vector<quint64> shape_hash;
+    std::vector<quint64> subtree_hash;
+    quint64 tree_hash;
+};
+
+namespace
+{
+
+void HashCombine(quint64& seed, quint64 value)
+{
+    seed ^= value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+}
+
+// what operator== compares, but the status and the size
+quint64 HashIdentity(const AbstractTreeNode& node)
+{
+    quint64 hash = HashString( node.model->registration_ID );
+    HashCombine( hash, HashString( node.instance_name ) );
+    return hash;
+}
+
+quint64 HashNode(const AbstractTreeNode& node, quint64 identity)
+{
+    quint64 hash = identity;
+    for(const auto& port_it: node.ports_mapping)
+    {
+        HashCombine( hash, HashString( port_it.first ) );
+        HashCombine( hash, HashString( port_it.second ) );
+    }
+    return hash;
+}
+
+quint64 HashShape(const AbstractTreeNode& node, quint64 node_hash)
+{
+    quint64 hash = node_hash;
+    HashCombine( hash, quint64( node.children_index.size() ) );
+    for(int child: node.children_index)
+    {
+        HashCombine( hash, quint64( child ) );
+    }
+    return hash;
+}
+
+} // end namespace
+
+void AbsBehaviorTree::EditedNodes::add(size_t index)
+{
+    if( all )
+    {
+        return;
+    }
+    if( flags.size() <= index )
+    {
+        flags.resize( index + 1, 0 );
+    }
+    if( !flags[index] )
+    {
+        flags[index] = 1;
+        list.push_back( int(index) );
+    }
+}
+
+void AbsBehaviorTree::EditedNodes::clear()
+{
+    all = false;
+    list.clear();
+    flags.clear();
+}
+
+bool AbsBehaviorTree::indexIsValid() const
+{
+    if( !_index || _index->shape_hash.size() != _nodes.size() )
+    {
+        return false;
+    }
+    auto unchanged = [this](size_t i)
+    {
+        const AbstractTreeNode& node = _nodes[i];
+        return HashShape( node, HashNode( node, HashIdentity(node) ) ) == _index->shape_hash[i];
+    };
+    if( _edited.all )
+    {
+        for(size_t i = 0; i < _nodes.size(); i++)
+        {
+            if( !unchanged(i) ) return false;
+        }
+    }
+    else{
+        for(int i: _edited.list)
+        {
+            if( size_t(i) < _nodes.size() && !unchanged(i) ) return false;
+        }
+    }
+    return true;
+}
+
+const AbsBehaviorTree::Index &AbsBehaviorTree::index() const
+{
+    if( indexIsValid() )
+    {
+        return *_index;
+    }
+
+    auto index = std::make_shared<Index>();
+    const int count = int( _nodes.size() );
+    index->parent.assign( count, -1 );
+    index->node_hash.resize( count );
+    index->shape_hash.resize( count );
+    index->subtree_hash.assign( count, 0 );
+    index->tree_hash = quint64( count );
+
+    for(int i = 0; i < count; i++)
+    {
+        const AbstractTreeNode& node = _nodes[i];
+        index->by_name[ node.instance_name ].push_back( i );
+        index->by_ID[ node.model->registration_ID ].push_back( i );
+        for(int child: node.children_index)
+        {
+            if( child >= 0 && child < count )
+            {
+                index->parent[child] = i;
+            }
+        }
+        const quint64 identity = HashIdentity( node );
+        HashCombine( index->tree_hash, identity );
+        index->node_hash[i] = HashNode( node, identity );
+        index->shape_hash[i] = HashShape( node, index->node_hash[i] );
+    }
+
+    // children first, without recursion: trees can be very deep
+    enum { NEW, OPEN, DONE };
+    std::vector<char> state( count, NEW );
+    std::vector<int> stack;
+    for(int start = 0; start < count; start++)
+    {
+        if( state[start] != NEW )
+        {
+            continue;
+        }
+        stack.push_back( start );
+        while( !stack.empty() )
+        {
+            const int current = stack.back();
+            const auto& children = _nodes[current].children_index;
+            if( state[current] == NEW )
+            {
+                state[current] = OPEN;
+                for(int child: children)
+                {
+                    if( child >= 0 && child < count && state[child] == NEW )
+                    {
+                        stack.push_back( child );
+                    }
+                }
+                continue;
+            }
+            stack.pop_back();
+            if( state[current] == DONE )
+            {
+                continue;
+            }
+            quint64 hash = index->node_hash[current];
+            HashCombine( hash, quint64( children.size() ) );
+            for(int child: children)
+            {
+                // still 0 if the "tree" has a cycle
+                HashCombine( hash, ( child >= 0 && child < count ) ? index->subtree_hash[child] : 0 );
+            }
+            index->subtree_hash[current] = hash;
+            state[current] = DONE;
+        }
+    }
+
+    _index = index;
+    return *_index;
+}
+
+std::vector<const AbstractTreeNode *> AbsBehaviorTree::findNodesByID(const QString &registration_ID) const
+{
+    std::vector<const AbstractTreeNode*> out;
+    auto it = index().by_ID.find( registration_ID );
+    if( it != index().by_ID.end() )
+    {
+        out.reserve( it->size() );
+        for(int i: *it)
+        {
+            out.push_back( &_nodes[i] );
+        }
+    }
+    return out;
+}
+
+int AbsBehaviorTree::parentIndex(size_t node_index) const
+{
+    return index().parent.at( node_index );
+}
+
+quint64 AbsBehaviorTree::nodeHash(size_t node_index) const
+{
+    return index().node_hash.at( node_index );
+}
+
+quint64 AbsBehaviorTree::subtreeHash(size_t node_index) const
+{
+    return index().subtree_hash.at( node_index );
+}
+
+quint64 AbsBehaviorTree::hash() const
+{
+    return index().tree_hash;
+}
 
 void AbsBehaviorTree::clear()
 {
+    _index.reset();
+    _edited.clear();
     _nodes.resize(0);
 }
 
@@ -13,9 +393,17 @@ AbsBehaviorTree::~AbsBehaviorTree()
     clear();
 }
 
+AbstractTreeNode *AbsBehaviorTree::node(size_t index)
+{
+    AbstractTreeNode* node = &_nodes.at(index);
+    _edited.add( index );
+    return node;
+}
+
 AbstractTreeNode *AbsBehaviorTree::rootNode()
 {
     if( _nodes.empty() ) return nullptr;
+    _edited.add( 0 );
     return &_nodes.front();
 }
 
@@ -26,31 +414,29 @@ const AbstractTreeNode *AbsBehaviorTree::rootNode() const
 }
 
 
-std::vector<const AbstractTreeNode*> AbsBehaviorTree::findNodes(const QString &instance_name)
+std::vector<const AbstractTreeNode*> AbsBehaviorTree::findNodes(const QString &instance_name) const
 {
     std::vector<const AbstractTreeNode*> out;
-    out.reserve( 4 );
-
-    for( const auto& node: _nodes)
+    auto it = index().by_name.find( instance_name );
+    if( it != index().by_name.end() )
     {
-        if( node.instance_name == instance_name)
+        out.reserve( it->size() );
+        for(int i: *it)
         {
-            out.push_back( &node );
+            out.push_back( &_nodes[i] );
         }
     }
     return out;
 }
 
-const AbstractTreeNode* AbsBehaviorTree::findFirstNode(const QString &instance_name)
+const AbstractTreeNode* AbsBehaviorTree::findFirstNode(const QString &instance_name) const
 {
-    for( const auto& node: _nodes)
+    auto it = index().by_name.find( instance_name );
+    if( it == index().by_name.end() )
     {
-        if( node.instance_name == instance_name)
-        {
-            return ( &node );
-        }
+        return nullptr;
     }
-    return nullptr;
+    return &_nodes[ it->front() ];
 }
 
 
@@ -58,6 +444,7 @@ const AbstractTreeNode* AbsBehaviorTree::findFirstNode(const QString &instance_n
 AbstractTreeNode* AbsBehaviorTree::addNode(AbstractTreeNode* parent,
                                            AbstractTreeNode && new_node )
 {
+    _index.reset();
     int index = _nodes.size();
     new_node.index = index;
     if( parent )
@@ -67,8 +454,11 @@ AbstractTreeNode* AbsBehaviorTree::addNode(AbstractTreeNode* parent,
     }
     else{
         _nodes.clear();
+        _edited.clear();
         _nodes.push_back(new_node);
+        index = 0;
     }
+    _edited.add( index );
     return &_nodes.back();
 }
 
@@ -87,7 +477,7 @@ void AbsBehaviorTree::debugPrint() const
 
         printf("%s (%s)",
                node->instance_name.toStdString().c_str(),
-               node->model.registration_ID.toStdString().c_str() );
+               node->model->registration_ID.toStdString().c_str() );
         std::cout << std::endl; // force flush
 
         for(int index: node->children_index)
@@ -104,6 +494,7 @@ void AbsBehaviorTree::debugPrint() const
 bool AbsBehaviorTree::operator ==(const AbsBehaviorTree &other) const
 {
     if( _nodes.size() != other._nodes.size() ) return false;
+    if( hash() != other.hash() ) return false;
 
     for (size_t index = 0; index < _nodes.size(); index++)
     {
@@ -134,7 +525,7 @@ const char *toStr(GraphicMode type)
 
 bool AbstractTreeNode::operator ==(const AbstractTreeNode &other) const
 {
-    bool same_registration = model.registration_ID == other.model.registration_ID;
+    bool same_registration = model->registration_ID == other.model->registration_ID;
     return  same_registration &&
             status == other.status &&
             size == other.size &&
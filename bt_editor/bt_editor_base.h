@@ -4,8 +4,11 @@
 #include <QString>
 #include <QPointF>
 #include <QSizeF>
+#include <QUuid>
 #include <map>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 #include <nodes/Node>
 #include <deque>
 #include <behaviortree_cpp_v3/bt_factory.h>
@@ -14,7 +17,40 @@ using BT::NodeStatus;
 using BT::NodeType;
 using BT::PortDirection;
 
-typedef std::map<QString, QString> PortsMapping;
+// Port name -> value, sorted by name. A flat vector rather than a std::map:
+// nodes have a handful of ports, and the same few names repeat in thousands
+// of nodes, so they are interned, see InternString().
+class PortsMapping
+{
+public:
+    typedef std::pair<QString, QString> value_type;
+    typedef std::vector<value_type>::const_iterator const_iterator;
+    typedef const_iterator iterator;
+
+    const_iterator begin() const { return _ports.begin(); }
+    const_iterator end() const   { return _ports.end(); }
+
+    size_t size() const { return _ports.size(); }
+    bool empty() const  { return _ports.empty(); }
+
+    const_iterator find(const QString& name) const;
+
+    size_t count(const QString& name) const { return find(name) == end() ? 0 : 1; }
+
+    // Like std::map::insert(), an existing value is not replaced.
+    std::pair<const_iterator, bool> insert(const value_type& port);
+
+    // Adds the port or replaces its value.
+    void set(const QString& name, const QString& value);
+
+    bool operator ==(const PortsMapping& other) const { return _ports == other._ports; }
+    bool operator !=(const PortsMapping& other) const { return _ports != other._ports; }
+
+private:
+    std::vector<value_type>::iterator lowerBound(const QString& name);
+
+    std::vector<value_type> _ports;
+};
 
 // alternative type, similar to BT::PortInfo
 struct PortModel
@@ -27,6 +63,13 @@ struct PortModel
     QString default_value;
 
     PortModel& operator = (const BT::PortInfo& src);
+
+    bool operator == (const PortModel& other) const
+    {
+        return type_name == other.type_name && direction == other.direction &&
+               description == other.description && default_value == other.default_value;
+    }
+    bool operator != (const PortModel& other) const { return !( *this == other); }
 };
 
 typedef std::map<QString, PortModel> PortModels;
@@ -48,6 +91,22 @@ struct  NodeModel
 
 typedef std::map<QString, NodeModel> NodeModels;
 
+// Models never change once created: all the nodes (of every tree, and of
+// every scene) using the same model share one copy of it.
+typedef std::shared_ptr<const NodeModel> NodeModelPtr;
+
+// The shared copy of a model identical to this one (descriptions and default
+// values of the ports included), created if there isn't one yet. Thread-safe.
+NodeModelPtr InternNodeModel(const NodeModel& model);
+
+// The shared copy of the string, for the names that repeat in every node.
+// The copies that nobody else uses any more are dropped from time to time.
+// Thread-safe.
+QString InternString(const QString& str);
+
+// 64 bits hash of the string, for the hashes of the trees.
+quint64 HashString(const QString& str);
+
 
 enum class GraphicMode { EDITOR, MONITOR, REPLAY };
 
@@ -60,15 +119,10 @@ const NodeModels& BuiltinNodeModels();
 //--------------------------------
 struct AbstractTreeNode
 {
-    AbstractTreeNode() :
-        index(-1),
-        status(NodeStatus::IDLE),
-        graphic_node(nullptr)
-    {
-        model.type = NodeType::UNDEFINED;
-    }
+    AbstractTreeNode();
 
-    NodeModel model;
+    // never null, an UNDEFINED model by default
+    NodeModelPtr model;
     PortsMapping ports_mapping;
     int index;
     QString instance_name;
@@ -86,6 +140,12 @@ struct AbstractTreeNode
     }
 };
 
+// The lookups (by name, by model, parent) and the hashes use an index that
+// is built on first use. The nodes handed out by the non-const accessors can
+// still be modified through the pointer afterwards: every use of the index
+// first checks that those nodes did not change, and rebuilds it if they did.
+// Copies of a tree share its index until either is modified; the pointers
+// to the nodes of a tree don't follow its copies.
 class AbsBehaviorTree
 {
 public:
@@ -102,24 +162,43 @@ public:
 
     const NodesVector& nodes() const { return _nodes; }
 
-    NodesVector& nodes() { return _nodes; }
+    NodesVector& nodes() { _edited.all = true; return _nodes; }
 
     const AbstractTreeNode* node(size_t index) const { return &_nodes.at(index); }
 
-    AbstractTreeNode* node(size_t index) { return &_nodes.at(index); }
+    AbstractTreeNode* node(size_t index);
 
     AbstractTreeNode* rootNode();
 
     const AbstractTreeNode* rootNode() const;
 
-    std::vector<const AbstractTreeNode*> findNodes(const QString& instance_name);
+    std::vector<const AbstractTreeNode*> findNodes(const QString& instance_name) const;
+
+    const AbstractTreeNode* findFirstNode(const QString& instance_name) const;
+
+    // The nodes of this model, in index order.
+    std::vector<const AbstractTreeNode*> findNodesByID(const QString& registration_ID) const;
 
-    const AbstractTreeNode* findFirstNode(const QString& instance_name);
+    // -1 for the root, or for a node that is nobody's child.
+    int parentIndex(size_t index) const;
+
+    // Hash of the node alone: model ID, instance name and ports remapping.
+    // What identifies it in a document, not its status, size or position.
+    quint64 nodeHash(size_t index) const;
+
+    // Hash of the node and of all its descendants: their nodeHash() and the
+    // shape of the subtree.
+    quint64 subtreeHash(size_t index) const;
+
+    // Hash of the model IDs and instance names of all the nodes, in index
+    // order: equal trees have equal hashes.
+    quint64 hash() const;
 
     AbstractTreeNode* addNode(AbstractTreeNode* parent, AbstractTreeNode &&new_node );
 
     void debugPrint() const;
 
+    // Node by node; different hashes are different trees already.
     bool operator ==(const AbsBehaviorTree &other) const;
 
     bool operator !=(const AbsBehaviorTree &other) const{
@@ -129,9 +208,46 @@ public:
     void clear();
 
 private:
+    struct Index;
+
+    // The nodes handed out by the non-const accessors. A copy starts with
+    // none; an assignment keeps those of the tree assigned to, its nodes
+    // are still reachable through the same pointers.
+    struct EditedNodes
+    {
+        EditedNodes(): all(false) {}
+        EditedNodes(const EditedNodes&): all(false) {}
+        EditedNodes& operator=(const EditedNodes&) { return *this; }
+
+        void add(size_t index);
+        void clear();
+
+        bool all;
+        std::vector<int> list;
+        std::vector<char> flags;
+    };
+
+    const Index& index() const;
+
+    bool indexIsValid() const;
+
     NodesVector _nodes;
+    // never modified once built, so that copies can share it
+    mutable std::shared_ptr<const Index> _index;
+    EditedNodes _edited;
 };
 
+// A tree whose nodes are not in a scene yet, see GraphicContainer::setPendingTree().
+struct PendingTree
+{
+    AbsBehaviorTree tree;
+    // The UUIDs of the nodes are derived from it: every time the same
+    // PendingTree is built, its nodes get the same UUIDs.
+    QUuid uuid_seed;
+};
+
+typedef std::shared_ptr<const PendingTree> PendingTreePtr;
+
 static int GetUID()
 {
     static int uid = 1000;
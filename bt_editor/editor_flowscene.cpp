@@ -59,9 +59,8 @@ void EditorFlowScene::dragMoveEvent(QGraphicsSceneDragDropEvent* event)
 void EditorFlowScene::keyPressEvent(QKeyEvent *event)
 {
 
-    for( const auto& it: nodes())
+    for( const auto& node: nodes())
     {
-        const auto& node = it.second;
         auto line_edits = node->nodeDataModel()->embeddedWidget()->findChildren<QLineEdit*>();
         for(auto line_edit: line_edits )
         {
@@ -74,7 +73,7 @@ void EditorFlowScene::keyPressEvent(QKeyEvent *event)
         }
     }
 
-    const QString& registration_ID = _clipboard_node.model.registration_ID;
+    const QString registration_ID = _clipboard_node.model->registration_ID;
 
     auto selected_items = selectedItems();
     if( selected_items.size() == 1 &&
@@ -88,7 +87,7 @@ void EditorFlowScene::keyPressEvent(QKeyEvent *event)
         auto node_model = dynamic_cast<BehaviorTreeDataModel*>( selected_node.nodeDataModel() );
         if( !node_model ) return;
 
-        _clipboard_node.model = node_model->model();
+        _clipboard_node.model = node_model->sharedModel();
         _clipboard_node.instance_name  = node_model->instanceName();
     }
     else if( event->key() == Qt::Key_V &&
@@ -1,5 +1,6 @@
 #include "graphic_container.h"
 #include "utils.h"
+#include "tiled_export.h"
 #include "mainwindow.h"
 
 #include "models/SubtreeNodeModel.hpp"
@@ -12,6 +13,8 @@
 #include <QApplication>
 #include <QInputDialog>
 #include <QSvgGenerator>
+#include <QImage>
+#include <algorithm>
 
 using namespace QtNodes;
 
@@ -19,11 +22,61 @@ GraphicContainer::GraphicContainer(std::shared_ptr<DataModelRegistry> model_regi
                                    QWidget *parent) :
     QObject(parent),
     _model_registry( std::move(model_registry) ),
-    _signal_was_blocked(true)
+    _signal_was_blocked(true),
+    _arranged_revision(0),
+    _materialized_revision(0),
+    _pending_revision(0),
+    _cached_revision(0),
+    _editing_locked(false)
 {
     _scene = new EditorFlowScene( _model_registry, parent );
     _view  = new QtNodes::FlowView( _scene, parent );
 
+    // keep track of the changes for undo/redo before anyone else reacts to them
+    connect( _scene, &QtNodes::FlowScene::nodeCreated,
+             this, [this](QtNodes::Node& node)
+    {
+        _nodes_by_uuid[ node.uuid() ] = node.handle();
+        _changed_nodes.insert( node.uuid() );
+        _topology.addNode( node );
+    });
+
+    connect( _scene, &QtNodes::FlowScene::nodeDeleted,
+             this, &GraphicContainer::forgetNode );
+
+    connect( _scene, &QtNodes::FlowScene::nodePositionChanged,
+             this, [this](QtNodes::Node& node)
+    {
+        _changed_nodes.insert( node.uuid() );
+        _layout_cache.invalidate( node, _topology );
+    });
+
+    connect( _scene, &QtNodes::FlowScene::connectionCreated,
+             this, &GraphicContainer::markConnectionChanged );
+
+    connect( _scene, &QtNodes::FlowScene::connectionDeleted,
+             this, &GraphicContainer::markConnectionChanged );
+
+    connect( _scene, &QtNodes::FlowScene::connectionCreated,
+             this, [this](QtNodes::Connection& connection)
+    {
+        _topology.addConnection( connection );
+        if( auto parent = connection.getNode( QtNodes::PortType::Out ) )
+        {
+            _layout_cache.invalidate( *parent, _topology );
+        }
+    });
+
+    connect( _scene, &QtNodes::FlowScene::connectionDeleted,
+             this, [this](QtNodes::Connection& connection)
+    {
+        if( auto parent = connection.getNode( QtNodes::PortType::Out ) )
+        {
+            _layout_cache.invalidate( *parent, _topology );
+        }
+        _topology.removeConnection( connection );
+    });
+
     connect( _scene, &QtNodes::FlowScene::nodeDoubleClicked,
              this, &GraphicContainer::onNodeDoubleClicked);
 
@@ -72,11 +125,13 @@ GraphicContainer::GraphicContainer(std::shared_ptr<DataModelRegistry> model_regi
 
 void GraphicContainer::lockEditing(bool locked)
 {
+    _editing_locked = locked;
+
     std::vector<QtNodes::Node*> subtrees_expanded;
     for (auto& nodes_it: _scene->nodes() )
     {
 
-        QtNodes::Node* node = nodes_it.second.get();
+        QtNodes::Node* node = nodes_it.get();
         auto bt_model = dynamic_cast<BehaviorTreeDataModel*>( node->nodeDataModel() );
 
         if(bt_model->registrationName() == "Root")
@@ -112,9 +167,12 @@ void GraphicContainer::lockEditing(bool locked)
 
     for (auto& conn_it: _scene->connections() )
     {
-        QtNodes::Connection* conn = conn_it.second.get();
+        QtNodes::Connection* conn = conn_it.get();
         conn->connectionGraphicsObject().lock( locked );
     }
+
+    // connections are interactive only in editor mode
+    _scene->setConnectionLayerEnabled( locked );
 }
 
 void GraphicContainer::lockSubtreeEditing(Node &root_node, bool locked, bool change_style)
@@ -128,12 +186,11 @@ void GraphicContainer::lockSubtreeEditing(Node &root_node, bool locked, bool cha
             bt_model->lock(locked);
         }
 
-        auto connections = node->nodeState().getEntries(PortType::Out);
-        for (auto& conn_by_port: connections )
+        const auto& connections = node->nodeState().getEntries(PortType::Out);
+        for (const auto& conn_by_port: connections )
         {
-            for (auto& conn_it: conn_by_port )
+            for (QtNodes::Connection* conn: conn_by_port )
             {
-                QtNodes::Connection* conn = conn_it.second;
                 conn->connectionGraphicsObject().lock( locked );
             }
         }
@@ -154,17 +211,29 @@ void GraphicContainer::lockSubtreeEditing(Node &root_node, bool locked, bool cha
 
 void GraphicContainer::nodeReorder()
 {
+    if( _pending_tree )
+    {
+        return;
+    }
     {
         const QSignalBlocker blocker(this);
-        auto abstract_tree = BuildTreeFromScene( _scene );
-        NodeReorder( *_scene, abstract_tree );
-        zoomHomeView();
+        if( QtNodes::Node* root = _topology.root() )
+        {
+            _layout_cache.arrange( *_scene, _topology, *root );
+        }
+        _arranged_revision = _scene->revision();
     }
     emit undoableChange();
 }
 
+bool GraphicContainer::isArranged() const
+{
+    return _arranged_revision == _scene->revision();
+}
+
 void GraphicContainer::saveSvgFile(const QString path)
 {
+    materialize();
     QSvgGenerator generator;
     QRectF rect = _scene->itemsBoundingRect();
     generator.setFileName(path);
@@ -175,6 +244,36 @@ void GraphicContainer::saveSvgFile(const QString path)
     _scene->render(&painter, rect, rect);
 }
 
+bool GraphicContainer::fitsInPngFile()
+{
+    materialize();
+    QRectF rect = _scene->itemsBoundingRect();
+    return qint64( rect.width() ) * qint64( rect.height() ) <= MAX_IMAGE_PIXELS;
+}
+
+bool GraphicContainer::savePngFile(const QString path)
+{
+    if( !fitsInPngFile() )
+    {
+        return false;
+    }
+    QRectF rect = _scene->itemsBoundingRect();
+    QImage image( rect.size().toSize(), QImage::Format_ARGB32_Premultiplied );
+    image.fill( Qt::transparent );
+    {
+        QPainter painter( &image );
+        painter.setRenderHint( QPainter::Antialiasing );
+        _scene->render( &painter, QRectF( image.rect() ), rect );
+    }
+    return image.save( path, "PNG" );
+}
+
+bool GraphicContainer::savePngTiles(const QString directory)
+{
+    materialize();
+    return SaveSceneTiles( *_scene, _scene->itemsBoundingRect(), directory );
+}
+
 void GraphicContainer::zoomHomeView()
 {
     QRectF rect = _scene->itemsBoundingRect();
@@ -193,74 +292,143 @@ void GraphicContainer::zoomHomeView()
 
 bool GraphicContainer::containsValidTree() const
 {
-    if( _scene->nodes().empty())
+    if( _pending_tree )
     {
-        return false;
-    }
-
-    auto connections =  _scene->connections();
-
-    std::set<const QtNodes::Node*> nodes_with_input;
-    std::set<const QtNodes::Node*> nodes_with_output;
-
-    for (const auto& it: _scene->connections())
-    {
-        const QtNodes::Connection* connection = it.second.get();
-        auto node = connection->getNode( QtNodes::PortType::In);
-        if( node ){
-            nodes_with_input.insert( node );
-        }
-        node = connection->getNode( QtNodes::PortType::Out);
-        if( node ){
-            nodes_with_output.insert( node );
-        }
-    }
-
-    for (const auto& it: _scene->nodes())
-    {
-        const QtNodes::Node* node = it.second.get();
-        if( node->nodeDataModel()->nPorts(QtNodes::PortType::In) == 1 )
+        const auto& nodes = _pending_tree->tree.nodes();
+        if( nodes.empty() )
         {
-            if( nodes_with_input.find(node) == nodes_with_input.end() )
-            {
-                return false;
-            }
+            return false;
         }
-        if( node->nodeDataModel()->nPorts(QtNodes::PortType::Out) == 1 )
+        // same as below: once built, these nodes would have an output port
+        // without connections
+        for(const auto& node: nodes)
         {
-            if( nodes_with_output.find(node) == nodes_with_output.end() )
+            const NodeType type = node.model->type;
+            if( type != NodeType::ACTION && type != NodeType::CONDITION &&
+                type != NodeType::SUBTREE && node.children_index.empty() )
             {
                 return false;
             }
         }
+        return true;
     }
-    return true;
+
+    return _topology.isValid();
 }
 
 void GraphicContainer::clearScene()
 {
     const QSignalBlocker blocker( this );
+    _pending_tree.reset();
     _scene->clearScene();
+    _layout_cache.clear();
 }
 
+void GraphicContainer::setPendingTree(PendingTreePtr tree)
+{
+    clearScene();
+    _pending_tree = std::move(tree);
+    // the scene may have been empty already
+    _scene->bumpRevision();
+}
+
+bool GraphicContainer::materialize()
+{
+    if( !_pending_tree )
+    {
+        return false;
+    }
+    // taken first: building the scene may ask for it again
+    PendingTreePtr pending = std::move(_pending_tree);
+    const uint64_t pending_revision = revision();
+    {
+        const QSignalBlocker blocker( this );
+        loadSceneFromTree( pending->tree, pending->uuid_seed );
+        if( _editing_locked )
+        {
+            lockEditing( true );
+        }
+        // loadSceneFromTree already placed the nodes
+        _arranged_revision = _scene->revision();
+        zoomHomeView();
+    }
+    _materialized_revision = _scene->contentRevision();
+    _pending_revision = pending_revision;
+    // building the tab is not an edit
+    _changed_nodes.clear();
+
+    const bool was_blocked = blockSignals(false);
+    emit materialized();
+    blockSignals(was_blocked);
+    return true;
+}
+
+uint64_t GraphicContainer::revision() const
+{
+    const uint64_t revision = _scene->contentRevision();
+    return ( revision == _materialized_revision ) ? _pending_revision : revision;
+}
 
-std::set<QtNodes::Node*> GraphicContainer::getSubtreeNodesRecursively(Node &root_node)
+void GraphicContainer::setLayout(QtNodes::PortLayout layout)
 {
-    std::set<QtNodes::Node*> nodes;
-    std::function<void(QtNodes::Node&)> selectRecursively;
+    _scene->setLayout( layout );
+}
 
-    selectRecursively = [&](QtNodes::Node& node)
+AbsBehaviorTree GraphicContainer::loadedTree() const
+{
+    if( !_pending_tree )
     {
-        nodes.insert( &node );
-        auto children = getChildren(*_scene, node, false);
-        for (auto& child: children)
+        return BuildTreeFromScene( _scene );
+    }
+
+    AbsBehaviorTree tree = _pending_tree->tree;
+    // the ports of a built node are the ones of its model
+    for(auto& node: tree.nodes())
+    {
+        PortsMapping ports_mapping;
+        for(const auto& port_it: node.model->ports)
         {
-            selectRecursively(*child);
+            auto value_it = node.ports_mapping.find( port_it.first );
+            ports_mapping.insert( { port_it.first,
+                                    value_it != node.ports_mapping.end() ?
+                                        value_it->second : port_it.second.default_value } );
         }
-    };
+        node.ports_mapping = std::move(ports_mapping);
+    }
+    return tree;
+}
+
+std::shared_ptr<const AbsBehaviorTree> GraphicContainer::cachedTree() const
+{
+    if( !_cached_tree || _cached_revision != revision() )
+    {
+        _cached_tree = std::make_shared<const AbsBehaviorTree>( loadedTree() );
+        _cached_revision = revision();
+    }
+    return _cached_tree;
+}
+
+
+void GraphicContainer::setExpandedRevisions(Node &node,
+                                            const std::function<GraphicContainer*(const QString&)>& tab_by_name)
+{
+    for (auto subtree_node: getSubtreeNodesRecursively( node ) )
+    {
+        auto subtree_model = dynamic_cast<SubtreeNodeModel*>( subtree_node->nodeDataModel() );
+        if( !subtree_model || !subtree_model->expanded() )
+        {
+            continue;
+        }
+        if( GraphicContainer* tab = tab_by_name( subtree_model->registrationName() ) )
+        {
+            subtree_model->setExpandedRevision( tab->revision() );
+        }
+    }
+}
 
-    selectRecursively(root_node);
-    return nodes;
+std::vector<QtNodes::Node*> GraphicContainer::getSubtreeNodesRecursively(Node &root_node)
+{
+    return _topology.subtreeNodes( root_node );
 }
 
 void GraphicContainer::createSubtree(Node &root_node, QString subtree_name )
@@ -324,7 +492,7 @@ void GraphicContainer::onPortValueDoubleClicked(QLineEdit *edit_value)
 {
     for (const auto& it: _scene->nodes())
     {
-        auto node_model = dynamic_cast<BehaviorTreeDataModel*>( it.second->nodeDataModel() );
+        auto node_model = dynamic_cast<BehaviorTreeDataModel*>( it->nodeDataModel() );
         QString val = edit_value ?  edit_value->text() : QString();
         node_model->onHighlightPortValue( val );
     }
@@ -334,12 +502,26 @@ void GraphicContainer::onNodeCreated(Node &node)
 {
     if( auto bt_node = dynamic_cast<BehaviorTreeDataModel*>( node.nodeDataModel() ) )
     {
+        // the scene doesn't see the changes of the models
+        const QUuid uuid = node.uuid();
+        auto modelChanged = [this, uuid]()
+        {
+            _changed_nodes.insert( uuid );
+            _scene->bumpRevision();
+        };
+
         connect( bt_node, &BehaviorTreeDataModel::parameterUpdated,
-                 this, &GraphicContainer::undoableChange );
+                 this, modelChanged );
+
+        connect( bt_node, &BehaviorTreeDataModel::instanceNameChanged,
+                 this, modelChanged );
 
         connect( bt_node, &BehaviorTreeDataModel::portValueDoubleChicked,
                  this, &GraphicContainer::onPortValueDoubleClicked );
 
+        connect( bt_node, &BehaviorTreeDataModel::parameterUpdated,
+                 this, &GraphicContainer::undoableChange );
+
         connect( bt_node, &BehaviorTreeDataModel::instanceNameChanged,
                 this, &GraphicContainer::undoableChange );
 
@@ -355,6 +537,12 @@ void GraphicContainer::onNodeCreated(Node &node)
             {
                 emit requestSubTreeExpand( *this, node );
             });
+            // the output port comes and goes with the expansion
+            connect( subtree_node, &SubtreeNodeModel::expandedChanged,
+                     &(node), [&node, this]()
+            {
+                _topology.updatePorts( node );
+            });
         }
 
         bt_node->initWidget();
@@ -366,7 +554,7 @@ void GraphicContainer::onNodeContextMenu(Node &node, const QPointF &)
 {
     // only allow context menu in editor mode
     auto main_win = dynamic_cast<MainWindow*>( parent() );
-    if( main_win->getGraphicMode() != GraphicMode::EDITOR )
+    if( !main_win || main_win->getGraphicMode() != GraphicMode::EDITOR )
     {
         return;
     }
@@ -410,7 +598,7 @@ QtNodes::Node* GraphicContainer::substituteNode(Node *old_node, const QString& n
     QPointF prev_pos   = _scene->getNodePosition( *old_node );
     double prev_width = old_node->nodeGeometry().width();
 
-    auto& new_node = scene()->createNodeAtPos( new_node_ID, new_node_ID, prev_pos);
+    auto& new_node = _scene->createNodeAtPos( new_node_ID, new_node_ID, prev_pos);
 
     auto bt_old_node = dynamic_cast<BehaviorTreeDataModel*>( old_node->nodeDataModel());
     auto bt_new_node = dynamic_cast<BehaviorTreeDataModel*>( new_node.nodeDataModel());
@@ -443,10 +631,10 @@ QtNodes::Node* GraphicContainer::substituteNode(Node *old_node, const QString& n
     if( old_node->nodeDataModel()->nPorts( PortType::In ) == 1 &&
         new_node.nodeDataModel()->nPorts( PortType::In ) == 1 )
     {
-        auto conn_in  = old_node->nodeState().connections(PortType::In, 0);
-        for(auto it: conn_in)
+        const auto& conn_in  = old_node->nodeState().connections(PortType::In, 0);
+        for(QtNodes::Connection* conn: conn_in)
         {
-            auto child_node = it.second->getNode(PortType::Out);
+            auto child_node = conn->getNode(PortType::Out);
             _scene->createConnection( new_node, 0, *child_node, 0 );
         }
     }
@@ -454,10 +642,10 @@ QtNodes::Node* GraphicContainer::substituteNode(Node *old_node, const QString& n
     if( old_node->nodeDataModel()->nPorts( PortType::Out ) == 1 &&
         new_node.nodeDataModel()->nPorts( PortType::Out ) == 1 )
     {
-        auto conn_in  = old_node->nodeState().connections(PortType::Out, 0);
-        for(auto it: conn_in)
+        const auto& conn_out = old_node->nodeState().connections(PortType::Out, 0);
+        for(QtNodes::Connection* conn: conn_out)
         {
-            auto child_node = it.second->getNode(PortType::In);
+            auto child_node = conn->getNode(PortType::In);
             _scene->createConnection( *child_node, 0, new_node, 0 );
         }
     }
@@ -473,6 +661,9 @@ void GraphicContainer::deleteSubTreeRecursively(Node &root_node)
     auto nodes_to_delete = getSubtreeNodesRecursively(root_node);
     for(auto delete_me: nodes_to_delete)
     {
+        // the signals of the scene are blocked: the parent of the first
+        // node (the SubTree) is marked too, through its connection
+        forgetNode( *delete_me );
         _scene->removeNode( *delete_me );
     }
 }
@@ -513,8 +704,8 @@ void GraphicContainer::createSmartRemoveAction(QtNodes::Node &node, QMenu* node_
     auto *smart_remove = new QAction("Smart Remove ", node_menu);
     node_menu->addAction(smart_remove);
 
-    NodeState::ConnectionPtrSet conn_in  = node.nodeState().connections(PortType::In, 0);
-    NodeState::ConnectionPtrSet conn_out = node.nodeState().connections(PortType::Out, 0);
+    const NodeState::ConnectionPtrSet& conn_in  = node.nodeState().connections(PortType::In, 0);
+    const NodeState::ConnectionPtrSet& conn_out = node.nodeState().connections(PortType::Out, 0);
 
     if( conn_in.size() != 1 || conn_out.size() == 0 )
     {
@@ -522,7 +713,7 @@ void GraphicContainer::createSmartRemoveAction(QtNodes::Node &node, QMenu* node_
         return;
     }
 
-    auto parent_node = conn_in.begin()->second->getNode(PortType::Out);
+    auto parent_node = conn_in.front()->getNode(PortType::Out);
     auto policy = parent_node->nodeDataModel()->portOutConnectionPolicy(0);
 
     if( policy == NodeDataModel::ConnectionPolicy::One && conn_out.size() > 1)
@@ -542,7 +733,7 @@ void GraphicContainer::createSmartRemoveAction(QtNodes::Node &node, QMenu* node_
 void GraphicContainer::onSmartRemove(QtNodes::Node* node)
 {
     auto parent_node = GetParentNode( node );
-    NodeState::ConnectionPtrSet conn_out = node->nodeState().connections(PortType::Out, 0);
+    const NodeState::ConnectionPtrSet& conn_out = node->nodeState().connections(PortType::Out, 0);
 
     if( !parent_node || conn_out.size() == 0 )
     {
@@ -551,9 +742,9 @@ void GraphicContainer::onSmartRemove(QtNodes::Node* node)
 
     {
         const QSignalBlocker blocker(this);
-        for( auto& it: conn_out)
+        for( QtNodes::Connection* conn: conn_out)
         {
-            auto child_node = it.second->getNode(PortType::In);
+            auto child_node = conn->getNode(PortType::In);
             _scene->createConnection( *child_node, 0, *parent_node, 0 );
         }
         _scene->removeNode( *node );
@@ -587,7 +778,7 @@ void GraphicContainer::onConnectionContextMenu(QtNodes::Connection &connection,
 {
     // only allow connection context menu in editor mode
     auto main_win = dynamic_cast<MainWindow*>( parent() );
-    if( main_win->getGraphicMode() != GraphicMode::EDITOR )
+    if( !main_win || main_win->getGraphicMode() != GraphicMode::EDITOR )
     {
         return;
     }
@@ -623,11 +814,13 @@ void GraphicContainer::onConnectionContextMenu(QtNodes::Connection &connection,
 }
 
 void GraphicContainer::recursiveLoadStep(QPointF& cursor,
-                                         AbsBehaviorTree& tree,
-                                         AbstractTreeNode* abs_node,
-                                         Node* parent_node, int nest_level)
+                                         const AbsBehaviorTree& tree, int index,
+                                         Node* parent_node,
+                                         std::vector<Node*>& graphic_nodes,
+                                         int nest_level)
 {
-    Node& new_node = _scene->createNodeAtPos( abs_node->model.registration_ID,
+    const AbstractTreeNode* abs_node = tree.node(index);
+    Node& new_node = _scene->createNodeAtPos( abs_node->model->registration_ID,
                                               abs_node->instance_name,
                                               cursor);
     BehaviorTreeDataModel* bt_node = dynamic_cast<BehaviorTreeDataModel*>( new_node.nodeDataModel() );
@@ -636,16 +829,16 @@ void GraphicContainer::recursiveLoadStep(QPointF& cursor,
     {
         bt_node->setPortMapping( port_it.first, port_it.second );
     }
-    bt_node->initWidget();
+    // the widget was initialized by createNodeAtPos, only the size changed
+    bt_node->updateNodeSize();
 
     new_node.nodeGeometry().recalculateSize();
 
-    abs_node->pos = cursor;
-    abs_node->size = _scene->getNodeSize( new_node );
-    abs_node->graphic_node = &new_node;
+    const QSizeF size = _scene->getNodeSize( new_node );
+    graphic_nodes[index] = &new_node;
 
     // Special case for node Subtree. Expand if necessary
-    if( abs_node->model.type == NodeType::SUBTREE &&
+    if( abs_node->model->type == NodeType::SUBTREE &&
             abs_node->children_index.size() == 1 )
     {
         if( auto subtree_node = dynamic_cast<SubtreeNodeModel*>( bt_node ) )
@@ -657,24 +850,27 @@ void GraphicContainer::recursiveLoadStep(QPointF& cursor,
         }
     }
 
-    _scene->createConnection( *abs_node->graphic_node, 0,
+    _scene->createConnection( new_node, 0,
                               *parent_node, 0 );
 
-    for ( int index: abs_node->children_index)
+    for ( int child: abs_node->children_index)
     {
-        cursor.setX( cursor.x() + abs_node->size.width() );
-        cursor.setY( cursor.y() + abs_node->size.height() );
-        AbstractTreeNode* child = tree.node(index);
-        recursiveLoadStep(cursor, tree, child, abs_node->graphic_node, nest_level+1 );
+        cursor.setX( cursor.x() + size.width() );
+        cursor.setY( cursor.y() + size.height() );
+        recursiveLoadStep(cursor, tree, child, &new_node, graphic_nodes, nest_level+1 );
     }
 }
 
 
-void GraphicContainer::loadSceneFromTree(const AbsBehaviorTree &tree)
+void GraphicContainer::loadSceneFromTree(const AbsBehaviorTree &tree, const QUuid &uuid_seed)
 {
     AbsBehaviorTree abs_tree = tree;
+    _pending_tree.reset();
     _scene->clearScene();
 
+    // nodes are created, placed and published in a single batch
+    QtNodes::BulkBuildGuard bulk_build( *_scene );
+
     auto& first_qt_node = _scene->createNodeAtPos( "Root", "Root", QPointF(0,0) );
 
     QPointF cursor( - first_qt_node.nodeGeometry().width()*0.5,
@@ -682,40 +878,62 @@ void GraphicContainer::loadSceneFromTree(const AbsBehaviorTree &tree)
 
     _scene->setNodePosition( first_qt_node, cursor );
 
-    auto root_node = abs_tree.rootNode();
+    std::vector<Node*> graphic_nodes( abs_tree.nodesCount(), nullptr );
+    int root_index = 0;
 
-    if( root_node->model.registration_ID == "Root" )
+    if( abs_tree.rootNode()->model->registration_ID == "Root" )
     {
-        root_node->graphic_node = &first_qt_node;
-        int root_child_index = root_node->children_index.front();
-        root_node = abs_tree.node(root_child_index);
+        graphic_nodes[0] = &first_qt_node;
+        root_index = abs_tree.rootNode()->children_index.front();
     }
 
-    recursiveLoadStep(cursor, abs_tree, root_node, &first_qt_node, 1 );
+    recursiveLoadStep(cursor, abs_tree, root_index, &first_qt_node, graphic_nodes, 1 );
+
+    // the layout needs the sizes, and places the graphic nodes
+    for(size_t i = 0; i < graphic_nodes.size(); i++)
+    {
+        AbstractTreeNode* abs_node = abs_tree.node(i);
+        abs_node->graphic_node = graphic_nodes[i];
+        if( graphic_nodes[i] )
+        {
+            abs_node->size = _scene->getNodeSize( *graphic_nodes[i] );
+        }
+    }
+
+    if( !uuid_seed.isNull() )
+    {
+        // before the nodes are published, see BulkBuildGuard
+        first_qt_node.setUuid( QUuid::createUuidV5( uuid_seed, QString("Root") ) );
+        for(const auto& abs_node: abs_tree.nodes())
+        {
+            if( abs_node.graphic_node && abs_node.graphic_node != &first_qt_node )
+            {
+                abs_node.graphic_node->setUuid(
+                    QUuid::createUuidV5( uuid_seed, QString::number(abs_node.index) ) );
+            }
+        }
+    }
     NodeReorder( *_scene, abs_tree );
 }
 
-void GraphicContainer::appendTreeToNode(Node &node, AbsBehaviorTree& subtree)
+void GraphicContainer::appendTreeToNode(Node &node, const AbsBehaviorTree& subtree)
 {
     const QSignalBlocker blocker( this );
 
-    for (auto& abs_node: subtree.nodes() )
-    {
-        abs_node.graphic_node = nullptr;
-    }
-
     //--------------------------------------
+    QtNodes::BulkBuildGuard bulk_build( *_scene );
+
     QPointF cursor = _scene->getNodePosition(node) + QPointF(100,100);
 
     auto root_node = subtree.rootNode();
+    int root_index = 0;
 
-    if( root_node->model.registration_ID == "Root" )
+    if( root_node->model->registration_ID == "Root" )
     {
         if( root_node->children_index.size() == 1)
         {
             // first node become the child of Root
-            int root_child_index = root_node->children_index.front();
-            root_node = subtree.node(root_child_index);
+            root_index = root_node->children_index.front();
         }
         else{
             // Root has no child. Stop
@@ -724,12 +942,306 @@ void GraphicContainer::appendTreeToNode(Node &node, AbsBehaviorTree& subtree)
         }
     }
 
-    recursiveLoadStep(cursor, subtree, root_node , &node, 1 );
+    std::vector<Node*> graphic_nodes( subtree.nodesCount(), nullptr );
+    recursiveLoadStep(cursor, subtree, root_index, &node, graphic_nodes, 1 );
+}
+
+QStringList GraphicContainer::expandAllSubtrees(const std::function<GraphicContainer*(const QString&)>& tab_by_name,
+                                               bool change_style)
+{
+    materialize();
+
+    // as it is before the expansion: a SubTree that uses this tab is
+    // expanded once, and the chain is reported as a cycle
+    const std::shared_ptr<const AbsBehaviorTree> own_tree =
+            containsValidTree() ? cachedTree() : nullptr;
+
+    auto lookup = [this, &tab_by_name, &own_tree](const QString& ID) -> std::shared_ptr<const AbsBehaviorTree>
+    {
+        GraphicContainer* tab = tab_by_name( ID );
+        if( tab == this )
+        {
+            return own_tree;
+        }
+        if( !tab || !tab->containsValidTree() )
+        {
+            return nullptr;
+        }
+        return tab->cachedTree();
+    };
+
+    std::vector<QtNodes::Node*> collapsed;
+    for (auto& node_it: _scene->nodes() )
+    {
+        auto subtree_model = dynamic_cast<SubtreeNodeModel*>( node_it->nodeDataModel() );
+        if( subtree_model && !subtree_model->expanded() )
+        {
+            collapsed.push_back( node_it.get() );
+        }
+    }
+
+    FlatSubtreeCache cache;
+    QStringList cycles;
+    std::vector<QtNodes::Node*> expanded;
+    {
+        const QSignalBlocker blocker( this );
+        QtNodes::BulkBuildGuard bulk_build( *_scene );
+
+        for (QtNodes::Node* node: collapsed)
+        {
+            auto subtree_model = static_cast<SubtreeNodeModel*>( node->nodeDataModel() );
+            const QString ID = subtree_model->registrationName();
+            auto flat_tree = FlattenSubtree( ID, lookup, cache, &cycles );
+            if( !flat_tree )
+            {
+                continue;
+            }
+            subtree_model->setExpanded(true);
+            node->nodeState().getEntries(PortType::Out).resize(1);
+            appendTreeToNode( *node, *flat_tree );
+            expanded.push_back( node );
+        }
+    }
+
+    // the connections are published at the end of the bulk build
+    for (QtNodes::Node* node: expanded)
+    {
+        setExpandedRevisions( *node, tab_by_name );
+        lockSubtreeEditing( *node, true, change_style );
+    }
+    if( !expanded.empty() )
+    {
+        nodeReorder();
+    }
+    cycles.removeDuplicates();
+    return cycles;
 }
 
 void GraphicContainer::loadFromJson(const QByteArray &data)
 {
     const QSignalBlocker blocker( this );
     clearScene();
-    scene()->loadFromMemory( data );
+    _scene->loadFromMemory( data );
+}
+
+void GraphicContainer::forgetNode(QtNodes::Node &node)
+{
+    // the connections of the node are deleted after this call
+    _nodes_by_uuid.erase( node.uuid() );
+    _changed_nodes.insert( node.uuid() );
+    _layout_cache.forget( node, _topology );
+    _topology.removeNode( node );
+    for(auto port_type: {PortType::In, PortType::Out})
+    {
+        for(const auto& connections: node.nodeState().getEntries(port_type))
+        {
+            for(QtNodes::Connection* connection: connections)
+            {
+                markConnectionChanged( *connection );
+            }
+        }
+    }
+}
+
+void GraphicContainer::markConnectionChanged(const QtNodes::Connection &connection)
+{
+    for(auto port_type: {PortType::In, PortType::Out})
+    {
+        if( const QtNodes::Node* node = connection.getNode(port_type) )
+        {
+            _changed_nodes.insert( node->uuid() );
+        }
+    }
+}
+
+std::vector<QUuid> GraphicContainer::takeChangedNodes()
+{
+    std::vector<QUuid> changed( _changed_nodes.begin(), _changed_nodes.end() );
+    _changed_nodes.clear();
+    return changed;
+}
+
+std::vector<QUuid> GraphicContainer::nodeUuids() const
+{
+    std::vector<QUuid> uuids;
+    uuids.reserve( _nodes_by_uuid.size() );
+    for(const auto& it: _nodes_by_uuid)
+    {
+        uuids.push_back( it.first );
+    }
+    return uuids;
+}
+
+QtNodes::Node *GraphicContainer::findNode(const QUuid &uuid) const
+{
+    auto it = _nodes_by_uuid.find(uuid);
+    return (it != _nodes_by_uuid.end()) ? _scene->node( it->second ) : nullptr;
+}
+
+NodeRecordPtr GraphicContainer::nodeRecord(const QUuid &uuid) const
+{
+    const QtNodes::Node* node = findNode(uuid);
+    if( !node )
+    {
+        return NodeRecordPtr();
+    }
+    auto record = std::make_shared<NodeRecord>();
+    record->json = node->save();
+
+    const auto& entries = node->nodeState().getEntries(PortType::In);
+    for(size_t port = 0; port < entries.size(); port++)
+    {
+        for(const QtNodes::Connection* connection: entries[port])
+        {
+            const QtNodes::Node* out_node = connection->getNode(PortType::Out);
+            // a node being deleted is already gone for undo/redo
+            if( out_node && findNode( out_node->uuid() ) )
+            {
+                record->inputs.push_back( { static_cast<int>(port),
+                                            out_node->uuid(),
+                                            connection->getPortIndex(PortType::Out) } );
+            }
+        }
+    }
+    return record;
+}
+
+void GraphicContainer::applyNodeChanges(const std::vector<NodeChange> &changes, bool undo)
+{
+    const QSignalBlocker blocker( this );
+
+    auto targetOf = [undo](const NodeChange& change) -> const NodeRecordPtr&
+    {
+        return undo ? change.before : change.after;
+    };
+
+    // first remove the nodes that must not exist...
+    for(const auto& change: changes)
+    {
+        if( !targetOf(change) )
+        {
+            if( QtNodes::Node* node = findNode(change.uuid) )
+            {
+                _scene->removeNode( *node );
+            }
+        }
+    }
+
+    // ...then create or restore the other ones...
+    for(const auto& change: changes)
+    {
+        const NodeRecordPtr& record = targetOf(change);
+        if( !record )
+        {
+            continue;
+        }
+        QtNodes::Node* node = findNode(change.uuid);
+
+        if( node && node->nodeDataModel()->save() == record->json["model"].toObject() )
+        {
+            // same convention of Node::save(): center of the top side
+            const QJsonObject position = record->json["position"].toObject();
+            const qreal width = node->nodeGraphicsObject().boundingRect().width();
+            const QPointF pos( position["x"].toDouble() - width*0.5,
+                               position["y"].toDouble() );
+            if( _scene->getNodePosition( *node ) != pos )
+            {
+                _scene->setNodePosition( *node, pos );
+            }
+            continue;
+        }
+
+        // a different model can't be restored in place: the node is made
+        // again, keeping the connections of its outputs
+        struct OutputLink
+        {
+            int out_port;
+            QUuid in_node;
+            int in_port;
+        };
+        std::vector<OutputLink> outputs;
+        if( node )
+        {
+            const auto& entries = node->nodeState().getEntries(PortType::Out);
+            for(size_t port = 0; port < entries.size(); port++)
+            {
+                for(const QtNodes::Connection* connection: entries[port])
+                {
+                    if( const QtNodes::Node* in_node = connection->getNode(PortType::In) )
+                    {
+                        outputs.push_back( { static_cast<int>(port),
+                                             in_node->uuid(),
+                                             connection->getPortIndex(PortType::In) } );
+                    }
+                }
+            }
+            _scene->removeNode( *node );
+        }
+
+        node = &_scene->restoreNode( record->json );
+
+        const int out_ports = static_cast<int>( node->nodeDataModel()->nPorts(PortType::Out) );
+        for(const auto& link: outputs)
+        {
+            QtNodes::Node* in_node = findNode( link.in_node );
+            if( in_node && link.out_port < out_ports )
+            {
+                _scene->createConnection( *in_node, link.in_port, *node, link.out_port );
+            }
+        }
+    }
+
+    // ...and finally connect their inputs
+    for(const auto& change: changes)
+    {
+        const NodeRecordPtr& record = targetOf(change);
+        QtNodes::Node* node = record ? findNode(change.uuid) : nullptr;
+        if( !node )
+        {
+            continue;
+        }
+
+        std::vector<NodeLink> current_inputs;
+        std::vector<QtNodes::Connection*> to_delete;
+
+        const auto& entries = node->nodeState().getEntries(PortType::In);
+        for(size_t port = 0; port < entries.size(); port++)
+        {
+            for(QtNodes::Connection* connection: entries[port])
+            {
+                const QtNodes::Node* out_node = connection->getNode(PortType::Out);
+                NodeLink link = { static_cast<int>(port),
+                                  out_node ? out_node->uuid() : QUuid(),
+                                  connection->getPortIndex(PortType::Out) };
+
+                if( std::find( record->inputs.begin(), record->inputs.end(), link ) == record->inputs.end() )
+                {
+                    to_delete.push_back( connection );
+                }
+                else{
+                    current_inputs.push_back( link );
+                }
+            }
+        }
+
+        for(QtNodes::Connection* connection: to_delete)
+        {
+            _scene->deleteConnection( *connection );
+        }
+
+        for(const auto& link: record->inputs)
+        {
+            if( std::find( current_inputs.begin(), current_inputs.end(), link ) != current_inputs.end() )
+            {
+                continue;
+            }
+            QtNodes::Node* out_node = findNode( link.out_node );
+            if( out_node &&
+                link.in_port < static_cast<int>( node->nodeDataModel()->nPorts(PortType::In) ) &&
+                link.out_port < static_cast<int>( out_node->nodeDataModel()->nPorts(PortType::Out) ) )
+            {
+                _scene->createConnection( *node, link.in_port, *out_node, link.out_port );
+            }
+        }
+    }
 }
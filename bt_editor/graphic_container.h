@@ -4,9 +4,15 @@
 #include <QObject>
 #include <QWidget>
 #include <QLineEdit>
+#include <QStringList>
+#include <functional>
+#include <unordered_set>
 
 #include "bt_editor_base.h"
 #include "editor_flowscene.h"
+#include "tree_layout.h"
+#include "tree_topology.h"
+#include "undo_history.h"
 
 #include <nodes/Node>
 #include <nodes/NodeData>
@@ -21,31 +27,88 @@ public:
     explicit GraphicContainer(std::shared_ptr<QtNodes::DataModelRegistry> registry,
                               QWidget *parent = nullptr);
 
+    // Empty while the tab is pending: call materialize() first where the
+    // nodes are needed.
     EditorFlowScene* scene() { return _scene; }
     QtNodes::FlowView*  view() { return _view; }
 
     const EditorFlowScene* scene()  const{ return _scene; }
     const QtNodes::FlowView* view() const { return _view; }
 
+    // Keeps the tree, without building its nodes until the scene is needed,
+    // usually when the tab is shown for the first time. Saving, validation
+    // and the expansion of SubTrees use the tree directly.
+    void setPendingTree(PendingTreePtr tree);
+
+    // Null if the nodes have been built already.
+    const PendingTreePtr& pendingTree() const { return _pending_tree; }
+
+    // Builds the nodes of a pending tab. False if there was nothing to build.
+    bool materialize();
+
+    // Revision of the content of the scene, see FlowScene::contentRevision():
+    // moving nodes doesn't change it. Building the nodes of a pending tab
+    // keeps the revision of the pending tree.
+    uint64_t revision() const;
+
+    // Only the layout of the ports: the nodes are not moved.
+    void setLayout(QtNodes::PortLayout layout);
+
     void lockEditing(bool locked);
 
     void lockSubtreeEditing(QtNodes::Node& node, bool locked, bool change_style);
 
     void nodeReorder();
 
+    // false if the scene changed since the last nodeReorder()
+    bool isArranged() const;
+
     void saveSvgFile(const QString path);
 
+    // False if the scene is larger than MAX_IMAGE_PIXELS: save it with
+    // savePngTiles() instead.
+    bool fitsInPngFile();
+
+    // False if the image could not be written, or if !fitsInPngFile().
+    bool savePngFile(const QString path);
+
+    // See SaveSceneTiles().
+    bool savePngTiles(const QString directory);
+
     void zoomHomeView();
 
     bool containsValidTree() const;
 
+    // Parents, children and root of the nodes of the scene.
+    const TreeTopology& topology() const { return _topology; }
+
     void clearScene();
 
+    // The tree as it is in the scene, or as it will be once built.
     AbsBehaviorTree loadedTree() const;
 
-    void loadSceneFromTree(const AbsBehaviorTree &tree);
+    // Same as loadedTree(), but built only once per revision(): every scene
+    // in which this tab is an expanded SubTree shares it. The positions are
+    // the ones of that revision, the nodes may have moved since.
+    std::shared_ptr<const AbsBehaviorTree> cachedTree() const;
+
+    // With a seed, the UUIDs of the nodes are derived from it.
+    void loadSceneFromTree(const AbsBehaviorTree &tree, const QUuid& uuid_seed = QUuid());
+
+    // The subtree is only read: it can be shared, e.g. a cachedTree().
+    void appendTreeToNode(QtNodes::Node& node, const AbsBehaviorTree &subtree);
 
-    void appendTreeToNode(QtNodes::Node& node, AbsBehaviorTree &subtree);
+    // Expands every collapsed SubTree of the scene together with the
+    // SubTrees nested in it (see FlattenSubtree()): the nodes are built at
+    // once and arranged once. 'tab_by_name' gives the tab of a SubTree.
+    // Returns the chains of recursive SubTrees, which were cut.
+    QStringList expandAllSubtrees(const std::function<GraphicContainer*(const QString&)>& tab_by_name,
+                                  bool change_style);
+
+    // Stores in the expanded SubTree 'node', and in the ones nested in it,
+    // the revision() of their tab: they are refreshed when it changes.
+    void setExpandedRevisions(QtNodes::Node& node,
+                              const std::function<GraphicContainer*(const QString&)>& tab_by_name);
 
     void loadFromJson(const QByteArray& data);
 
@@ -53,10 +116,24 @@ public:
 
     void deleteSubTreeRecursively(QtNodes::Node& node);
 
-    std::set<QtNodes::Node*> getSubtreeNodesRecursively(QtNodes::Node &root_node);
+    // The node and all its descendants, parents first.
+    std::vector<QtNodes::Node*> getSubtreeNodesRecursively(QtNodes::Node &root_node);
 
     void createSubtree(QtNodes::Node& root_node, QString subtree_name = QString());
 
+    // Undo/redo: the nodes created, deleted or modified since the last call.
+    std::vector<QUuid> takeChangedNodes();
+
+    std::vector<QUuid> nodeUuids() const;
+
+    // Null if there is no such node in the scene.
+    NodeRecordPtr nodeRecord(const QUuid& uuid) const;
+
+    QtNodes::Node* findNode(const QUuid& uuid) const;
+
+    // Brings the nodes to their state before (undo) or after the changes.
+    void applyNodeChanges(const std::vector<NodeChange>& changes, bool undo);
+
 public slots:
 
     void onNodeDoubleClicked(QtNodes::Node& root_node);
@@ -82,6 +159,10 @@ signals:
 
     void requestSubTreeCreate(AbsBehaviorTree tree, QString name);
 
+    // The nodes of a pending tab have been built. Emitted even if the
+    // signals are blocked.
+    void materialized();
+
 private:
     EditorFlowScene* _scene;
     QtNodes::FlowView*  _view;
@@ -90,16 +171,45 @@ private:
 
    void createSmartRemoveAction(QtNodes::Node &node, QMenu *nodeMenu);
 
+   void markConnectionChanged(const QtNodes::Connection& connection);
+
+   // Undo/redo and topology bookkeeping of a node about to be removed.
+   void forgetNode(QtNodes::Node& node);
+
    void insertNodeInConnection(QtNodes::Connection &connection, QString node_name);
 
-   void recursiveLoadStep(QPointF &cursor, AbsBehaviorTree &tree,
-                          AbstractTreeNode *abs_node,
-                          QtNodes::Node* parent_node, int nest_level);
+   // Creates the node 'index' of the tree and its descendants, and stores
+   // them in graphic_nodes (one per node of the tree).
+   void recursiveLoadStep(QPointF &cursor, const AbsBehaviorTree &tree, int index,
+                          QtNodes::Node* parent_node,
+                          std::vector<QtNodes::Node*>& graphic_nodes, int nest_level);
 
    std::shared_ptr<QtNodes::DataModelRegistry> _model_registry;
 
    bool _signal_was_blocked;
 
+   TreeLayoutCache _layout_cache;
+
+   uint64_t _arranged_revision;
+
+   // content revision of the scene right after materialize(), and of the
+   // pending tree it replaced: the same tree
+   uint64_t _materialized_revision;
+   uint64_t _pending_revision;
+
+   mutable std::shared_ptr<const AbsBehaviorTree> _cached_tree;
+   mutable uint64_t _cached_revision;
+
+   std::unordered_map<QUuid, QtNodes::SlotHandle> _nodes_by_uuid;
+
+   TreeTopology _topology;
+
+   std::unordered_set<QUuid> _changed_nodes;
+
+   PendingTreePtr _pending_tree;
+
+   bool _editing_locked;
+
 };
 
 #endif // GRAPHIC_CONTAINER_H
@@ -7,6 +7,7 @@
 #include <nodes/DataModelRegistry>
 
 #include "mainwindow.h"
+#include "batch_render.h"
 #include "XML_utilities.hpp"
 #include "startup_dialog.h"
 #include "models/RootNodeModel.hpp"
@@ -19,6 +20,15 @@ using QtNodes::ConnectionStyle;
 int
 main(int argc, char *argv[])
 {
+    // nothing is shown when rendering: don't need a display
+    for(int i = 1; i < argc; i++)
+    {
+        if( QByteArray(argv[i]).startsWith("--render") && qgetenv("QT_QPA_PLATFORM").isEmpty() )
+        {
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+        }
+    }
+
     QApplication app(argc, argv);
     app.setApplicationName("Groot");
     app.setWindowIcon(QPixmap(":/icons/BT.png"));
@@ -66,6 +76,24 @@ main(int argc, char *argv[])
                                          "output.svg");
     parser.addOption(output_svg_option);
 
+    // batch rendering, see RenderFiles()
+    QCommandLineOption render_option(QStringList() << "render",
+                                     "Render the files to images in this directory, without any window",
+                                     "directory");
+    parser.addOption(render_option);
+    QCommandLineOption format_option(QStringList() << "format",
+                                     "Format of the rendered images: [svg,png,tiles] (defaults to svg)",
+                                     "format");
+    parser.addOption(format_option);
+    QCommandLineOption all_trees_option(QStringList() << "all-trees",
+                                        "Render every tree of the files, not only the main one");
+    parser.addOption(all_trees_option);
+    QCommandLineOption jobs_option(QStringList() << "jobs",
+                                   "Number of worker processes used to render (defaults to 1)",
+                                   "jobs");
+    parser.addOption(jobs_option);
+    parser.addPositionalArgument("files", "XML files to render (only with --render)", "[files...]");
+
     parser.process( app );
 
     QFile styleFile( ":/stylesheet.qss" );
@@ -73,6 +101,33 @@ main(int argc, char *argv[])
     QString style( styleFile.readAll() );
     app.setStyleSheet( style );
 
+    if( parser.isSet(render_option) )
+    {
+        RenderOptions options;
+        options.output_dir = parser.value(render_option);
+        options.all_trees = parser.isSet(all_trees_option);
+        if( parser.isSet(format_option) )
+        {
+            options.format = parser.value(format_option).toLower();
+        }
+        if( parser.isSet(jobs_option) )
+        {
+            bool ok = false;
+            options.jobs = parser.value(jobs_option).toInt(&ok);
+            if( !ok || options.jobs < 1 )
+            {
+                std::cout << "--jobs needs a positive number" << std::endl;
+                return 1;
+            }
+        }
+        if( parser.positionalArguments().empty() )
+        {
+            std::cout << "--render needs at least one file" << std::endl;
+            return 1;
+        }
+        return RenderFiles( parser.positionalArguments(), options );
+    }
+
     if( parser.isSet(test_option) )
     {
         MainWindow win( GraphicMode::EDITOR );
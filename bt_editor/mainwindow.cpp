@@ -15,18 +15,22 @@
 #include <QSvgWidget>
 #include <QShortcut>
 #include <QTabBar>
+#include <QStatusBar>
 #include <QXmlStreamWriter>
 #include <QDesktopServices>
 #include <QInputDialog>
+#include <QtConcurrent>
 #include <nodes/Node>
 #include <nodes/NodeData>
 #include <nodes/NodeStyle>
 #include <nodes/FlowView>
 #include <thread>
+#include <algorithm>
 
 #include "editor_flowscene.h"
 #include "utils.h"
 #include "XML_utilities.hpp"
+#include "tree_diff_window.h"
 
 #include "models/RootNodeModel.hpp"
 #include "models/SubtreeNodeModel.hpp"
@@ -41,6 +45,22 @@ using QtNodes::FlowScene;
 using QtNodes::NodeGraphicsObject;
 using QtNodes::NodeState;
 
+namespace
+{
+// the most recent steps of the undo/redo stacks are never compressed
+const int UNDO_UNPACKED_STEPS = 10;
+const int DEFAULT_UNDO_MEMORY_LIMIT_MB = 64;
+
+QString FormatMemory(size_t bytes)
+{
+    if( bytes < 1024*1024 )
+    {
+        return QString("%1 KB").arg( bytes / 1024.0, 0, 'f', 1 );
+    }
+    return QString("%1 MB").arg( bytes / (1024.0*1024.0), 0, 'f', 1 );
+}
+}
+
 MainWindow::MainWindow(GraphicMode initial_mode,
                        const QString& monitor_address,
                        const QString& monitor_pub_port,
@@ -71,6 +91,10 @@ MainWindow::MainWindow(GraphicMode initial_mode,
         _current_layout = QtNodes::PortLayout::Vertical;
     }
 
+    const int undo_limit_MB = settings.value("MainWindow/undoMemoryLimitMB",
+                                             DEFAULT_UNDO_MEMORY_LIMIT_MB).toInt();
+    _undo_memory_limit = size_t( std::max(1, undo_limit_MB) ) * 1024 * 1024;
+
     _model_registry = std::make_shared<QtNodes::DataModelRegistry>();
 
     //------------------------------------------------------
@@ -83,9 +107,10 @@ MainWindow::MainWindow(GraphicMode initial_mode,
             category = "Root";
         }
         QtNodes::DataModelRegistry::RegistryItemCreator creator;
-        creator = [model]() -> QtNodes::DataModelRegistry::RegistryItemPtr
+        NodeModelPtr shared_model = InternNodeModel( model );
+        creator = [shared_model]() -> QtNodes::DataModelRegistry::RegistryItemPtr
         {
-            auto ptr = new BehaviorTreeDataModel( model );
+            auto ptr = new BehaviorTreeDataModel( shared_model );
             return std::unique_ptr<BehaviorTreeDataModel>(ptr);
         };
         _model_registry->registerModel( category, creator, ID );
@@ -226,7 +251,8 @@ MainWindow::MainWindow(GraphicMode initial_mode,
     createTab("BehaviorTree");
     onTabSetMainTree(0);
     onSceneChanged();
-    _current_state = saveCurrentState();
+    _current_state = saveWindowState();
+    _undo_recorder.commit( _tab_info );
 }
 
 
@@ -246,6 +272,7 @@ void MainWindow::closeEvent(QCloseEvent *event)
     }
 
     settings.setValue("StartupDialog.Mode", toStr( _current_mode ) );
+    settings.setValue("MainWindow/undoMemoryLimitMB", int( _undo_memory_limit / (1024*1024) ) );
 
     QMainWindow::closeEvent(event);
 }
@@ -269,6 +296,12 @@ GraphicContainer* MainWindow::createTab(const QString &name)
 
     //--------------------------------
 
+    connect( ti, &GraphicContainer::materialized,
+            this, [this, ti]()
+    {
+        _undo_recorder.rebase( *ti );
+    });
+
     connect( ti, &GraphicContainer::undoableChange,
             this, &MainWindow::onPushUndo );
 
@@ -297,32 +330,9 @@ MainWindow::~MainWindow()
 
 void MainWindow::loadFromXML(const QString& xml_text)
 {
-    QDomDocument document;
+    XMLTreeFile file;
     try{
-        QString errorMsg;
-        int errorLine;
-        if( ! document.setContent(xml_text, &errorMsg, &errorLine ) )
-        {
-            throw std::runtime_error( tr("Error parsing XML (line %1): %2").arg(errorLine).arg(errorMsg).toStdString() );
-        }
-        //---------------
-        std::vector<QString> registered_ID;
-        for (const auto& it: _treenode_models)
-        {
-            registered_ID.push_back( it.first );
-        }
-        std::vector<QString> error_messages;
-        bool done = VerifyXML(document, registered_ID, error_messages );
-
-        if( !done )
-        {
-            QString merged_error;
-            for (const auto& err: error_messages)
-            {
-                merged_error += err + "\n";
-            }
-            throw std::runtime_error( merged_error.toStdString() );
-        }
+        file = ReadXMLTrees( xml_text, _treenode_models );
     }
     catch( std::runtime_error& err)
     {
@@ -332,21 +342,26 @@ void MainWindow::loadFromXML(const QString& xml_text)
         return;
     }
 
+    for (const auto& warning: file.warnings)
+    {
+        QMessageBox::question(this, "Fix your file!", warning, QMessageBox::Ok );
+    }
+
     //---------------
     bool error = false;
     QString err_message;
     auto saved_state = _current_state;
+    // the nodes as they were, to go back to them if loading fails
+    const UndoRecorder saved_records = _undo_recorder;
     auto prev_tree_model = _treenode_models;
 
     try {
-        auto document_root = document.documentElement();
-
-        if( document_root.hasAttribute("main_tree_to_execute"))
+        if( !file.main_tree.isEmpty() )
         {
-            _main_tree = document_root.attribute("main_tree_to_execute");
+            _main_tree = file.main_tree;
         }
 
-        auto custom_models = ReadTreeNodesModel( document_root );
+        const NodeModels& custom_models = file.models;
 
         for( const auto& model: custom_models)
         {
@@ -359,23 +374,39 @@ void MainWindow::loadFromXML(const QString& xml_text)
 
         const QSignalBlocker blocker( currentTabInfo() );
 
-        for (auto bt_root = document_root.firstChildElement("BehaviorTree");
-             !bt_root.isNull();
-             bt_root = bt_root.nextSiblingElement("BehaviorTree"))
+        // the nodes of a tab are built only when it is shown
+        for (const auto& it: file.trees)
         {
-            auto tree = BuildTreeFromXML( bt_root, _treenode_models );
             QString tree_name("BehaviorTree");
 
-            if( bt_root.hasAttribute("ID") )
+            if( !it.first.isEmpty() )
             {
-                tree_name = bt_root.attribute("ID");
+                tree_name = it.first;
                 if( _main_tree.isEmpty() )  // valid when there is only one
                 {
                     _main_tree = tree_name;
                 }
             }
-            onCreateAbsBehaviorTree(tree, tree_name);
+
+            auto container = getTabByName(tree_name);
+            if( !container )
+            {
+                container = createTab(tree_name);
+            }
+            auto pending = std::make_shared<PendingTree>();
+            pending->tree = it.second;
+            pending->uuid_seed = QUuid::createUuid();
+            container->setPendingTree( pending );
+
+            for(const auto& node: it.second.nodes())
+            {
+                if( node.model->type == NodeType::SUBTREE && getTabByName(node.model->registration_ID) == nullptr)
+                {
+                    createTab(node.model->registration_ID);
+                }
+            }
         }
+        clearUndoStacks();
 
         if( !_main_tree.isEmpty() )
         {
@@ -397,7 +428,7 @@ void MainWindow::loadFromXML(const QString& xml_text)
             _main_tree = "BehaviorTree";
         }
         else{
-            currentTabInfo()->nodeReorder();
+            currentTabInfo()->materialize();
         }
         auto models_to_remove = GetModelsToRemove(this, _treenode_models, custom_models);
 
@@ -414,7 +445,11 @@ void MainWindow::loadFromXML(const QString& xml_text)
     if( error )
     {
         _treenode_models = prev_tree_model;
-        loadSavedStateFromJson( saved_state );
+        UndoStep revert;
+        revert.before = saved_state;
+        revert.after = saveWindowState();
+        revert.tabs = saved_records.compare( _tab_info );
+        applyUndoStep( revert, true );
         qDebug() << "R: Undo size: " << _undo_stack.size() << " Redo size: " << _redo_stack.size();
         QMessageBox::warning(this, tr("Exception!"),
                              tr("It was not possible to parse the file. Error:\n\n%1"). arg( err_message ),
@@ -460,177 +495,153 @@ void MainWindow::on_actionLoad_triggered()
     loadFromXML(xml_text);
 }
 
-QString MainWindow::saveToXML() const
+void MainWindow::on_actionCompare_triggered()
 {
-    QDomDocument doc;
+    auto container = currentTabInfo();
+    if( !container )
+    {
+        return;
+    }
 
-    const char* COMMENT_SEPARATOR = " ////////// ";
+    QSettings settings;
+    QString directory_path  = settings.value("MainWindow.lastLoadDirectory",
+                                            QDir::homePath() ).toString();
 
-    QDomElement root = doc.createElement( "root" );
-    doc.appendChild( root );
+    QString fileName = QFileDialog::getOpenFileName(this,
+                                                    tr("Compare with file"), directory_path,
+                                                    tr("BehaviorTree files (*.xml)"));
+    QFile file(fileName);
+    if (fileName.isEmpty() || !file.open(QIODevice::ReadOnly)){
+        return;
+    }
 
-    if( _main_tree.isEmpty() == false)
+    XMLTreeFile other;
+    try{
+        other = ReadXMLTrees( QTextStream(&file).readAll(), _treenode_models );
+    }
+    catch( std::runtime_error& err)
     {
-        root.setAttribute("main_tree_to_execute", _main_tree.toStdString().c_str());
+        QMessageBox::critical(this, "Error parsing the XML", err.what() );
+        return;
     }
 
-    for (auto& it: _tab_info)
+    // the tree with the same name, otherwise the main one
+    const QString tab_name = ui->tabWidget->tabText( ui->tabWidget->currentIndex() );
+    const AbsBehaviorTree* before = nullptr;
+    for(const auto& it: other.trees)
     {
-        auto& container = it.second;
-        auto  scene = container->scene();
-
-        auto abs_tree = BuildTreeFromScene(container->scene());
-        auto abs_root = abs_tree.rootNode();
-        if( abs_root->children_index.size() == 1 &&
-            abs_root->model.registration_ID == "Root"  )
+        if( it.first == tab_name )
         {
-            // move to the child of ROOT
-            abs_root = abs_tree.node( abs_root->children_index.front() );
+            before = &it.second;
         }
-
-        QtNodes::Node* root_node = abs_root->graphic_node;
-
-        root.appendChild( doc.createComment(COMMENT_SEPARATOR) );
-        QDomElement root_element = doc.createElement("BehaviorTree");
-
-        root_element.setAttribute("ID", it.first.toStdString().c_str());
-        root.appendChild(root_element);
-
-        RecursivelyCreateXml(*scene, doc, root_element, root_node );
     }
-    root.appendChild( doc.createComment(COMMENT_SEPARATOR) );
-
-    QDomElement root_models = doc.createElement("TreeNodesModel");
-
-    for(const auto& tree_it: _treenode_models)
+    for(const auto& it: other.trees)
     {
-        const auto& ID    = tree_it.first;
-        const auto& model = tree_it.second;
-
-        if( BuiltinNodeModels().count(ID) != 0 )
+        if( !before && ( it.first == other.main_tree || other.trees.size() == 1 ) )
         {
-            continue;
+            before = &it.second;
         }
+    }
+    if( !before )
+    {
+        QMessageBox::warning(this, tr("Compare with file"),
+                             tr("There is no tree called [%1] in the file.").arg(tab_name) );
+        return;
+    }
 
-        QDomElement node = doc.createElement( QString::fromStdString(toStr(model.type)) );
+    // the file is drawn with its own models (the ones it does not declare
+    // are taken from the editor), the tab with the models of the editor
+    NodeModels before_models = other.models;
+    before_models.insert( _treenode_models.begin(), _treenode_models.end() );
 
-        if( !node.isNull() )
-        {
-            node.setAttribute("ID", ID);
+    auto window = new TreeDiffWindow( *before, QFileInfo(fileName).fileName(),
+                                      container->loadedTree(), tab_name,
+                                      CreateModelRegistry( before_models ),
+                                      CreateModelRegistry( _treenode_models ),
+                                      _current_layout, this );
+    window->show();
+}
 
-            for(const auto& port_it: model.ports)
-            {
-                const auto& port_name = port_it.first;
-                const auto& port = port_it.second;
+void MainWindow::on_actionExpandAll_triggered()
+{
+    auto container = currentTabInfo();
+    if( !container )
+    {
+        return;
+    }
 
-                QDomElement port_element = writePortModel(port_name, port, doc);
-                node.appendChild( port_element );
-            }
-        }
-        root_models.appendChild(node);
+    QStringList cycles;
+    {
+        const QSignalBlocker blocker( this );
+        cycles = container->expandAllSubtrees( [this](const QString& ID)
+                                               {
+                                                   return getTabByName(ID);
+                                               },
+                                               _current_mode == GraphicMode::EDITOR );
     }
-    root.appendChild(root_models);
-    root.appendChild( doc.createComment(COMMENT_SEPARATOR) );
 
-    return xmlDocumentToString(doc);
+    if( !cycles.isEmpty() )
+    {
+        QMessageBox::warning(this, tr("Recursive SubTrees"),
+                             tr("These SubTrees contain themselves, they were expanded only once:\n%1")
+                             .arg( cycles.join("\n") ) );
+    }
 }
 
-QString MainWindow::xmlDocumentToString(const QDomDocument &document) const
+QString MainWindow::saveToXML() const
 {
-  QString output_string;
-
-  QXmlStreamWriter stream(&output_string);
-
-  stream.setAutoFormatting(true);
-  stream.setAutoFormattingIndent(4);
-
-  stream.writeStartDocument();
-
-  auto root_element = document.documentElement();
-
-  stream.writeStartElement(root_element.tagName());
+    QString output_string;
+    QXmlStreamWriter stream(&output_string);
+    writeXML(stream);
+    return output_string;
+}
 
-  streamElementAttributes(stream, root_element);
+void MainWindow::writeXML(QXmlStreamWriter &stream) const
+{
+    const char* COMMENT_SEPARATOR = " ////////// ";
 
-  auto next_node = root_element.firstChild();
+    stream.setAutoFormatting(true);
+    stream.setAutoFormattingIndent(4);
 
-  while ( !next_node.isNull() )
-  {
-    recursivelySaveNodeCanonically(stream, next_node);
+    stream.writeStartDocument();
+    stream.writeStartElement("root");
 
-    if ( stream.hasError() )
+    if( _main_tree.isEmpty() == false)
     {
-        break;
+        stream.writeAttribute("main_tree_to_execute", _main_tree);
     }
-    next_node = next_node.nextSibling();
-  }
-
-  stream.writeEndElement();
-  stream.writeEndDocument();
 
-  return output_string;
-}
-
-void MainWindow::streamElementAttributes(QXmlStreamWriter &stream, const QDomElement &element) const
-{
-    if (element.hasAttributes())
+    for (auto& it: _tab_info)
     {
-        QMap<QString, QString> attributes;
-        const QDomNamedNodeMap attributes_map = element.attributes();
+        auto& container = it.second;
 
-        for (int i = 0; i < attributes_map.count(); ++i)
+        auto abs_tree = container->loadedTree();
+        auto abs_root = abs_tree.rootNode();
+        if( abs_root && abs_root->children_index.size() == 1 &&
+            abs_root->model->registration_ID == "Root"  )
         {
-           auto attribute = attributes_map.item(i);
-            attributes.insert(attribute.nodeName(), attribute.nodeValue());
+            // move to the child of ROOT
+            abs_root = abs_tree.node( abs_root->children_index.front() );
         }
 
-        auto i = attributes.constBegin();
-        while (i != attributes.constEnd())
+        stream.writeComment(COMMENT_SEPARATOR);
+        stream.writeStartElement("BehaviorTree");
+        stream.writeAttribute("ID", it.first);
+
+        if( abs_root )
         {
-            stream.writeAttribute(i.key(), i.value());
-            ++i;
+            WriteTreeNodeXml(stream, abs_tree, *abs_root);
         }
+        stream.writeEndElement();
     }
-}
+    stream.writeComment(COMMENT_SEPARATOR);
 
-void MainWindow::recursivelySaveNodeCanonically(QXmlStreamWriter &stream, const QDomNode &parent_node) const
-{
-  if ( stream.hasError() )
-  {
-    return;
-  }
-
-  if ( parent_node.isElement() )
-  {
-    const QDomElement parent_element = parent_node.toElement();
-
-    if ( !parent_element.isNull() )
-    {
-        stream.writeStartElement(parent_element.tagName());
+    WriteNodeModelsXml(stream, _treenode_models);
 
-        streamElementAttributes(stream, parent_element);
+    stream.writeComment(COMMENT_SEPARATOR);
 
-        if (parent_element.hasChildNodes())
-        {
-            auto child = parent_element.firstChild();
-            while ( !child.isNull() )
-            {
-                recursivelySaveNodeCanonically(stream, child);
-                child = child.nextSibling();
-            }
-        }
-
-        stream.writeEndElement();
-    }
-  }
-  else if (parent_node.isComment())
-  {
-    stream.writeComment(parent_node.nodeValue());
-  }
-  else if (parent_node.isText())
-  {
-    stream.writeCharacters(parent_node.nodeValue());
-  }
+    stream.writeEndElement();
+    stream.writeEndDocument();
 }
 
 void MainWindow::on_actionSave_triggered()
@@ -666,12 +677,10 @@ void MainWindow::on_actionSave_triggered()
         fileName += ".xml";
     }
 
-    QString xml_text = saveToXML();
-
     QFile file(fileName);
     if (file.open(QIODevice::WriteOnly)) {
-        QTextStream stream(&file);
-        stream << xml_text;
+        QXmlStreamWriter stream(&file);
+        writeXML(stream);
     }
 
     directory_path = QFileInfo(fileName).absolutePath();
@@ -681,6 +690,7 @@ void MainWindow::on_actionSave_triggered()
 void MainWindow::onAutoArrange()
 {
     currentTabInfo()->nodeReorder();
+    currentTabInfo()->zoomHomeView();
 }
 
 void MainWindow::onSaveSvg()
@@ -693,8 +703,39 @@ void MainWindow::onSaveSvg()
 
     QString fileName = QFileDialog::getSaveFileName(this,
                                                     tr("Save BehaviorTree to svg"), directory_path,
-                                                    tr("SVG files (*.svg)"));
-    currentTabInfo()->saveSvgFile(fileName);
+                                                    tr("SVG files (*.svg);;PNG images (*.png)"));
+    if (fileName.isEmpty()){
+        return;
+    }
+    if( fileName.endsWith(".png", Qt::CaseInsensitive) )
+    {
+        if( currentTabInfo()->fitsInPngFile() )
+        {
+            if( !currentTabInfo()->savePngFile(fileName) )
+            {
+                QMessageBox::warning(this, tr("Save BehaviorTree to png"),
+                                     tr("It was not possible to write the file\n%1").arg(fileName));
+            }
+        }
+        else{
+            // too large for a single image
+            QFileInfo info(fileName);
+            const QString tiles_dir = info.absoluteDir().filePath( info.completeBaseName() + "_tiles" );
+            if( currentTabInfo()->savePngTiles(tiles_dir) )
+            {
+                QMessageBox::information(this, tr("Save BehaviorTree to png"),
+                                         tr("The image is too large: it was saved as tiles in\n%1").arg(tiles_dir));
+            }
+            else{
+                QMessageBox::warning(this, tr("Save BehaviorTree to png"),
+                                     tr("The image is too large for a single file, and it was "
+                                        "not possible to write the tiles in\n%1").arg(tiles_dir));
+            }
+        }
+    }
+    else{
+        currentTabInfo()->saveSvgFile(fileName);
+    }
 
     directory_path = QFileInfo(fileName).absolutePath();
     settings.setValue("SidepanelEditor.lastSaveSvgDirectory", directory_path);
@@ -793,33 +834,35 @@ void MainWindow::on_splitter_splitterMoved(int , int )
     }
 }
 
-MainWindow::SavedState MainWindow::saveCurrentState()
+MainWindow::WindowState MainWindow::saveWindowState()
 {
-    SavedState saved;
+    WindowState saved;
     int index = ui->tabWidget->currentIndex();
     saved.main_tree = _main_tree;
     saved.current_tab_name = ui->tabWidget->tabText(index);
     auto current_view = getTabByName( saved.current_tab_name )->view();
     saved.view_transform = current_view->transform();
     saved.view_area = current_view->sceneRect();
-
-    for (auto& it: _tab_info)
-    {
-        saved.json_states[it.first] = it.second->scene()->saveToMemory();
-    }
     return saved;
 }
 
 void MainWindow::onPushUndo()
 {
-    SavedState saved = saveCurrentState();
+    UndoStep step;
+    step.before = _current_state;
+    step.after = saveWindowState();
+    // only what changed since the last step
+    step.tabs = _undo_recorder.commit( _tab_info );
 
-    if( _undo_stack.empty() || ( saved != _current_state &&  _undo_stack.back() != _current_state) )
+    _current_state = step.after;
+
+    if( !step.tabs.empty() || step.before.main_tree != step.after.main_tree )
     {
-        _undo_stack.push_back( std::move(_current_state) );
+        step.bytes = sizeof(UndoStep) + EstimateMemoryUsage( step.tabs );
+        _undo_stack.push_back( std::move(step) );
         _redo_stack.clear();
     }
-    _current_state = saved;
+    trimUndoHistory();
 
     //qDebug() << "P: Undo size: " << _undo_stack.size() << " Redo size: " << _redo_stack.size();
 }
@@ -830,11 +873,20 @@ void MainWindow::onUndoInvoked()
 
     if( _undo_stack.size() > 0)
     {
-        _redo_stack.push_back( std::move(_current_state) );
-        _current_state = _undo_stack.back();
+        UndoStep step = std::move( _undo_stack.back() );
         _undo_stack.pop_back();
 
-        loadSavedStateFromJson(_current_state);
+        if( !unpackUndoStep( step ) )
+        {
+            // the older steps start from where this one would go back to
+            _undo_stack.clear();
+            trimUndoHistory();
+            statusBar()->showMessage( tr("The undo history is corrupted and has been cleared"), 5000 );
+            return;
+        }
+        applyUndoStep( step, true );
+        _redo_stack.push_back( std::move(step) );
+        trimUndoHistory();
 
         // qDebug() << "U: Undo size: " << _undo_stack.size() << " Redo size: " << _redo_stack.size();
     }
@@ -846,59 +898,166 @@ void MainWindow::onRedoInvoked()
 
     if( _redo_stack.size() > 0)
     {
-        _undo_stack.push_back( _current_state );
-        _current_state = std::move( _redo_stack.back() );
+        UndoStep step = std::move( _redo_stack.back() );
         _redo_stack.pop_back();
 
-        loadSavedStateFromJson(_current_state);
+        if( !unpackUndoStep( step ) )
+        {
+            // the next steps start from where this one would go to
+            _redo_stack.clear();
+            trimUndoHistory();
+            statusBar()->showMessage( tr("The redo history is corrupted and has been cleared"), 5000 );
+            return;
+        }
+        applyUndoStep( step, false );
+        _undo_stack.push_back( std::move(step) );
+        trimUndoHistory();
 
         // qDebug() << "R: Undo size: " << _undo_stack.size() << " Redo size: " << _redo_stack.size();
     }
 }
 
-void MainWindow::loadSavedStateFromJson(SavedState saved_state)
+bool MainWindow::unpackUndoStep(UndoStep &step)
 {
-    // TODO crash if the name of the container (tab) changed
-    for (auto& it: _tab_info)
+    if( !step.packed_tabs.isEmpty() )
     {
-        it.second->clearScene();
-        it.second->deleteLater();
+        if( !UnpackTabChanges( step.packed_tabs, step.tabs ) )
+        {
+            return false;
+        }
+        step.packed_tabs.clear();
+        step.bytes = sizeof(UndoStep) + EstimateMemoryUsage( step.tabs );
     }
-    _tab_info.clear();
-    ui->tabWidget->clear();
+    return true;
+}
 
-    _main_tree = saved_state.main_tree;
+void MainWindow::trimUndoHistory()
+{
+    for(auto stack: {&_undo_stack, &_redo_stack})
+    {
+        // the steps below the packed one are packed already
+        for(int i = int(stack->size()) - UNDO_UNPACKED_STEPS - 1; i >= 0; i--)
+        {
+            UndoStep& step = (*stack)[i];
+            if( !step.packed_tabs.isEmpty() )
+            {
+                break;
+            }
+            step.packed_tabs = PackTabChanges( step.tabs );
+            step.tabs = std::vector<TabChange>();
+            step.bytes = sizeof(UndoStep) + size_t( step.packed_tabs.size() );
+        }
+    }
+
+    size_t total_bytes = 0;
+    for(auto stack: {&_undo_stack, &_redo_stack})
+    {
+        for(const auto& step: *stack)
+        {
+            total_bytes += step.bytes;
+        }
+    }
 
-    for(const auto& it: saved_state.json_states)
+    // forget the oldest changes first, but keep the last one anyway
+    while( total_bytes > _undo_memory_limit && _undo_stack.size() > 1 )
     {
-        QString tab_name = it.first;
-        _tab_info.insert( {tab_name, createTab(tab_name)} );
+        total_bytes -= _undo_stack.front().bytes;
+        _undo_stack.pop_front();
     }
-    for(const auto& it: saved_state.json_states)
+    while( total_bytes > _undo_memory_limit && !_redo_stack.empty() )
     {
-        QString name = it.first;
-        auto container = getTabByName(name);
-        container->loadFromJson( it.second );
-        container->view()->setTransform( saved_state.view_transform );
-        container->view()->setSceneRect( saved_state.view_area );
+        total_bytes -= _redo_stack.front().bytes;
+        _redo_stack.pop_front();
     }
 
-    for (int i=0; i< ui->tabWidget->count(); i++)
+    ui->labelUndoMemory->setText( tr("Undo: %1").arg( FormatMemory(total_bytes) ) );
+    ui->labelUndoMemory->setToolTip( tr("%1 undo and %2 redo steps, limit %3")
+                                     .arg( _undo_stack.size() )
+                                     .arg( _redo_stack.size() )
+                                     .arg( FormatMemory(_undo_memory_limit) ) );
+}
+
+void MainWindow::applyUndoStep(const UndoStep &step, bool undo)
+{
+    const WindowState& state = undo ? step.before : step.after;
     {
-        if( ui->tabWidget->tabText( i ) == saved_state.current_tab_name)
+        // changing the current tab would refresh and rearrange it
+        const QSignalBlocker blocker( ui->tabWidget );
+
+        for(const auto& tab: step.tabs)
+        {
+            const bool exists = undo ? tab.existed_before : tab.exists_after;
+            auto container = getTabByName( tab.name );
+
+            if( !exists )
+            {
+                if( container )
+                {
+                    for( int index = 0; index < ui->tabWidget->count(); index++)
+                    {
+                        if( ui->tabWidget->tabText(index) == tab.name )
+                        {
+                            ui->tabWidget->removeTab( index );
+                            break;
+                        }
+                    }
+                    container->clearScene();
+                    container->deleteLater();
+                    _tab_info.erase( tab.name );
+                }
+                continue;
+            }
+
+            if( !container )
+            {
+                container = createTab( tab.name );
+                container->clearScene();
+            }
+
+            const PendingTreePtr& from_tree = undo ? tab.pending_after : tab.pending_before;
+            const PendingTreePtr& to_tree = undo ? tab.pending_before : tab.pending_after;
+            if( from_tree )
+            {
+                // the nodes of the tree, if built since, are not in the step
+                container->clearScene();
+            }
+            container->applyNodeChanges( tab.nodes, undo );
+            if( to_tree )
+            {
+                container->setPendingTree( to_tree );
+            }
+        }
+
+        // the scenes are as recorded in the step already
+        _undo_recorder.commit( _tab_info );
+
+        _main_tree = state.main_tree;
+
+        for (int i=0; i< ui->tabWidget->count(); i++)
         {
-            ui->tabWidget->setCurrentIndex(i);
-            ui->tabWidget->widget(i)->setFocus();
+            if( ui->tabWidget->tabText( i ) == state.current_tab_name)
+            {
+                ui->tabWidget->setCurrentIndex(i);
+                ui->tabWidget->widget(i)->setFocus();
+            }
+            if( ui->tabWidget->tabText(i) == _main_tree)
+            {
+                onTabSetMainTree(i);
+            }
         }
-        if( ui->tabWidget->tabText(i) == _main_tree)
+        if( ui->tabWidget->count() == 1 )
         {
-            onTabSetMainTree(i);
+            onTabSetMainTree(0);
         }
     }
-    if( ui->tabWidget->count() == 1 )
+
+    if( auto container = getTabByName( state.current_tab_name ) )
     {
-        onTabSetMainTree(0);
+        container->materialize();
+        container->view()->setTransform( state.view_transform );
+        container->view()->setSceneRect( state.view_area );
     }
+    _current_state = state;
     onSceneChanged();
 }
 
@@ -945,13 +1104,14 @@ void MainWindow::onAddToModelRegistry(const NodeModel &model)
     namespace util = QtNodes::detail;
     const auto& ID = model.registration_ID;
 
-    DataModelRegistry::RegistryItemCreator node_creator = [model]() -> DataModelRegistry::RegistryItemPtr
+    NodeModelPtr shared_model = InternNodeModel( model );
+    DataModelRegistry::RegistryItemCreator node_creator = [shared_model]() -> DataModelRegistry::RegistryItemPtr
     {
-        if( model.type == NodeType::SUBTREE)
+        if( shared_model->type == NodeType::SUBTREE)
         {
-            return util::make_unique<SubtreeNodeModel>(model);
+            return util::make_unique<SubtreeNodeModel>(shared_model);
         }
-        return util::make_unique<BehaviorTreeDataModel>(model);
+        return util::make_unique<BehaviorTreeDataModel>(shared_model);
     };
 
     _model_registry->registerModel( QString::fromStdString( toStr(model.type)), node_creator, ID);
@@ -971,6 +1131,14 @@ void MainWindow::onDestroySubTree(const QString &ID)
             continue;
         }
         auto container = it.second;
+        // only the tabs using the SubTree are built
+        if( container->pendingTree() &&
+            container->pendingTree()->tree.findNodesByID( ID ).empty() &&
+            container->pendingTree()->tree.findNodes( ID ).empty() )
+        {
+            continue;
+        }
+        container->materialize();
         auto tree = BuildTreeFromScene(container->scene());
         for( const auto& abs_node: tree.nodes())
         {
@@ -996,7 +1164,7 @@ void MainWindow::onDestroySubTree(const QString &ID)
     {
         if( ui->tabWidget->tabText(index) == ID)
         {
-            sub_container->scene()->clearScene();
+            sub_container->clearScene();
             sub_container->deleteLater();
             ui->tabWidget->removeTab( index );
             _tab_info.erase(ID);
@@ -1015,26 +1183,30 @@ void MainWindow::onDestroySubTree(const QString &ID)
 
 void MainWindow::onModelRemoveRequested(QString ID)
 {
-    BehaviorTreeDataModel* node_found = nullptr;
+    bool node_found = false;
     QString tab_containing_node;
 
     for (auto& it: _tab_info)
     {
         auto container = it.second;
+        if( container->pendingTree() )
+        {
+            node_found = !container->pendingTree()->tree.findNodesByID( ID ).empty();
+        }
         for(const auto& node_it: container->scene()->nodes() )
         {
-            QtNodes::Node* graphic_node = node_it.second.get();
+            QtNodes::Node* graphic_node = node_it.get();
             auto bt_node = dynamic_cast<BehaviorTreeDataModel*>( graphic_node->nodeDataModel() );
 
             if( bt_node->model().registration_ID == ID )
             {
-                node_found = bt_node;
-                tab_containing_node = it.first;
+                node_found = true;
                 break;
             }
         }
-        if( node_found != nullptr )
+        if( node_found )
         {
+            tab_containing_node = it.first;
             break;
         }
     }
@@ -1058,7 +1230,7 @@ void MainWindow::onModelRemoveRequested(QString ID)
     else
     {
         int ret = QMessageBox::Cancel;
-        if( node_found->model().type != NodeType::SUBTREE )
+        if( node_type != NodeType::SUBTREE )
         {
             ret = QMessageBox::warning(this,"Delete TreeNode Model?",
                                        "Are you sure? This action can't be undone.",
@@ -1110,14 +1282,18 @@ QtNodes::Node* MainWindow::subTreeExpand(GraphicContainer &container,
             return &node;
         }
 
-        auto abs_subtree = BuildTreeFromScene( subtree_container->scene() );
+        auto abs_subtree = subtree_container->cachedTree();
 
         subtree_model->setExpanded(true);
         node.nodeState().getEntries(PortType::Out).resize(1);
-        container.appendTreeToNode( node, abs_subtree );
+        container.appendTreeToNode( node, *abs_subtree );
+        container.setExpandedRevisions( node, [this](const QString& ID)
+                                        {
+                                            return getTabByName(ID);
+                                        } );
         container.lockSubtreeEditing( node, true, is_editor_mode );
 
-        if( abs_subtree.nodes().size() > 1 )
+        if( abs_subtree->nodesCount() > 1 )
         {
             container.nodeReorder();
         }
@@ -1132,7 +1308,7 @@ QtNodes::Node* MainWindow::subTreeExpand(GraphicContainer &container,
         QtNodes::Node* child_node = nullptr;
         if(conn_out.size() == 1)
         {
-            child_node = conn_out.begin()->second->getNode( PortType::In );
+            child_node = conn_out.front()->getNode( PortType::In );
         }
 
         const QSignalBlocker blocker( container );
@@ -1163,13 +1339,23 @@ QtNodes::Node* MainWindow::subTreeExpand(GraphicContainer &container,
             throw std::logic_error("subTreeExpand with SUBTREE_REFRESH, but not an expanded SubTree");
         }
 
-        QtNodes::Node* child_node = conn_out.begin()->second->getNode( PortType::In );
+        QtNodes::Node* child_node = conn_out.front()->getNode( PortType::In );
 
         auto subtree_container = getTabByName(subtree_name);
-        auto subtree = BuildTreeFromScene( subtree_container->scene() );
+        // nothing changed in the SubTree since it was expanded here
+        if( !subtree_container ||
+            subtree_model->expandedRevision() == subtree_container->revision() )
+        {
+            return &node;
+        }
+        auto subtree = subtree_container->cachedTree();
 
         container.deleteSubTreeRecursively( *child_node );
-        container.appendTreeToNode( node, subtree );
+        container.appendTreeToNode( node, *subtree );
+        container.setExpandedRevisions( node, [this](const QString& ID)
+                                        {
+                                            return getTabByName(ID);
+                                        } );
         container.nodeReorder();
         container.lockSubtreeEditing( node, true, is_editor_mode );
 
@@ -1213,14 +1399,15 @@ void MainWindow::onCreateAbsBehaviorTree(const AbsBehaviorTree &tree,
     }
     const QSignalBlocker blocker( container );
     container->loadSceneFromTree( tree );
-    container->nodeReorder();
+    // loadSceneFromTree already placed the nodes
+    container->zoomHomeView();
 
     if( secondary_tabs ){
       for(const auto& node: tree.nodes())
       {
-        if( node.model.type == NodeType::SUBTREE && getTabByName(node.model.registration_ID) == nullptr)
+        if( node.model->type == NodeType::SUBTREE && getTabByName(node.model->registration_ID) == nullptr)
         {
-          createTab(node.model.registration_ID);
+          createTab(node.model->registration_ID);
         }
       }
     }
@@ -1242,9 +1429,17 @@ void MainWindow::onTreeNodeEdited(QString prev_ID, QString new_ID)
         auto container = it.second;
         std::vector<QtNodes::Node*> nodes_to_rename;
 
+        // only the tabs using the model are built
+        if( container->pendingTree() &&
+            container->pendingTree()->tree.findNodesByID( prev_ID ).empty() )
+        {
+            continue;
+        }
+        container->materialize();
+
         for(const auto& node_it: container->scene()->nodes() )
         {
-            QtNodes::Node* graphic_node = node_it.second.get();
+            QtNodes::Node* graphic_node = node_it.get();
             if( !graphic_node )  {
                 continue;
             }
@@ -1378,24 +1573,41 @@ void MainWindow::refreshNodesLayout(QtNodes::PortLayout new_layout)
         ui->toolButtonLayout->update();
     }
 
-    bool refreshed = false;
+    // the scenes can be used only here, in the GUI thread, but the layout
+    // works on the abstract trees alone: compute all of them in parallel.
+    std::vector<std::pair<QtNodes::FlowScene*, AbsBehaviorTree>> trees;
+    for(auto& tab: _tab_info)
+    {
+        if( tab.second->pendingTree() )
+        {
+            // nothing to move yet
+            tab.second->setLayout( new_layout );
+            continue;
+        }
+        auto scene = tab.second->scene();
+        if( scene->layout() != new_layout )
+        {
+            trees.push_back( { scene, BuildTreeFromScene( scene ) } );
+            scene->setLayout( new_layout );
+        }
+    }
+
+    QtConcurrent::blockingMap( trees,
+                               [new_layout](std::pair<QtNodes::FlowScene*, AbsBehaviorTree>& tree)
+    {
+        ComputeTreeLayout( tree.second, new_layout );
+    });
+
     {
         const QSignalBlocker blocker( currentTabInfo() );
-        for(auto& tab: _tab_info)
+        for(auto& tree: trees)
         {
-            auto scene = tab.second->scene();
-            if( scene->layout() != new_layout )
-            {
-                auto abstract_tree = BuildTreeFromScene( scene );
-                scene->setLayout( new_layout );
-                NodeReorder( *scene, abstract_tree );
-                refreshed = true;
-            }
+            ApplyTreeLayout( *tree.first, tree.second );
         }
         on_toolButtonCenterView_pressed();
     }
     _current_layout = new_layout;
-    if(refreshed)
+    if( !trees.empty() )
     {
         onPushUndo();
     }
@@ -1407,32 +1619,37 @@ void MainWindow::refreshExpandedSubtrees()
     if( !container){
         return;
     }
-    auto scene = container->scene();
-    auto root_node = findRoot( *scene );
+    container->materialize();
+    const TreeTopology& topology = container->topology();
+    auto root_node = topology.root();
     if( !root_node )
     {
         return;
     }
 
+    // the outermost expanded SubTrees that changed since, nested ones included:
+    // refreshing a SubTree rebuilds the ones inside it
     std::vector<QtNodes::Node*> subtree_nodes;
-    std::function<void(QtNodes::Node*)> selectRecursively;
-
-    selectRecursively = [&](QtNodes::Node* node)
+    std::vector<QtNodes::Node*> pending = { root_node };
+    while( !pending.empty() )
     {
+        QtNodes::Node* node = pending.back();
+        pending.pop_back();
         auto subtree_model = dynamic_cast<SubtreeNodeModel*>(node->nodeDataModel());
         if(subtree_model && subtree_model->expanded())
         {
-            subtree_nodes.push_back( node );
-        }
-        else{
-            auto children = getChildren( scene, *node, false );
-            for(auto child_node: children)
+            auto subtree_container = getTabByName( subtree_model->registrationName() );
+            // a tab expanded in itself is never up to date
+            if( subtree_container && subtree_container != container &&
+                subtree_model->expandedRevision() != subtree_container->revision() )
             {
-                selectRecursively(child_node);
+                subtree_nodes.push_back( node );
+                continue;
             }
         }
-    };
-    selectRecursively( root_node );
+        const auto& children = topology.children( *node );
+        pending.insert( pending.end(), children.begin(), children.end() );
+    }
 
     for (auto subtree_node: subtree_nodes)
     {
@@ -1526,35 +1743,16 @@ void MainWindow::on_tabWidget_currentChanged(int index)
     if( tab )
     {
         const QSignalBlocker blocker( tab );
-        tab->nodeReorder();
         _current_state.current_tab_name = ui->tabWidget->tabText( index );
+        tab->materialize();
         refreshExpandedSubtrees();
-        tab->zoomHomeView();
-    }
-}
-
-bool MainWindow::SavedState::operator ==(const MainWindow::SavedState &other) const
-{
-    if( current_tab_name != other.current_tab_name ||
-        json_states.size() != other.json_states.size())
-    {
-        return false;
-    }
-    for(auto& it: json_states  )
-    {
-        auto other_it = other.json_states.find(it.first);
-        if( other_it == other.json_states.end() ||
-            it.second != other_it->second)
+        // don't move the nodes (and the view) of a tab that didn't change
+        if( !tab->isArranged() )
         {
-            return false;
+            tab->nodeReorder();
+            tab->zoomHomeView();
         }
     }
-    if( view_area != other.view_area ||
-        view_transform != other.view_transform)
-    {
-        return false;
-    }
-    return true;
 }
 
 void MainWindow::resetTreeStyle(AbsBehaviorTree &tree){
@@ -1562,7 +1760,7 @@ void MainWindow::resetTreeStyle(AbsBehaviorTree &tree){
     QtNodes::NodeStyle  node_style;
     QtNodes::ConnectionStyle conn_style;
 
-    for(auto abs_node: tree.nodes()){
+    for(const auto& abs_node: tree.nodes()){
         auto gui_node = abs_node.graphic_node;
 
         gui_node->nodeDataModel()->setNodeStyle( node_style );
@@ -1571,7 +1769,7 @@ void MainWindow::resetTreeStyle(AbsBehaviorTree &tree){
         const auto& conn_in = gui_node->nodeState().connections(PortType::In, 0 );
         if(conn_in.size() == 1)
         {
-            auto conn = conn_in.begin()->second;
+            auto conn = conn_in.front();
             conn->setStyle( conn_style );
             conn->connectionGraphicsObject().update();
         }
@@ -1608,7 +1806,7 @@ void MainWindow::onChangeNodesStatus(const QString& bt_name,
         const auto& conn_in = gui_node->nodeState().connections(PortType::In, 0 );
         if(conn_in.size() == 1)
         {
-            auto conn = conn_in.begin()->second;
+            auto conn = conn_in.front();
             conn->setStyle( style.second );
             conn->connectionGraphicsObject().update();
         }
@@ -14,6 +14,7 @@
 #include <nodes/DataModelRegistry>
 
 #include "graphic_container.h"
+#include "undo_history.h"
 #include "XML_utilities.hpp"
 #include "sidepanel_editor.h"
 #include "sidepanel_replay.h"
@@ -144,6 +145,10 @@ private slots:
 
     void on_actionReportIssue_triggered();
 
+    void on_actionCompare_triggered();
+
+    void on_actionExpandAll_triggered();
+
 public:
 
     void lockEditing(const bool locked);
@@ -164,24 +169,38 @@ private:
 
     void refreshExpandedSubtrees();
 
-    void streamElementAttributes(QXmlStreamWriter &stream, const QDomElement &element) const;
-
-    QString xmlDocumentToString(const QDomDocument &document) const;
+    // Canonical XML of all the trees and of the custom models, see saveToXML()
+    void writeXML(QXmlStreamWriter &stream) const;
 
-    void recursivelySaveNodeCanonically(QXmlStreamWriter &stream, const QDomNode &parent_node) const;
-
-    struct SavedState
+    // what undo/redo restores, besides the nodes
+    struct WindowState
     {
         QString main_tree;
         QString current_tab_name;
         QTransform view_transform;
         QRectF view_area;
-        std::map<QString, QByteArray> json_states;
-        bool operator ==( const SavedState& other) const;
-        bool operator !=( const SavedState& other) const { return !( *this == other); }
     };
 
-    void loadSavedStateFromJson(SavedState state);
+    struct UndoStep
+    {
+        UndoStep(): bytes(0) {}
+
+        WindowState before;
+        WindowState after;
+        std::vector<TabChange> tabs;
+        // the old steps keep their tabs here, see PackTabChanges()
+        QByteArray packed_tabs;
+        size_t bytes;
+    };
+
+    void applyUndoStep(const UndoStep& step, bool undo);
+
+    // False if the packed tabs of the step can't be read back.
+    static bool unpackUndoStep(UndoStep& step);
+
+    // Compresses the older steps and drops the oldest ones when the history
+    // takes more memory than allowed.
+    void trimUndoHistory();
 
     QtNodes::Node *subTreeExpand(GraphicContainer& container,
                        QtNodes::Node &node,
@@ -197,9 +216,11 @@ private:
 
     std::mutex _mutex;
 
-    std::deque<SavedState> _undo_stack;
-    std::deque<SavedState> _redo_stack;
-    SavedState _current_state;
+    std::deque<UndoStep> _undo_stack;
+    std::deque<UndoStep> _redo_stack;
+    WindowState _current_state;
+    UndoRecorder _undo_recorder;
+    size_t _undo_memory_limit;
     QtNodes::PortLayout _current_layout;
 
     NodeModels _treenode_models;
@@ -217,7 +238,7 @@ private:
     QString _monitor_server_port;
     bool _monitor_autoconnect;
 
-    MainWindow::SavedState saveCurrentState();
+    MainWindow::WindowState saveWindowState();
     void clearUndoStacks();
 };
 
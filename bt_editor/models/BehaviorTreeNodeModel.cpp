@@ -15,13 +15,13 @@ const int DEFAULT_LINE_WIDTH  = 100;
 const int DEFAULT_FIELD_WIDTH = 50;
 const int DEFAULT_LABEL_WIDTH = 50;
 
-BehaviorTreeDataModel::BehaviorTreeDataModel(const NodeModel &model):
+BehaviorTreeDataModel::BehaviorTreeDataModel(NodeModelPtr model):
     _params_widget(nullptr),
     _uid( GetUID() ),
-    _model(model),
+    _model( std::move(model) ),
     _icon_renderer(nullptr),
     _style_caption_color( QtNodes::NodeStyle().FontColor ),
-    _style_caption_alias( model.registration_ID )
+    _style_caption_alias( _model->registration_ID )
 {
     readStyle();
     _main_widget = new QFrame();
@@ -84,7 +84,7 @@ BehaviorTreeDataModel::BehaviorTreeDataModel(const NodeModel &model):
 
     for(int pref_index=0; pref_index < 3; pref_index++)
     {
-        for(const auto& port_it: model.ports )
+        for(const auto& port_it: _model->ports )
         {
             auto preferred_direction = preferred_port_types[pref_index];
             if( port_it.second.direction != preferred_direction )
@@ -180,7 +180,7 @@ BehaviorTreeDataModel::~BehaviorTreeDataModel()
 
 BT::NodeType BehaviorTreeDataModel::nodeType() const
 {
-    return _model.type;
+    return _model->type;
 }
 
 void BehaviorTreeDataModel::initWidget()
@@ -232,14 +232,14 @@ unsigned int BehaviorTreeDataModel::nPorts(QtNodes::PortType portType) const
     }
     else if( portType == QtNodes::PortType::In )
     {
-        return (_model.registration_ID == "Root") ? 0 : 1;
+        return (_model->registration_ID == "Root") ? 0 : 1;
     }
     return 0;
 }
 
 NodeDataModel::ConnectionPolicy BehaviorTreeDataModel::portOutConnectionPolicy(QtNodes::PortIndex) const
 {
-    return ( nodeType() == NodeType::DECORATOR || _model.registration_ID == "Root") ? ConnectionPolicy::One : ConnectionPolicy::Many;
+    return ( nodeType() == NodeType::DECORATOR || _model->registration_ID == "Root") ? ConnectionPolicy::One : ConnectionPolicy::Many;
 }
 
 void BehaviorTreeDataModel::updateNodeSize()
@@ -339,9 +339,9 @@ void BehaviorTreeDataModel::readStyle()
         qDebug()<<"JSON object is empty.";
         return;
     }
-    QString model_type_name( QString::fromStdString(toStr(_model.type)) );
+    QString model_type_name( QString::fromStdString(toStr(_model->type)) );
 
-    for (const auto& model_name: { model_type_name, _model.registration_ID} )
+    for (const auto& model_name: { model_type_name, _model->registration_ID} )
     {
         if( toplevel_object.contains(model_name) )
         {
@@ -364,7 +364,7 @@ void BehaviorTreeDataModel::readStyle()
 
 const QString& BehaviorTreeDataModel::registrationName() const
 {
-    return _model.registration_ID;
+    return _model->registration_ID;
 }
 
 const QString &BehaviorTreeDataModel::instanceName() const
@@ -27,7 +27,7 @@ class BehaviorTreeDataModel : public NodeDataModel
     Q_OBJECT
 
 public:
-    BehaviorTreeDataModel(const NodeModel &model );
+    BehaviorTreeDataModel(NodeModelPtr model);
 
     ~BehaviorTreeDataModel() override;
 
@@ -53,7 +53,10 @@ public:
 
     const QString &registrationName() const;
 
-    const NodeModel &model() const { return _model; }
+    const NodeModel &model() const { return *_model; }
+
+    // Shared with the other nodes of the same model, see InternNodeModel().
+    const NodeModelPtr& sharedModel() const { return _model; }
 
     QString name() const final { return registrationName(); }
 
@@ -101,7 +104,7 @@ protected:
     QFrame* _caption_logo_right;
 
 private:
-    const NodeModel _model;
+    const NodeModelPtr _model;
     QString _instance_name;
     QSvgRenderer* _icon_renderer;
 
@@ -2,9 +2,10 @@
 #include <QLineEdit>
 #include <QVBoxLayout>
 
-SubtreeNodeModel::SubtreeNodeModel(const NodeModel &model):
-    BehaviorTreeDataModel ( model ),
-    _expanded(false)
+SubtreeNodeModel::SubtreeNodeModel(NodeModelPtr model):
+    BehaviorTreeDataModel ( std::move(model) ),
+    _expanded(false),
+    _expanded_revision(0)
 {
     _line_edit_name->setReadOnly(true);
     _line_edit_name->setHidden(true);
@@ -35,10 +36,15 @@ SubtreeNodeModel::SubtreeNodeModel(const NodeModel &model):
 
 void SubtreeNodeModel::setExpanded(bool expand)
 {
+    const bool changed = ( _expanded != expand );
     _expanded = expand;
     _expand_button->setText( _expanded ? "Collapse" : "Expand");
     _expand_button->adjustSize();
     _main_widget->adjustSize();
+    if( changed )
+    {
+        emit expandedChanged();
+    }
 }
 
 void SubtreeNodeModel::setInstanceName(const QString &name)
@@ -9,7 +9,7 @@ class SubtreeNodeModel : public BehaviorTreeDataModel
     Q_OBJECT
 public:
 
-    SubtreeNodeModel(const NodeModel& model);
+    SubtreeNodeModel(NodeModelPtr model);
 
     ~SubtreeNodeModel() override = default;
 
@@ -17,6 +17,12 @@ public:
 
     bool expanded() const { return _expanded; }
 
+    // revision of the SubTree's own tab when it was expanded here,
+    // see GraphicContainer::revision()
+    uint64_t expandedRevision() const { return _expanded_revision; }
+
+    void setExpandedRevision(uint64_t revision) { _expanded_revision = revision; }
+
     unsigned int  nPorts(PortType portType) const override
     {
         int out_port = _expanded ? 1 : 0;
@@ -38,9 +44,13 @@ public:
 signals:
     void expandButtonPushed();
 
+    // nPorts(PortType::Out) changed
+    void expandedChanged();
+
 private:
     QPushButton* _expand_button;
     bool _expanded;
+    uint64_t _expanded_revision;
 
 };
 
@@ -0,0 +1,329 @@
+#include "snapshot_codec.h"
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <cmath>
+
+namespace
+{
+
+const quint32 SNAPSHOT_MAGIC   = 0x47535331; // "GSS1"
+const quint16 SNAPSHOT_VERSION = 1;
+
+enum JsonTag : quint8
+{
+    TAG_NULL,
+    TAG_FALSE,
+    TAG_TRUE,
+    TAG_INT,
+    TAG_DOUBLE,
+    TAG_STRING,
+    TAG_ARRAY,
+    TAG_OBJECT
+};
+
+void writeVarUInt(QDataStream& stream, quint64 value)
+{
+    while( value >= 0x80 )
+    {
+        stream << quint8( (value & 0x7F) | 0x80 );
+        value >>= 7;
+    }
+    stream << quint8(value);
+}
+
+quint64 readVarUInt(QDataStream& stream)
+{
+    quint64 value = 0;
+    for(int shift = 0; shift < 64; shift += 7)
+    {
+        quint8 byte = 0;
+        stream >> byte;
+        value |= quint64(byte & 0x7F) << shift;
+        if( !(byte & 0x80) )
+        {
+            break;
+        }
+    }
+    return value;
+}
+
+// zig-zag, so that small negative numbers stay small
+quint64 encodeSigned(qint64 value)
+{
+    return (quint64(value) << 1) ^ quint64(value >> 63);
+}
+
+qint64 decodeSigned(quint64 value)
+{
+    return qint64(value >> 1) ^ -qint64(value & 1);
+}
+
+void writeRawString(QDataStream& stream, const QString& value)
+{
+    const QByteArray utf8 = value.toUtf8();
+    writeVarUInt( stream, quint64( utf8.size() ) );
+    stream.writeRawData( utf8.constData(), utf8.size() );
+}
+
+QString readRawString(QDataStream& stream)
+{
+    const quint64 size = readVarUInt(stream);
+    if( stream.status() != QDataStream::Ok || size > quint64( stream.device()->bytesAvailable() ) )
+    {
+        stream.setStatus( QDataStream::ReadCorruptData );
+        return QString();
+    }
+    QByteArray utf8( int(size), Qt::Uninitialized );
+    stream.readRawData( utf8.data(), int(size) );
+    return QString::fromUtf8( utf8 );
+}
+
+} // end namespace
+
+
+SnapshotWriter::SnapshotWriter():
+    _stream( &_body, QIODevice::WriteOnly )
+{
+    _stream.setVersion( QDataStream::Qt_5_0 );
+}
+
+void SnapshotWriter::writeBool(bool value)
+{
+    _stream << quint8( value ? 1 : 0 );
+}
+
+void SnapshotWriter::writeUInt(quint64 value)
+{
+    writeVarUInt( _stream, value );
+}
+
+void SnapshotWriter::writeInt(qint64 value)
+{
+    writeVarUInt( _stream, encodeSigned(value) );
+}
+
+void SnapshotWriter::writeDouble(double value)
+{
+    _stream << value;
+}
+
+void SnapshotWriter::writeString(const QString &value)
+{
+    auto it = _string_index.find(value);
+    if( it == _string_index.end() )
+    {
+        it = _string_index.insert( value, quint64( _strings.size() ) );
+        _strings.push_back( value );
+    }
+    writeVarUInt( _stream, it.value() );
+}
+
+void SnapshotWriter::writeUuid(const QUuid &value)
+{
+    const QByteArray bytes = value.toRfc4122();
+    _stream.writeRawData( bytes.constData(), bytes.size() );
+}
+
+void SnapshotWriter::writeJson(const QJsonValue &value)
+{
+    switch( value.type() )
+    {
+    case QJsonValue::Bool:
+        _stream << quint8( value.toBool() ? TAG_TRUE : TAG_FALSE );
+        break;
+
+    case QJsonValue::Double:
+    {
+        const double number = value.toDouble();
+        // most numbers are small integers: ports, flags, rounded positions.
+        // Not -0, the integer would lose its sign.
+        if( std::floor(number) == number && std::fabs(number) < 1e15 &&
+            !std::signbit(number) )
+        {
+            _stream << quint8( TAG_INT );
+            writeInt( qint64(number) );
+        }
+        else{
+            _stream << quint8( TAG_DOUBLE );
+            writeDouble( number );
+        }
+        break;
+    }
+    case QJsonValue::String:
+        _stream << quint8( TAG_STRING );
+        writeString( value.toString() );
+        break;
+
+    case QJsonValue::Array:
+    {
+        const QJsonArray array = value.toArray();
+        _stream << quint8( TAG_ARRAY );
+        writeUInt( quint64( array.size() ) );
+        for(const QJsonValue& item: array)
+        {
+            writeJson( item );
+        }
+        break;
+    }
+    case QJsonValue::Object:
+    {
+        const QJsonObject object = value.toObject();
+        _stream << quint8( TAG_OBJECT );
+        writeUInt( quint64( object.size() ) );
+        for(auto it = object.begin(); it != object.end(); ++it)
+        {
+            writeString( it.key() );
+            writeJson( it.value() );
+        }
+        break;
+    }
+    default:
+        _stream << quint8( TAG_NULL );
+    }
+}
+
+QByteArray SnapshotWriter::data() const
+{
+    QByteArray result;
+    QDataStream stream( &result, QIODevice::WriteOnly );
+    stream.setVersion( QDataStream::Qt_5_0 );
+
+    stream << SNAPSHOT_MAGIC << SNAPSHOT_VERSION;
+    writeVarUInt( stream, quint64( _strings.size() ) );
+    for(const QString& string: _strings)
+    {
+        writeRawString( stream, string );
+    }
+    stream.writeRawData( _body.constData(), _body.size() );
+    return result;
+}
+
+
+SnapshotReader::SnapshotReader(const QByteArray &data):
+    _data(data),
+    _stream( _data ),
+    _valid(false)
+{
+    _stream.setVersion( QDataStream::Qt_5_0 );
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    _stream >> magic >> version;
+    if( magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION )
+    {
+        return;
+    }
+
+    const quint64 count = readVarUInt( _stream );
+    // every string takes at least one byte
+    if( count > quint64( _data.size() ) )
+    {
+        return;
+    }
+    _strings.reserve( int(count) );
+    for(quint64 i = 0; i < count && _stream.status() == QDataStream::Ok; i++)
+    {
+        _strings.push_back( readRawString( _stream ) );
+    }
+    _valid = (_stream.status() == QDataStream::Ok);
+}
+
+bool SnapshotReader::isValid() const
+{
+    return _valid && _stream.status() == QDataStream::Ok;
+}
+
+void SnapshotReader::setCorrupt()
+{
+    _stream.setStatus( QDataStream::ReadCorruptData );
+}
+
+bool SnapshotReader::readBool()
+{
+    quint8 value = 0;
+    _stream >> value;
+    return value != 0;
+}
+
+quint64 SnapshotReader::readUInt()
+{
+    return readVarUInt( _stream );
+}
+
+qint64 SnapshotReader::readInt()
+{
+    return decodeSigned( readVarUInt( _stream ) );
+}
+
+double SnapshotReader::readDouble()
+{
+    double value = 0;
+    _stream >> value;
+    return value;
+}
+
+QString SnapshotReader::readString()
+{
+    const quint64 index = readVarUInt( _stream );
+    if( index >= quint64( _strings.size() ) )
+    {
+        _stream.setStatus( QDataStream::ReadCorruptData );
+        return QString();
+    }
+    return _strings[ int(index) ];
+}
+
+QUuid SnapshotReader::readUuid()
+{
+    QByteArray bytes( 16, Qt::Uninitialized );
+    if( _stream.readRawData( bytes.data(), 16 ) != 16 )
+    {
+        _stream.setStatus( QDataStream::ReadPastEnd );
+        return QUuid();
+    }
+    return QUuid::fromRfc4122( bytes );
+}
+
+QJsonValue SnapshotReader::readJson()
+{
+    quint8 tag = TAG_NULL;
+    _stream >> tag;
+
+    switch( tag )
+    {
+    case TAG_FALSE:  return QJsonValue( false );
+    case TAG_TRUE:   return QJsonValue( true );
+    case TAG_INT:    return QJsonValue( double( readInt() ) );
+    case TAG_DOUBLE: return QJsonValue( readDouble() );
+    case TAG_STRING: return QJsonValue( readString() );
+
+    case TAG_ARRAY:
+    {
+        QJsonArray array;
+        const quint64 size = readUInt();
+        for(quint64 i = 0; i < size && _stream.status() == QDataStream::Ok; i++)
+        {
+            array.append( readJson() );
+        }
+        return array;
+    }
+    case TAG_OBJECT:
+    {
+        QJsonObject object;
+        const quint64 size = readUInt();
+        for(quint64 i = 0; i < size && _stream.status() == QDataStream::Ok; i++)
+        {
+            const QString key = readString();
+            object.insert( key, readJson() );
+        }
+        return object;
+    }
+    case TAG_NULL:
+        return QJsonValue();
+
+    default:
+        setCorrupt();
+        return QJsonValue();
+    }
+}
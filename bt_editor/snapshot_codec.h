@@ -0,0 +1,83 @@
+#ifndef SNAPSHOT_CODEC_H
+#define SNAPSHOT_CODEC_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QHash>
+#include <QJsonValue>
+#include <QString>
+#include <QUuid>
+#include <QVector>
+
+// Compact binary encoding of the snapshots kept in memory, e.g. by the undo
+// history. JSON text is still what is written to files.
+//
+// Every string (model names, port names and values, JSON keys) is stored
+// once in a table and then referred to by its index: the same few names
+// repeat in almost every node. Numbers are variable-length encoded.
+//
+// The data starts with a magic number and a version; a reader refuses data
+// written with another version.
+class SnapshotWriter
+{
+public:
+    SnapshotWriter();
+
+    void writeBool(bool value);
+
+    void writeUInt(quint64 value);
+
+    void writeInt(qint64 value);
+
+    void writeDouble(double value);
+
+    void writeString(const QString& value);
+
+    void writeUuid(const QUuid& value);
+
+    void writeJson(const QJsonValue& value);
+
+    // Header, string table and everything written so far.
+    QByteArray data() const;
+
+private:
+    QByteArray _body;
+    QDataStream _stream;
+    QHash<QString, quint64> _string_index;
+    QVector<QString> _strings;
+};
+
+class SnapshotReader
+{
+public:
+    explicit SnapshotReader(const QByteArray& data);
+
+    // False if the data has another version, if it ended too soon or if
+    // something read made no sense.
+    bool isValid() const;
+
+    // For the checks done by the caller: isValid() is false from now on.
+    void setCorrupt();
+
+    bool readBool();
+
+    quint64 readUInt();
+
+    qint64 readInt();
+
+    double readDouble();
+
+    QString readString();
+
+    QUuid readUuid();
+
+    QJsonValue readJson();
+
+private:
+    QByteArray _data;
+    QDataStream _stream;
+    QVector<QString> _strings;
+    bool _valid;
+};
+
+#endif // SNAPSHOT_CODEC_H
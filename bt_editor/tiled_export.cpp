@@ -0,0 +1,119 @@
+#include "tiled_export.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFuture>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <QtMath>
+#include <algorithm>
+#include <deque>
+
+bool SaveSceneTiles(QGraphicsScene &scene, const QRectF &rect,
+                    const QString &directory, int tile_size)
+{
+    QDir dir( directory );
+    if( tile_size < 1 || !dir.mkpath(".") )
+    {
+        return false;
+    }
+
+    // tiles painted but not written yet
+    const int max_pending = std::max( 2, QThreadPool::globalInstance()->maxThreadCount() * 2 );
+    std::deque<QFuture<bool>> pending;
+    bool success = true;
+
+    auto waitOldest = [&pending, &success]()
+    {
+        pending.front().waitForFinished();
+        success = pending.front().result() && success;
+        pending.pop_front();
+    };
+
+    QJsonArray levels;
+    qreal scale = 1.0;
+
+    for(int level = 0; success; level++)
+    {
+        const int width  = std::max( 1, qCeil( rect.width()  * scale ) );
+        const int height = std::max( 1, qCeil( rect.height() * scale ) );
+        const int columns = (width  + tile_size - 1) / tile_size;
+        const int rows    = (height + tile_size - 1) / tile_size;
+
+        if( !dir.mkpath( QString::number(level) ) )
+        {
+            success = false;
+            break;
+        }
+
+        for(int row = 0; row < rows; row++)
+        {
+            for(int column = 0; column < columns; column++)
+            {
+                const QRect target( column * tile_size, row * tile_size,
+                                    std::min( tile_size, width  - column * tile_size ),
+                                    std::min( tile_size, height - row * tile_size ) );
+                const QRectF source( rect.left() + target.x() / scale,
+                                     rect.top()  + target.y() / scale,
+                                     target.width()  / scale,
+                                     target.height() / scale );
+
+                QImage tile( target.size(), QImage::Format_ARGB32_Premultiplied );
+                tile.fill( Qt::transparent );
+                {
+                    QPainter painter( &tile );
+                    painter.setRenderHint( QPainter::Antialiasing );
+                    scene.render( &painter, QRectF( tile.rect() ), source, Qt::IgnoreAspectRatio );
+                }
+
+                const QString path = dir.filePath( QString("%1/%2_%3.png").arg(level).arg(column).arg(row) );
+                if( int(pending.size()) >= max_pending )
+                {
+                    waitOldest();
+                }
+                pending.push_back( QtConcurrent::run( [tile, path]()
+                {
+                    return tile.save( path, "PNG" );
+                }) );
+            }
+        }
+
+        QJsonObject json_level;
+        json_level["width"]   = width;
+        json_level["height"]  = height;
+        json_level["columns"] = columns;
+        json_level["rows"]    = rows;
+        levels.append( json_level );
+
+        if( columns == 1 && rows == 1 )
+        {
+            break;
+        }
+        scale *= 0.5;
+    }
+
+    while( !pending.empty() )
+    {
+        waitOldest();
+    }
+    if( !success )
+    {
+        return false;
+    }
+
+    QJsonObject description;
+    description["tile_size"] = tile_size;
+    description["levels"] = levels;
+
+    QFile file( dir.filePath("tiles.json") );
+    if( !file.open( QIODevice::WriteOnly ) )
+    {
+        return false;
+    }
+    return file.write( QJsonDocument( description ).toJson() ) > 0;
+}
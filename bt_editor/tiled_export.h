@@ -0,0 +1,26 @@
+#ifndef TILED_EXPORT_H
+#define TILED_EXPORT_H
+
+#include <QGraphicsScene>
+#include <QRectF>
+#include <QString>
+
+// Above this size, a scene is exported as tiles rather than as a single image.
+const qint64 MAX_IMAGE_PIXELS = 100 * 1000 * 1000;
+
+// Writes 'rect' of the scene as a pyramid of PNG tiles of tile_size pixels:
+// "<directory>/<level>/<column>_<row>.png". Level 0 has one pixel per unit of
+// the scene, every following level is half the size of the previous one, and
+// the last one fits in a single tile. "<directory>/tiles.json" describes the
+// size of every level.
+//
+// The scene is painted tile by tile in the calling thread (graphics items
+// are not thread-safe), while the tiles already painted are compressed and
+// written by QtConcurrent. Only a few tiles are in memory at the same time,
+// whatever the size of the scene.
+//
+// False if any file could not be written.
+bool SaveSceneTiles(QGraphicsScene& scene, const QRectF& rect,
+                    const QString& directory, int tile_size = 512);
+
+#endif // TILED_EXPORT_H
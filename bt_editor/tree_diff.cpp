@@ -0,0 +1,273 @@
+#include "tree_diff.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+namespace
+{
+
+// Above this, the children are aligned greedily rather than with a longest
+// common subsequence, which needs a table of this size.
+const size_t MAX_LCS_CELLS = 4 * 1000 * 1000;
+
+typedef std::vector<std::pair<int, int>> IndexPairs;
+
+// The children of the node that are in the tree, into 'children'.
+void ValidChildren(const AbsBehaviorTree& tree, int index, std::vector<int>& children)
+{
+    children.clear();
+    for(int child: tree.node(index)->children_index)
+    {
+        if( child >= 0 && child < int(tree.nodesCount()) )
+        {
+            children.push_back( child );
+        }
+    }
+}
+
+// Hash of the model ID of every node.
+std::vector<quint64> ModelHashes(const AbsBehaviorTree& tree)
+{
+    std::vector<quint64> hashes( tree.nodesCount() );
+    for(size_t i = 0; i < hashes.size(); i++)
+    {
+        hashes[i] = HashString( tree.node(i)->model->registration_ID );
+    }
+    return hashes;
+}
+
+// Pairs of positions with equal values, in increasing order on both sides,
+// taking the first possible match every time.
+IndexPairs GreedyMatch(const std::vector<quint64>& x, const std::vector<quint64>& y)
+{
+    std::unordered_map<quint64, std::pair<std::vector<int>, size_t>> positions;
+    for(int j = 0; j < int(y.size()); j++)
+    {
+        positions[ y[j] ].first.push_back( j );
+    }
+
+    IndexPairs out;
+    int last = -1;
+    for(int i = 0; i < int(x.size()); i++)
+    {
+        auto it = positions.find( x[i] );
+        if( it == positions.end() )
+        {
+            continue;
+        }
+        const std::vector<int>& candidates = it->second.first;
+        size_t& cursor = it->second.second;
+        while( cursor < candidates.size() && candidates[cursor] <= last )
+        {
+            cursor++;
+        }
+        if( cursor < candidates.size() )
+        {
+            last = candidates[cursor++];
+            out.push_back( { i, last } );
+        }
+    }
+    return out;
+}
+
+// Longest common subsequence: pairs of positions with equal values.
+IndexPairs CommonSubsequence(const std::vector<quint64>& x, const std::vector<quint64>& y)
+{
+    if( x.empty() || y.empty() )
+    {
+        return IndexPairs();
+    }
+    if( x.size() * y.size() > MAX_LCS_CELLS )
+    {
+        return GreedyMatch( x, y );
+    }
+
+    // length of the subsequence of x[i..] and y[j..]
+    const size_t cols = y.size() + 1;
+    std::vector<int> length( (x.size() + 1) * cols, 0 );
+    for(size_t i = x.size(); i-- > 0; )
+    {
+        for(size_t j = y.size(); j-- > 0; )
+        {
+            length[i*cols + j] = ( x[i] == y[j] ) ?
+                        length[(i+1)*cols + j+1] + 1 :
+                        std::max( length[(i+1)*cols + j], length[i*cols + j+1] );
+        }
+    }
+
+    IndexPairs out;
+    size_t i = 0, j = 0;
+    while( i < x.size() && j < y.size() )
+    {
+        if( x[i] == y[j] )
+        {
+            out.push_back( { int(i), int(j) } );
+            i++;
+            j++;
+        }
+        else if( length[(i+1)*cols + j] >= length[i*cols + j+1] )
+        {
+            i++;
+        }
+        else{
+            j++;
+        }
+    }
+    return out;
+}
+
+class TreeDiffer
+{
+public:
+    TreeDiffer(const AbsBehaviorTree& before, const AbsBehaviorTree& after):
+        _before(before),
+        _after(after),
+        _before_models( ModelHashes(before) ),
+        _after_models( ModelHashes(after) )
+    {}
+
+    TreeDiff run()
+    {
+        // whatever is not matched is removed or added
+        _diff.before.assign( _before.nodesCount(), DiffStatus::REMOVED );
+        _diff.after.assign( _after.nodesCount(), DiffStatus::ADDED );
+        _diff.matches.assign( _before.nodesCount(), -1 );
+        _after_matched.assign( _after.nodesCount(), false );
+
+        if( _before.nodesCount() > 0 && _after.nodesCount() > 0 &&
+            _before_models[0] == _after_models[0] )
+        {
+            _pending.push_back( { 0, 0 } );
+        }
+
+        while( !_pending.empty() )
+        {
+            const std::pair<int, int> pair = _pending.back();
+            _pending.pop_back();
+            compare( pair.first, pair.second );
+        }
+        return std::move(_diff);
+    }
+
+private:
+
+    void compare(int b, int a)
+    {
+        // only if the "tree" shares nodes or has cycles
+        if( _diff.matches[b] != -1 || _after_matched[a] )
+        {
+            return;
+        }
+        _after_matched[a] = true;
+
+        const bool same_label = _before.nodeHash(b) == _after.nodeHash(a);
+        _diff.matches[b] = a;
+        _diff.before[b] = same_label ? DiffStatus::SAME : DiffStatus::CHANGED;
+        _diff.after[a]  = same_label ? DiffStatus::SAME : DiffStatus::CHANGED;
+
+        // reused from call to call: alignChildren() does not call compare()
+        ValidChildren( _before, b, _before_children );
+        ValidChildren( _after, a, _after_children );
+
+        // identical subtrees: match the children one by one
+        if( _before.subtreeHash(b) == _after.subtreeHash(a) &&
+            _before_children.size() == _after_children.size() )
+        {
+            for(size_t i = 0; i < _before_children.size(); i++)
+            {
+                _pending.push_back( { _before_children[i], _after_children[i] } );
+            }
+            return;
+        }
+        alignChildren( _before_children, _after_children );
+    }
+
+    void alignChildren(const std::vector<int>& before_children,
+                       const std::vector<int>& after_children)
+    {
+        auto sameSubtree = [this](int b, int a)
+        {
+            return _before.subtreeHash(b) == _after.subtreeHash(a);
+        };
+
+        // common prefix and suffix
+        size_t first = 0;
+        while( first < before_children.size() && first < after_children.size() &&
+               sameSubtree( before_children[first], after_children[first] ) )
+        {
+            _pending.push_back( { before_children[first], after_children[first] } );
+            first++;
+        }
+        size_t before_end = before_children.size();
+        size_t after_end  = after_children.size();
+        while( before_end > first && after_end > first &&
+               sameSubtree( before_children[before_end-1], after_children[after_end-1] ) )
+        {
+            before_end--;
+            after_end--;
+            _pending.push_back( { before_children[before_end], after_children[after_end] } );
+        }
+
+        // identical subtrees in the middle
+        std::vector<quint64> before_hashes, after_hashes;
+        for(size_t i = first; i < before_end; i++)
+        {
+            before_hashes.push_back( _before.subtreeHash( before_children[i] ) );
+        }
+        for(size_t i = first; i < after_end; i++)
+        {
+            after_hashes.push_back( _after.subtreeHash( after_children[i] ) );
+        }
+        IndexPairs anchors = CommonSubsequence( before_hashes, after_hashes );
+        // sentinel, closing the last gap
+        anchors.push_back( { int(before_hashes.size()), int(after_hashes.size()) } );
+
+        int gap_before = 0;
+        int gap_after = 0;
+        for(const auto& anchor: anchors)
+        {
+            // between two anchors: children of the same model are compared
+            std::vector<quint64> before_models, after_models;
+            for(int i = gap_before; i < anchor.first; i++)
+            {
+                before_models.push_back( _before_models[ before_children[first + i] ] );
+            }
+            for(int i = gap_after; i < anchor.second; i++)
+            {
+                after_models.push_back( _after_models[ after_children[first + i] ] );
+            }
+            for(const auto& pair: CommonSubsequence( before_models, after_models ))
+            {
+                _pending.push_back( { before_children[first + gap_before + pair.first],
+                                      after_children[first + gap_after + pair.second] } );
+            }
+
+            if( anchor.first < int(before_hashes.size()) )
+            {
+                _pending.push_back( { before_children[first + anchor.first],
+                                      after_children[first + anchor.second] } );
+            }
+            gap_before = anchor.first + 1;
+            gap_after  = anchor.second + 1;
+        }
+    }
+
+    const AbsBehaviorTree& _before;
+    const AbsBehaviorTree& _after;
+    const std::vector<quint64> _before_models;
+    const std::vector<quint64> _after_models;
+    TreeDiff _diff;
+    std::vector<bool> _after_matched;
+    // matched nodes whose children are still to be compared
+    IndexPairs _pending;
+    std::vector<int> _before_children;
+    std::vector<int> _after_children;
+};
+
+} // end namespace
+
+TreeDiff DiffTrees(const AbsBehaviorTree &before, const AbsBehaviorTree &after)
+{
+    return TreeDiffer( before, after ).run();
+}
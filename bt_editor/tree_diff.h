@@ -0,0 +1,40 @@
+#ifndef TREE_DIFF_H
+#define TREE_DIFF_H
+
+#include <vector>
+
+#include "bt_editor_base.h"
+
+enum class DiffStatus { SAME, CHANGED, ADDED, REMOVED };
+
+// Result of DiffTrees(), by node index of each tree.
+struct TreeDiff
+{
+    // SAME, CHANGED or REMOVED
+    std::vector<DiffStatus> before;
+    // SAME, CHANGED or ADDED
+    std::vector<DiffStatus> after;
+    // node of 'after' matched with each node of 'before', -1 if removed
+    std::vector<int> matches;
+};
+
+// Differences between two versions of a tree.
+//
+// Every subtree has a Merkle hash of its model ID, instance name, ports
+// remapping and of the hashes of its children
+// (AbsBehaviorTree::subtreeHash). Two matched nodes with the same hash have
+// identical subtrees, which are matched node by node without looking any
+// further. Otherwise their children are aligned: first the common prefix
+// and suffix, then identical subtrees in the same order (a longest common
+// subsequence on the hashes), then, between those, the children with the
+// same model ID, which are compared in turn. Everything left is removed or
+// added.
+//
+// Only the regions that changed cost more than O(n). Nothing recurses, so
+// very deep trees are fine.
+//
+// A matched node is CHANGED if its instance name or its ports remapping is
+// different, SAME otherwise (even if something changed below it).
+TreeDiff DiffTrees(const AbsBehaviorTree& before, const AbsBehaviorTree& after);
+
+#endif // TREE_DIFF_H
@@ -0,0 +1,126 @@
+#include "tree_diff_window.h"
+#include "graphic_container.h"
+#include "tree_diff.h"
+#include "utils.h"
+
+#include <QSplitter>
+#include <QVBoxLayout>
+#include <nodes/ConnectionStyle>
+#include <nodes/NodeStyle>
+
+using QtNodes::PortType;
+
+namespace
+{
+
+void PaintDifferences(const AbsBehaviorTree& tree, const std::vector<DiffStatus>& status)
+{
+    for(size_t index = 0; index < tree.nodesCount() && index < status.size(); index++)
+    {
+        QtNodes::Node* gui_node = tree.node(index)->graphic_node;
+        if( !gui_node || status[index] == DiffStatus::SAME )
+        {
+            continue;
+        }
+
+        QColor color;
+        switch( status[index] )
+        {
+        case DiffStatus::CHANGED: color = QColor(255, 165, 0); break;
+        case DiffStatus::ADDED:   color = QColor(77, 255, 50); break;
+        case DiffStatus::REMOVED: color = QColor(255, 50, 50); break;
+        default: break;
+        }
+
+        QtNodes::NodeStyle node_style;
+        node_style.PenWidth *= 3.0;
+        node_style.HoveredPenWidth = node_style.PenWidth;
+        node_style.NormalBoundaryColor = node_style.ShadowColor = color;
+        gui_node->nodeDataModel()->setNodeStyle( node_style );
+        gui_node->nodeGraphicsObject().update();
+
+        // the link to the parent is new (or gone) too
+        if( status[index] != DiffStatus::CHANGED )
+        {
+            QtNodes::ConnectionStyle conn_style;
+            conn_style.NormalColor = color;
+            for(QtNodes::Connection* conn: gui_node->nodeState().connections(PortType::In, 0))
+            {
+                conn->setStyle( conn_style );
+                conn->connectionGraphicsObject().update();
+            }
+        }
+    }
+}
+
+} // end namespace
+
+
+TreeDiffWindow::TreeDiffWindow(const AbsBehaviorTree &before, const QString &before_title,
+                               const AbsBehaviorTree &after, const QString &after_title,
+                               std::shared_ptr<QtNodes::DataModelRegistry> before_registry,
+                               std::shared_ptr<QtNodes::DataModelRegistry> after_registry,
+                               QtNodes::PortLayout layout,
+                               QWidget *parent) :
+    QWidget(parent, Qt::Window)
+{
+    setAttribute( Qt::WA_DeleteOnClose );
+    setWindowTitle( tr("Compare %1 with %2").arg(before_title).arg(after_title) );
+    resize( 1200, 700 );
+
+    auto main_layout = new QVBoxLayout( this );
+    _summary = new QLabel( this );
+    auto splitter = new QSplitter( Qt::Horizontal, this );
+    main_layout->addWidget( _summary );
+    main_layout->addWidget( splitter, 1 );
+
+    GraphicContainer* before_container = addPane( splitter, before_title, before,
+                                                  before_registry, layout );
+    GraphicContainer* after_container  = addPane( splitter, after_title, after,
+                                                  after_registry, layout );
+
+    // the trees of the scenes know their graphic nodes
+    const AbsBehaviorTree before_scene_tree = BuildTreeFromScene( before_container->scene() );
+    const AbsBehaviorTree after_scene_tree  = BuildTreeFromScene( after_container->scene() );
+    const TreeDiff diff = DiffTrees( before_scene_tree, after_scene_tree );
+
+    PaintDifferences( before_scene_tree, diff.before );
+    PaintDifferences( after_scene_tree, diff.after );
+
+    int changed = 0, removed = 0, added = 0;
+    for(DiffStatus status: diff.before)
+    {
+        changed += (status == DiffStatus::CHANGED) ? 1 : 0;
+        removed += (status == DiffStatus::REMOVED) ? 1 : 0;
+    }
+    for(DiffStatus status: diff.after)
+    {
+        added += (status == DiffStatus::ADDED) ? 1 : 0;
+    }
+    _summary->setText( tr("%1 changed, %2 removed, %3 added").arg(changed).arg(removed).arg(added) );
+}
+
+GraphicContainer *TreeDiffWindow::addPane(QWidget *splitter, const QString &title,
+                                          const AbsBehaviorTree &tree,
+                                          std::shared_ptr<QtNodes::DataModelRegistry> registry,
+                                          QtNodes::PortLayout layout)
+{
+    auto pane = new QWidget( splitter );
+    auto pane_layout = new QVBoxLayout( pane );
+    pane_layout->setContentsMargins( 0, 0, 0, 0 );
+    pane_layout->addWidget( new QLabel( title, pane ) );
+
+    auto container = new GraphicContainer( registry, pane );
+    container->scene()->setLayout( layout );
+    if( tree.nodesCount() > 0 )
+    {
+        container->loadSceneFromTree( tree );
+    }
+    container->lockEditing( true );
+    // read-only: no menu to create nodes
+    container->view()->setContextMenuPolicy( Qt::NoContextMenu );
+    container->view()->viewport()->setContextMenuPolicy( Qt::NoContextMenu );
+    pane_layout->addWidget( container->view(), 1 );
+    container->zoomHomeView();
+    return container;
+}
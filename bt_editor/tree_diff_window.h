@@ -0,0 +1,39 @@
+#ifndef TREE_DIFF_WINDOW_H
+#define TREE_DIFF_WINDOW_H
+
+#include <QWidget>
+#include <QLabel>
+#include <memory>
+
+#include <nodes/DataModelRegistry>
+#include <nodes/internal/PortType.hpp>
+
+#include "bt_editor_base.h"
+
+class GraphicContainer;
+
+// Two versions of a tree side by side, read-only, with the differences found
+// by DiffTrees() coloured: changed nodes in orange, removed ones (on the
+// left) in red, added ones (on the right) in green. Each side is drawn with
+// its own models.
+class TreeDiffWindow : public QWidget
+{
+    Q_OBJECT
+public:
+    TreeDiffWindow(const AbsBehaviorTree& before, const QString& before_title,
+                   const AbsBehaviorTree& after, const QString& after_title,
+                   std::shared_ptr<QtNodes::DataModelRegistry> before_registry,
+                   std::shared_ptr<QtNodes::DataModelRegistry> after_registry,
+                   QtNodes::PortLayout layout,
+                   QWidget *parent = nullptr);
+
+private:
+    GraphicContainer* addPane(QWidget* splitter, const QString& title,
+                              const AbsBehaviorTree& tree,
+                              std::shared_ptr<QtNodes::DataModelRegistry> registry,
+                              QtNodes::PortLayout layout);
+
+    QLabel* _summary;
+};
+
+#endif // TREE_DIFF_WINDOW_H
@@ -0,0 +1,524 @@
+#include "tree_layout.h"
+#include "tree_topology.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <vector>
+#include <nodes/FlowScene>
+
+using QtNodes::PortLayout;
+
+namespace
+{
+
+struct ContourSegment;
+
+// Position inside a chain of ContourSegments. The values read through it
+// are moved by 'shift'.
+struct ContourRef
+{
+    std::shared_ptr<const ContourSegment> segment;
+    size_t index = 0;
+    qreal shift = 0;
+};
+
+// A piece of an outline, one value per level. The following levels are
+// those of 'next', usually the outline of a child, which is shared instead
+// of being copied.
+struct ContourSegment
+{
+    std::vector<qreal> values;
+    ContourRef next;
+};
+
+class ContourReader
+{
+public:
+    ContourReader() {}
+
+    ContourReader(const ContourRef& ref, qreal shift): _ref(ref)
+    {
+        _ref.shift += shift;
+    }
+
+    qreal next()
+    {
+        while( _ref.index >= _ref.segment->values.size() )
+        {
+            ContourRef following = _ref.segment->next;
+            following.shift += _ref.shift;
+            _ref = std::move(following);
+        }
+        return _ref.segment->values[ _ref.index++ ] + _ref.shift;
+    }
+
+    void skip(size_t count)
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            next();
+        }
+    }
+
+    const ContourRef& ref() const { return _ref; }
+
+private:
+    ContourRef _ref;
+};
+
+// Outline of the children placed so far. The first levels are stored in
+// 'values', the remaining ones are read lazily from the outline of a single
+// child ('tail'), so that a tall child is never copied.
+struct ForestContour
+{
+    std::vector<qreal> values;
+    std::vector<int> owners;   // index of the child each level comes from
+    ContourReader tail;
+    int tail_owner = -1;
+    size_t height = 0;
+
+    void materialize(size_t levels)
+    {
+        while( values.size() < levels )
+        {
+            values.push_back( tail.next() );
+            owners.push_back( tail_owner );
+        }
+    }
+
+    void setTail(const ContourReader& reader, int owner, size_t new_height)
+    {
+        tail = reader;
+        tail_owner = owner;
+        height = new_height;
+    }
+
+    ContourRef toContour(qreal first_value, qreal shift) const
+    {
+        auto segment = std::make_shared<ContourSegment>();
+        segment->values.reserve( values.size() + 1 );
+        segment->values.push_back( first_value );
+        for(qreal value: values)
+        {
+            segment->values.push_back( value + shift );
+        }
+        if( values.size() < height )
+        {
+            segment->next = tail.ref();
+            segment->next.shift += shift;
+        }
+        ContourRef ref;
+        ref.segment = std::move(segment);
+        return ref;
+    }
+};
+
+} // end namespace
+
+// Layout of a subtree, relative to the center of its root along the breadth
+// axis (X for a vertical layout, Y for a horizontal one).
+struct SubtreeLayout
+{
+    size_t height;                    // number of levels
+    std::vector<qreal> child_offsets; // centers of the children
+    ContourRef left;                  // leftmost edge of every level
+    ContourRef right;                 // rightmost edge of every level
+    ContourRef depth;                 // biggest node size along the depth axis
+};
+
+namespace
+{
+
+std::shared_ptr<const SubtreeLayout> layoutLeaf(qreal breadth, qreal depth)
+{
+    auto layout = std::make_shared<SubtreeLayout>();
+    ForestContour empty;
+    layout->height = 1;
+    layout->left  = empty.toContour( -breadth * 0.5, 0 );
+    layout->right = empty.toContour(  breadth * 0.5, 0 );
+    layout->depth = empty.toContour(  depth, 0 );
+    return layout;
+}
+
+// Places the children left to right, each one as close as possible to the
+// outline of the ones before it. When a child is pushed away by a subtree
+// that isn't its direct neighbour, the subtrees in between are spread evenly
+// in the gap (Walker's "shift" and "change").
+std::shared_ptr<const SubtreeLayout>
+layoutParent(qreal breadth, qreal depth,
+             const std::vector<std::shared_ptr<const SubtreeLayout>>& children)
+{
+    const size_t count = children.size();
+
+    std::vector<qreal> offset(count, 0);
+    std::vector<qreal> shift(count, 0);
+    std::vector<qreal> change(count, 0);
+
+    ForestContour left, right, depths;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        const SubtreeLayout& child = *children[i];
+        qreal child_offset = 0;
+
+        if( i > 0 )
+        {
+            ContourReader child_left(child.left, 0);
+            const size_t common = std::min(right.height, child.height);
+            right.materialize(common);
+
+            for(size_t level = 0; level < common; level++)
+            {
+                const qreal needed = right.values[level] + LAYOUT_NODE_SPACING - child_left.next();
+                if( level == 0 )
+                {
+                    child_offset = needed;
+                }
+                else if( needed > child_offset )
+                {
+                    const int pushed_by = right.owners[level];
+                    const qreal amount = needed - child_offset;
+                    const qreal subtrees = static_cast<qreal>(i) - pushed_by;
+                    change[i] -= amount / subtrees;
+                    shift[i]  += amount;
+                    change[pushed_by] += amount / subtrees;
+                    child_offset = needed;
+                }
+            }
+        }
+        offset[i] = child_offset;
+
+        // right outline: this child hides the ones before it
+        ContourReader child_right(child.right, child_offset);
+        if( child.height >= right.height )
+        {
+            right.values.clear();
+            right.owners.clear();
+            right.setTail(child_right, static_cast<int>(i), child.height);
+        }
+        else{
+            for(size_t level = 0; level < child.height; level++)
+            {
+                right.values[level] = child_right.next();
+                right.owners[level] = static_cast<int>(i);
+            }
+        }
+
+        // left outline: only the levels deeper than the ones before it
+        if( child.height > left.height )
+        {
+            left.materialize(left.height);
+            ContourReader child_left(child.left, child_offset);
+            child_left.skip(left.height);
+            left.setTail(child_left, static_cast<int>(i), child.height);
+        }
+
+        // biggest size of every level
+        ContourReader child_depth(child.depth, 0);
+        const size_t common = std::min(depths.height, child.height);
+        depths.materialize(common);
+        for(size_t level = 0; level < common; level++)
+        {
+            depths.values[level] = std::max( depths.values[level], child_depth.next() );
+        }
+        if( child.height > depths.height )
+        {
+            depths.setTail(child_depth, static_cast<int>(i), child.height);
+        }
+    }
+
+    // spread the subtrees that were skipped over
+    qreal total_shift = 0;
+    qreal total_change = 0;
+    for(size_t i = count; i-- > 0; )
+    {
+        offset[i] += total_shift;
+        total_change += change[i];
+        total_shift += shift[i] + total_change;
+    }
+
+    const qreal middle = (offset.front() + offset.back()) * 0.5;
+
+    auto layout = std::make_shared<SubtreeLayout>();
+    layout->height = left.height + 1;
+    layout->child_offsets.resize(count);
+    for(size_t i = 0; i < count; i++)
+    {
+        layout->child_offsets[i] = offset[i] - middle;
+    }
+    layout->left  = left.toContour( -breadth * 0.5, -middle );
+    layout->right = right.toContour( breadth * 0.5, -middle );
+    layout->depth = depths.toContour( depth, 0 );
+    return layout;
+}
+
+qreal breadthOf(const QSizeF& size, bool vertical)
+{
+    return vertical ? size.width() : size.height();
+}
+
+qreal depthOf(const QSizeF& size, bool vertical)
+{
+    return vertical ? size.height() : size.width();
+}
+
+std::shared_ptr<const SubtreeLayout>
+layoutNode(const QSizeF& size, bool vertical,
+           const std::vector<std::shared_ptr<const SubtreeLayout>>& children)
+{
+    const qreal breadth = breadthOf(size, vertical);
+    const qreal depth = depthOf(size, vertical);
+    if( children.empty() )
+    {
+        return layoutLeaf(breadth, depth);
+    }
+    return layoutParent(breadth, depth, children);
+}
+
+// Position of every level along the depth axis: the root is centered in 0,
+// the other levels follow it.
+std::vector<qreal> levelOffsets(const SubtreeLayout& root_layout)
+{
+    std::vector<qreal> level_offset( root_layout.height );
+    ContourReader level_depth(root_layout.depth, 0);
+    qreal offset = 0;
+
+    for(size_t level = 0; level < root_layout.height; level++)
+    {
+        const qreal level_size = level_depth.next();
+        level_offset[level] = (level == 0) ? -level_size * 0.5 : offset;
+        offset += level_size + LAYOUT_LEVEL_SPACING;
+    }
+    return level_offset;
+}
+
+// Top left corner of a node centered in 'center' along the breadth axis.
+QPointF nodePosition(qreal center, qreal level_offset, const QSizeF& size, bool vertical)
+{
+    if( vertical )
+    {
+        return QPointF( center - size.width() * 0.5, level_offset );
+    }
+    return QPointF( level_offset, center - size.height() * 0.5 );
+}
+
+} // end namespace
+
+
+void ComputeTreeLayout(AbsBehaviorTree& tree, PortLayout layout)
+{
+    if( tree.nodesCount() == 0 )
+    {
+        return;
+    }
+    const bool vertical = (layout == PortLayout::Vertical);
+
+    // pre-order visit, the root is always the first node
+    std::vector<int> order;
+    std::vector<int> stack(1, 0);
+    order.reserve( tree.nodesCount() );
+
+    while( !stack.empty() )
+    {
+        const int index = stack.back();
+        stack.pop_back();
+        order.push_back(index);
+
+        const auto& children = tree.node(index)->children_index;
+        stack.insert( stack.end(), children.rbegin(), children.rend() );
+    }
+
+    // children before parents
+    std::vector<std::shared_ptr<const SubtreeLayout>> layouts( tree.nodesCount() );
+    std::vector<std::shared_ptr<const SubtreeLayout>> children_layouts;
+
+    for(auto it = order.rbegin(); it != order.rend(); ++it)
+    {
+        const AbstractTreeNode& node = *tree.node(*it);
+        children_layouts.clear();
+        for(int child: node.children_index)
+        {
+            children_layouts.push_back( layouts[child] );
+        }
+        layouts[*it] = layoutNode(node.size, vertical, children_layouts);
+    }
+
+    const std::vector<qreal> level_offset = levelOffsets( *layouts[0] );
+
+    // parents before children: absolute positions
+    std::vector<qreal> center( tree.nodesCount(), 0 );
+    std::vector<size_t> level( tree.nodesCount(), 0 );
+
+    for(int index: order)
+    {
+        AbstractTreeNode* node = tree.node(index);
+        const SubtreeLayout& subtree = *layouts[index];
+
+        node->pos = nodePosition( center[index], level_offset[ level[index] ],
+                                  node->size, vertical );
+
+        for(size_t i = 0; i < node->children_index.size(); i++)
+        {
+            const int child = node->children_index[i];
+            center[child] = center[index] + subtree.child_offsets[i];
+            level[child] = level[index] + 1;
+        }
+    }
+}
+
+
+TreeLayoutCache::TreeLayoutCache():
+    _layout(PortLayout::Vertical),
+    _arranging(false),
+    _last_computed(0)
+{}
+
+TreeLayoutCache::~TreeLayoutCache()
+{}
+
+void TreeLayoutCache::clear()
+{
+    _entries.clear();
+    _dirty.clear();
+    _level_offsets.clear();
+}
+
+void TreeLayoutCache::markDirty(QtNodes::Node *node, const TreeTopology &topology)
+{
+    // the ancestors of a dirty node are dirty already
+    while( node && _dirty.insert( node ).second )
+    {
+        node = topology.parent( *node );
+    }
+}
+
+void TreeLayoutCache::invalidate(QtNodes::Node &node, const TreeTopology &topology)
+{
+    if( !_arranging )
+    {
+        markDirty( &node, topology );
+    }
+}
+
+void TreeLayoutCache::forget(QtNodes::Node &node, const TreeTopology &topology)
+{
+    markDirty( topology.parent( node ), topology );
+    _entries.erase( &node );
+    _dirty.erase( &node );
+}
+
+void TreeLayoutCache::arrange(QtNodes::FlowScene &scene, const TreeTopology &topology,
+                              QtNodes::Node &root)
+{
+    _last_computed = 0;
+
+    if( scene.layout() != _layout )
+    {
+        clear();
+        _layout = scene.layout();
+    }
+    const bool vertical = (_layout == PortLayout::Vertical);
+
+    // nothing tells when a node is resized
+    for(const auto& it: _entries)
+    {
+        QtNodes::Node* node = const_cast<QtNodes::Node*>( it.first );
+        if( scene.getNodeSize( *node ) != it.second.size )
+        {
+            markDirty( node, topology );
+        }
+    }
+
+    auto needsLayout = [this](const QtNodes::Node* node)
+    {
+        return _dirty.count( node ) || !_entries.count( node );
+    };
+
+    // children before parents, only below the dirty nodes
+    std::vector<std::pair<QtNodes::Node*, bool>> stack( 1, { &root, false } );
+    std::unordered_set<const QtNodes::Node*> visited;
+    std::vector<std::shared_ptr<const SubtreeLayout>> children_layouts;
+
+    while( !stack.empty() )
+    {
+        QtNodes::Node* node = stack.back().first;
+        if( !stack.back().second )
+        {
+            // a careless edit can make a loop
+            if( !needsLayout( node ) || !visited.insert( node ).second )
+            {
+                stack.pop_back();
+                continue;
+            }
+            stack.back().second = true;
+            Entry& entry = _entries[node];
+            entry.children.clear();
+            for(QtNodes::Node* child: getChildren( scene, *node, true ))
+            {
+                if( !visited.count( child ) )
+                {
+                    entry.children.push_back( child );
+                    stack.push_back( { child, false } );
+                }
+            }
+            continue;
+        }
+        stack.pop_back();
+
+        Entry& entry = _entries[node];
+        children_layouts.clear();
+        for(QtNodes::Node* child: entry.children)
+        {
+            children_layouts.push_back( _entries.at( child ).layout );
+        }
+        entry.size = scene.getNodeSize( *node );
+        entry.layout = layoutNode( entry.size, vertical, children_layouts );
+        _last_computed++;
+    }
+
+    // a level that changed size moves all the deeper ones
+    std::vector<qreal> level_offsets = levelOffsets( *_entries.at( &root ).layout );
+    const bool move_all = ( level_offsets != _level_offsets );
+    _level_offsets = std::move(level_offsets);
+
+    // parents before children; a clean subtree whose root keeps its place
+    // keeps the place of all its nodes
+    _arranging = true;
+    {
+        QtNodes::ConnectionBatchGuard connection_batch( scene );
+
+        std::vector<std::pair<QtNodes::Node*, std::pair<qreal, size_t>>> placing;
+        placing.push_back( { &root, { 0.0, size_t(0) } } );
+
+        while( !placing.empty() )
+        {
+            QtNodes::Node* node = placing.back().first;
+            const qreal center = placing.back().second.first;
+            const size_t level = placing.back().second.second;
+            placing.pop_back();
+
+            Entry& entry = _entries.at( node );
+            if( !move_all && entry.placed && !_dirty.count( node ) &&
+                entry.center == center && entry.level == level )
+            {
+                continue;
+            }
+            entry.center = center;
+            entry.level = level;
+            entry.placed = true;
+
+            const QPointF pos = nodePosition( center, _level_offsets[level], entry.size, vertical );
+            if( scene.getNodePosition( *node ) != pos )
+            {
+                scene.setNodePosition( *node, pos );
+            }
+            for(size_t i = 0; i < entry.children.size(); i++)
+            {
+                placing.push_back( { entry.children[i],
+                                     { center + entry.layout->child_offsets[i], level + 1 } } );
+            }
+        }
+    }
+    _arranging = false;
+    _dirty.clear();
+}
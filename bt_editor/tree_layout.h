@@ -0,0 +1,99 @@
+#ifndef TREE_LAYOUT_H
+#define TREE_LAYOUT_H
+
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <nodes/internal/PortType.hpp>
+
+#include "bt_editor_base.h"
+
+// Distance between siblings (and between neighbouring subtrees).
+const qreal LAYOUT_NODE_SPACING  = 40;
+// Distance between two consecutive levels of the tree.
+const qreal LAYOUT_LEVEL_SPACING = 80;
+
+struct SubtreeLayout;
+
+class TreeTopology;
+
+namespace QtNodes
+{
+class FlowScene;
+}
+
+// Compact tidy-tree layout (Reingold-Tilford, with the even spreading of
+// smaller subtrees introduced by Walker).
+//
+// Subtrees are packed as close as the node sizes allow, a parent is centered
+// above its children and smaller subtrees are spread evenly between bigger
+// ones. Every node of a level shares the same position on the depth axis.
+//
+// Writes AbstractTreeNode::pos of every node reachable from the root. The
+// outlines of the subtrees share their deepest part with the tallest child,
+// so a whole tree is O(n), and nothing recurses, so very deep trees are fine.
+void ComputeTreeLayout(AbsBehaviorTree& tree, QtNodes::PortLayout layout);
+
+// The same layout, arranged in place in the nodes of a scene and kept from
+// one call to the next. The scene tells it which nodes changed (see
+// invalidate()); only those and their ancestors are computed again, the
+// other subtrees keep their cached layout, and only the nodes whose place
+// changed are moved.
+class TreeLayoutCache
+{
+public:
+    TreeLayoutCache();
+
+    ~TreeLayoutCache();
+
+    // The node was created, moved by the user or resized, or its children
+    // changed: its subtree and the ones containing it must be computed
+    // again. Ignored for the moves made by arrange() itself.
+    void invalidate(QtNodes::Node& node, const TreeTopology& topology);
+
+    // Call it before the node is removed from the topology.
+    void forget(QtNodes::Node& node, const TreeTopology& topology);
+
+    // Lays out the tree below the root and moves the nodes whose position
+    // changed. The sizes of the nodes are compared with the ones of the last
+    // call, the rest of the scene is only visited where it changed.
+    void arrange(QtNodes::FlowScene& scene, const TreeTopology& topology,
+                 QtNodes::Node& root);
+
+    void clear();
+
+    // Number of subtrees kept in the cache.
+    size_t size() const { return _entries.size(); }
+
+    // Number of subtrees that the last arrange() computed again.
+    size_t lastComputedCount() const { return _last_computed; }
+
+private:
+    struct Entry
+    {
+        Entry(): center(0), level(0), placed(false) {}
+
+        std::shared_ptr<const SubtreeLayout> layout;
+        // ordered as in the layout
+        std::vector<QtNodes::Node*> children;
+        QSizeF size;
+        // where the node was placed, see arrange()
+        qreal center;
+        size_t level;
+        bool placed;
+    };
+
+    void markDirty(QtNodes::Node* node, const TreeTopology& topology);
+
+    QtNodes::PortLayout _layout;
+    std::unordered_map<const QtNodes::Node*, Entry> _entries;
+    // nodes whose subtree must be computed again, their ancestors included
+    std::unordered_set<const QtNodes::Node*> _dirty;
+    std::vector<qreal> _level_offsets;
+    bool _arranging;
+    size_t _last_computed;
+};
+
+#endif // TREE_LAYOUT_H
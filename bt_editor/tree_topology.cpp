@@ -0,0 +1,211 @@
+#include "tree_topology.h"
+
+#include <algorithm>
+
+using QtNodes::PortType;
+
+TreeTopology::TreeTopology():
+    _missing_parent(0),
+    _missing_children(0)
+{}
+
+void TreeTopology::clear()
+{
+    _nodes.clear();
+    _links.clear();
+    _parentless.clear();
+    _missing_parent = 0;
+    _missing_children = 0;
+}
+
+TreeTopology::NodeLinks &TreeTopology::linksOf(QtNodes::Node &node)
+{
+    auto it = _nodes.find( &node );
+    if( it == _nodes.end() )
+    {
+        NodeLinks links;
+        links.parent = nullptr;
+        links.inputs = 0;
+        links.has_input_port  = node.nodeDataModel()->nPorts( PortType::In ) > 0;
+        links.has_output_port = node.nodeDataModel()->nPorts( PortType::Out ) > 0;
+        it = _nodes.insert( { &node, std::move(links) } ).first;
+        count( &node, it->second, +1 );
+    }
+    return it->second;
+}
+
+void TreeTopology::count(QtNodes::Node* node, const NodeLinks &links, int sign)
+{
+    if( links.has_input_port && links.inputs == 0 )
+    {
+        _missing_parent += sign;
+    }
+    if( links.has_output_port && links.children.empty() )
+    {
+        _missing_children += sign;
+    }
+    if( links.inputs == 0 )
+    {
+        if( sign > 0 )
+        {
+            _parentless.insert( node );
+        }
+        else{
+            _parentless.erase( node );
+        }
+    }
+}
+
+void TreeTopology::addNode(QtNodes::Node &node)
+{
+    if( _nodes.count( &node ) )
+    {
+        updatePorts( node );
+    }
+    else{
+        linksOf( node );
+    }
+}
+
+void TreeTopology::removeNode(QtNodes::Node &node)
+{
+    auto it = _nodes.find( &node );
+    if( it == _nodes.end() )
+    {
+        return;
+    }
+    for(auto port_type: {PortType::In, PortType::Out})
+    {
+        for(const auto& connections: node.nodeState().getEntries(port_type))
+        {
+            for(const QtNodes::Connection* connection: connections)
+            {
+                removeConnection( *connection );
+            }
+        }
+    }
+    count( &node, it->second, -1 );
+    _nodes.erase( it );
+}
+
+void TreeTopology::addConnection(QtNodes::Connection &connection)
+{
+    QtNodes::Node* parent = connection.getNode( PortType::Out );
+    QtNodes::Node* child  = connection.getNode( PortType::In );
+
+    removeConnection( connection );
+    if( !parent || !child )
+    {
+        return;
+    }
+
+    NodeLinks& parent_links = linksOf( *parent );
+    count( parent, parent_links, -1 );
+    parent_links.children.push_back( child );
+    count( parent, parent_links, +1 );
+
+    NodeLinks& child_links = linksOf( *child );
+    count( child, child_links, -1 );
+    child_links.parent = parent;
+    child_links.inputs++;
+    count( child, child_links, +1 );
+
+    _links[ &connection ] = { parent, child };
+}
+
+void TreeTopology::removeConnection(const QtNodes::Connection &connection)
+{
+    auto link = _links.find( &connection );
+    if( link == _links.end() )
+    {
+        return;
+    }
+    QtNodes::Node* parent = link->second.first;
+    QtNodes::Node* child  = link->second.second;
+    _links.erase( link );
+
+    auto parent_it = _nodes.find( parent );
+    if( parent_it != _nodes.end() )
+    {
+        NodeLinks& parent_links = parent_it->second;
+        count( parent, parent_links, -1 );
+        auto& children = parent_links.children;
+        auto child_it = std::find( children.begin(), children.end(), child );
+        if( child_it != children.end() )
+        {
+            children.erase( child_it );
+        }
+        count( parent, parent_links, +1 );
+    }
+
+    auto child_it = _nodes.find( child );
+    if( child_it != _nodes.end() )
+    {
+        NodeLinks& child_links = child_it->second;
+        count( child, child_links, -1 );
+        child_links.inputs--;
+        if( child_links.inputs == 0 )
+        {
+            child_links.parent = nullptr;
+        }
+        count( child, child_links, +1 );
+    }
+}
+
+void TreeTopology::updatePorts(QtNodes::Node &node)
+{
+    auto it = _nodes.find( &node );
+    if( it == _nodes.end() )
+    {
+        return;
+    }
+    NodeLinks& links = it->second;
+    count( &node, links, -1 );
+    links.has_input_port  = node.nodeDataModel()->nPorts( PortType::In ) > 0;
+    links.has_output_port = node.nodeDataModel()->nPorts( PortType::Out ) > 0;
+    count( &node, links, +1 );
+}
+
+QtNodes::Node *TreeTopology::parent(const QtNodes::Node &node) const
+{
+    auto it = _nodes.find( &node );
+    return ( it != _nodes.end() ) ? it->second.parent : nullptr;
+}
+
+const std::vector<QtNodes::Node *> &TreeTopology::children(const QtNodes::Node &node) const
+{
+    static const std::vector<QtNodes::Node*> no_children;
+    auto it = _nodes.find( &node );
+    return ( it != _nodes.end() ) ? it->second.children : no_children;
+}
+
+QtNodes::Node *TreeTopology::root() const
+{
+    return ( _parentless.size() == 1 ) ? *_parentless.begin() : nullptr;
+}
+
+bool TreeTopology::isValid() const
+{
+    return !_nodes.empty() && _missing_parent == 0 && _missing_children == 0;
+}
+
+std::vector<QtNodes::Node *> TreeTopology::subtreeNodes(QtNodes::Node &root_node) const
+{
+    std::vector<QtNodes::Node*> nodes;
+    // a careless edit can make a loop
+    std::unordered_set<const QtNodes::Node*> visited;
+    std::vector<QtNodes::Node*> pending = { &root_node };
+    while( !pending.empty() )
+    {
+        QtNodes::Node* node = pending.back();
+        pending.pop_back();
+        if( !visited.insert( node ).second )
+        {
+            continue;
+        }
+        nodes.push_back( node );
+        const auto& node_children = children( *node );
+        pending.insert( pending.end(), node_children.rbegin(), node_children.rend() );
+    }
+    return nodes;
+}
@@ -0,0 +1,87 @@
+#ifndef TREE_TOPOLOGY_H
+#define TREE_TOPOLOGY_H
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <nodes/Node>
+#include <nodes/Connection>
+
+// Parent and children of the nodes of a scene, kept up to date one node or
+// connection at a time (by GraphicContainer, from the signals of the scene)
+// instead of being computed again from all the connections.
+//
+// Besides the links, it counts the nodes with an input port but no parent
+// and the ones with an output port but no children, so that the validity of
+// the tree and its root are known in O(1), and a subtree is listed in
+// O(size of the subtree).
+//
+// The nodes created during a bulk build of the scene are only known at its
+// end, when the scene publishes them (see QtNodes::BulkBuildGuard).
+class TreeTopology
+{
+public:
+    TreeTopology();
+
+    void clear();
+
+    // Adding a node twice only updates its ports.
+    void addNode(QtNodes::Node& node);
+
+    // Call it while the connections of the node still exist: they are
+    // removed too.
+    void removeNode(QtNodes::Node& node);
+
+    // A connection that was known already is moved to its current ends.
+    // Connections without both ends are ignored.
+    void addConnection(QtNodes::Connection& connection);
+
+    void removeConnection(const QtNodes::Connection& connection);
+
+    // The number of ports of the node changed, e.g. an expanded SubTree.
+    void updatePorts(QtNodes::Node& node);
+
+    size_t size() const { return _nodes.size(); }
+
+    // Null for the root (or any node without parent).
+    QtNodes::Node* parent(const QtNodes::Node& node) const;
+
+    // In the order the connections were made, not by position.
+    const std::vector<QtNodes::Node*>& children(const QtNodes::Node& node) const;
+
+    // The only node without parent, null if there are none or many.
+    QtNodes::Node* root() const;
+
+    // Not empty, every input port and every output port connected.
+    bool isValid() const;
+
+    // The node and all its descendants, parents first.
+    std::vector<QtNodes::Node*> subtreeNodes(QtNodes::Node& root_node) const;
+
+private:
+    struct NodeLinks
+    {
+        QtNodes::Node* parent;
+        // number of connections to the input ports
+        int inputs;
+        std::vector<QtNodes::Node*> children;
+        bool has_input_port;
+        bool has_output_port;
+    };
+
+    NodeLinks& linksOf(QtNodes::Node& node);
+
+    // Adds (+1) or removes (-1) the node from the counters.
+    void count(QtNodes::Node* node, const NodeLinks& links, int sign);
+
+    std::unordered_map<const QtNodes::Node*, NodeLinks> _nodes;
+    // parent and child of each connection, as they were when it was added
+    std::unordered_map<const QtNodes::Connection*,
+                       std::pair<QtNodes::Node*, QtNodes::Node*>> _links;
+    std::unordered_set<QtNodes::Node*> _parentless;
+    int _missing_parent;
+    int _missing_children;
+};
+
+#endif // TREE_TOPOLOGY_H
@@ -0,0 +1,458 @@
+#include "undo_history.h"
+#include "graphic_container.h"
+
+#include "snapshot_codec.h"
+
+#include <algorithm>
+#include <QDebug>
+
+std::vector<TabChange> UndoRecorder::commit(const Tabs &tabs)
+{
+    std::vector<TabChange> changes;
+
+    for(auto it = _tabs.begin(); it != _tabs.end(); )
+    {
+        if( tabs.count(it->first) == 0 )
+        {
+            addRemovedTab( it->first, it->second, changes );
+            it = _tabs.erase(it);
+        }
+        else{
+            ++it;
+        }
+    }
+
+    for(const auto& it: tabs)
+    {
+        GraphicContainer* container = it.second;
+        TabRecord& record = _tabs[it.first];
+        const PendingTreePtr& pending = container->pendingTree();
+
+        std::vector<QUuid> uuids = container->takeChangedNodes();
+        // a pending tab built since the last commit, if rebase() wasn't called
+        const bool built = ( record.container == container && record.pending && !pending );
+
+        if( record.container != container || record.pending != pending )
+        {
+            // everything the old content had and the new one has
+            uuids = container->nodeUuids();
+            for(const auto& node: record.nodes)
+            {
+                uuids.push_back( node.first );
+            }
+        }
+
+        TabChange change;
+        change.name = it.first;
+        change.existed_before = record.exists;
+        change.exists_after = true;
+        if( record.pending != pending && !built )
+        {
+            change.pending_before = record.pending;
+            change.pending_after = pending;
+        }
+        diffNodes( record, *container, uuids, change );
+        applyNodes( change, record );
+
+        record.container = container;
+        record.pending = pending;
+
+        if( built )
+        {
+            continue;
+        }
+        if( !record.exists || !change.nodes.empty() ||
+            change.pending_before != change.pending_after )
+        {
+            record.exists = true;
+            changes.push_back( std::move(change) );
+        }
+    }
+    return changes;
+}
+
+std::vector<TabChange> UndoRecorder::compare(const Tabs &tabs) const
+{
+    std::vector<TabChange> changes;
+
+    for(const auto& it: _tabs)
+    {
+        if( tabs.count(it.first) == 0 )
+        {
+            addRemovedTab( it.first, it.second, changes );
+        }
+    }
+
+    const TabRecord new_tab;
+
+    for(const auto& it: tabs)
+    {
+        const GraphicContainer* container = it.second;
+        auto found = _tabs.find(it.first);
+        const TabRecord& record = (found != _tabs.end()) ? found->second : new_tab;
+
+        std::vector<QUuid> uuids = container->nodeUuids();
+        for(const auto& node: record.nodes)
+        {
+            uuids.push_back( node.first );
+        }
+
+        TabChange change;
+        change.name = it.first;
+        change.existed_before = record.exists;
+        change.exists_after = true;
+        if( record.pending != container->pendingTree() )
+        {
+            change.pending_before = record.pending;
+            change.pending_after = container->pendingTree();
+        }
+        diffNodes( record, *container, uuids, change );
+
+        if( !record.exists || !change.nodes.empty() ||
+            change.pending_before != change.pending_after )
+        {
+            changes.push_back( std::move(change) );
+        }
+    }
+    return changes;
+}
+
+void UndoRecorder::rebase(const GraphicContainer &container)
+{
+    for(auto& it: _tabs)
+    {
+        TabRecord& record = it.second;
+        if( record.container == &container && record.pending && !container.pendingTree() )
+        {
+            TabChange change;
+            diffNodes( record, container, container.nodeUuids(), change );
+            applyNodes( change, record );
+            record.pending.reset();
+        }
+    }
+}
+
+void UndoRecorder::applyNodes(const TabChange &change, TabRecord &record)
+{
+    for(const auto& node_change: change.nodes)
+    {
+        if( node_change.after )
+        {
+            record.nodes[ node_change.uuid ] = node_change.after;
+        }
+        else{
+            record.nodes.erase( node_change.uuid );
+        }
+    }
+}
+
+void UndoRecorder::diffNodes(const TabRecord &record,
+                             const GraphicContainer &container,
+                             const std::vector<QUuid> &uuids,
+                             TabChange &change)
+{
+    std::vector<QUuid> sorted_uuids = uuids;
+    std::sort( sorted_uuids.begin(), sorted_uuids.end() );
+    sorted_uuids.erase( std::unique( sorted_uuids.begin(), sorted_uuids.end() ),
+                        sorted_uuids.end() );
+
+    for(const QUuid& uuid: sorted_uuids)
+    {
+        auto found = record.nodes.find(uuid);
+        NodeRecordPtr before = (found != record.nodes.end()) ? found->second : NodeRecordPtr();
+        NodeRecordPtr after = container.nodeRecord(uuid);
+
+        if( before == after || (before && after && *before == *after) )
+        {
+            continue;
+        }
+        change.nodes.push_back( { uuid, before, after } );
+    }
+}
+
+void UndoRecorder::addRemovedTab(const QString &name, const TabRecord &record,
+                                 std::vector<TabChange> &changes)
+{
+    TabChange change;
+    change.name = name;
+    change.existed_before = true;
+    change.exists_after = false;
+    change.pending_before = record.pending;
+
+    change.nodes.reserve( record.nodes.size() );
+    for(const auto& node: record.nodes)
+    {
+        change.nodes.push_back( { node.first, node.second, NodeRecordPtr() } );
+    }
+    changes.push_back( std::move(change) );
+}
+
+namespace
+{
+
+void WriteRecord(SnapshotWriter& writer, const NodeRecordPtr& record)
+{
+    writer.writeBool( bool(record) );
+    if( !record )
+    {
+        return;
+    }
+    writer.writeJson( record->json );
+    writer.writeUInt( record->inputs.size() );
+    for(const auto& link: record->inputs)
+    {
+        writer.writeInt( link.in_port );
+        writer.writeUuid( link.out_node );
+        writer.writeInt( link.out_port );
+    }
+}
+
+NodeRecordPtr ReadRecord(SnapshotReader& reader)
+{
+    if( !reader.readBool() )
+    {
+        return NodeRecordPtr();
+    }
+    auto record = std::make_shared<NodeRecord>();
+    record->json = reader.readJson().toObject();
+
+    const quint64 inputs = reader.readUInt();
+    for(quint64 i = 0; i < inputs && reader.isValid(); i++)
+    {
+        NodeLink link;
+        link.in_port  = int( reader.readInt() );
+        link.out_node = reader.readUuid();
+        link.out_port = int( reader.readInt() );
+        record->inputs.push_back( link );
+    }
+    return record;
+}
+
+void WritePendingTree(SnapshotWriter& writer, const PendingTreePtr& pending)
+{
+    writer.writeBool( bool(pending) );
+    if( !pending )
+    {
+        return;
+    }
+    writer.writeUuid( pending->uuid_seed );
+    writer.writeUInt( pending->tree.nodesCount() );
+    for(const auto& node: pending->tree.nodes())
+    {
+        writer.writeInt( static_cast<int>(node.model->type) );
+        writer.writeString( node.model->registration_ID );
+        writer.writeUInt( node.model->ports.size() );
+        for(const auto& port_it: node.model->ports)
+        {
+            const PortModel& port = port_it.second;
+            writer.writeString( port_it.first );
+            writer.writeInt( static_cast<int>(port.direction) );
+            writer.writeString( port.type_name );
+            writer.writeString( port.description );
+            writer.writeString( port.default_value );
+        }
+        writer.writeString( node.instance_name );
+        writer.writeUInt( node.ports_mapping.size() );
+        for(const auto& mapping_it: node.ports_mapping)
+        {
+            writer.writeString( mapping_it.first );
+            writer.writeString( mapping_it.second );
+        }
+        writer.writeUInt( node.children_index.size() );
+        for(int child: node.children_index)
+        {
+            writer.writeUInt( child );
+        }
+    }
+}
+
+PendingTreePtr ReadPendingTree(SnapshotReader& reader)
+{
+    if( !reader.readBool() )
+    {
+        return PendingTreePtr();
+    }
+    auto pending = std::make_shared<PendingTree>();
+    pending->uuid_seed = reader.readUuid();
+
+    auto& nodes = pending->tree.nodes();
+    const quint64 count = reader.readUInt();
+    for(quint64 i = 0; i < count && reader.isValid(); i++)
+    {
+        AbstractTreeNode node;
+        node.index = int(i);
+        NodeModel model;
+        model.type = static_cast<NodeType>( reader.readInt() );
+        model.registration_ID = reader.readString();
+
+        const quint64 ports = reader.readUInt();
+        for(quint64 p = 0; p < ports && reader.isValid(); p++)
+        {
+            const QString name = reader.readString();
+            PortModel port;
+            port.direction     = static_cast<PortDirection>( reader.readInt() );
+            port.type_name     = reader.readString();
+            port.description   = reader.readString();
+            port.default_value = reader.readString();
+            model.ports.insert( { name, port } );
+        }
+        node.model = InternNodeModel( model );
+        node.instance_name = reader.readString();
+
+        const quint64 mappings = reader.readUInt();
+        for(quint64 m = 0; m < mappings && reader.isValid(); m++)
+        {
+            const QString port_name = reader.readString();
+            node.ports_mapping.insert( { port_name, reader.readString() } );
+        }
+
+        const quint64 children = reader.readUInt();
+        for(quint64 c = 0; c < children && reader.isValid(); c++)
+        {
+            const quint64 child = reader.readUInt();
+            if( child >= count )
+            {
+                reader.setCorrupt();
+                return PendingTreePtr();
+            }
+            node.children_index.push_back( int(child) );
+        }
+        // the indexes are already there: no need for addNode()
+        nodes.push_back( std::move(node) );
+    }
+    return pending;
+}
+
+size_t JsonBytes(const QJsonValue& value)
+{
+    // roughly what QJsonObject and QString allocate
+    const size_t ENTRY_BYTES = 16;
+
+    if( value.isString() )
+    {
+        return ENTRY_BYTES + value.toString().size() * sizeof(QChar);
+    }
+    if( value.isObject() )
+    {
+        const QJsonObject object = value.toObject();
+        size_t bytes = ENTRY_BYTES;
+        for(auto it = object.begin(); it != object.end(); ++it)
+        {
+            bytes += it.key().size() * sizeof(QChar) + JsonBytes( it.value() );
+        }
+        return bytes;
+    }
+    if( value.isArray() )
+    {
+        size_t bytes = ENTRY_BYTES;
+        for(const QJsonValue& item: value.toArray())
+        {
+            bytes += JsonBytes(item);
+        }
+        return bytes;
+    }
+    return ENTRY_BYTES;
+}
+
+size_t RecordBytes(const NodeRecord& record)
+{
+    return sizeof(NodeRecord) + JsonBytes( record.json ) +
+           record.inputs.capacity() * sizeof(NodeLink);
+}
+
+size_t PendingTreeBytes(const PendingTree& pending)
+{
+    // the strings are mostly shared with the models
+    const size_t NODE_BYTES = sizeof(AbstractTreeNode) + 64;
+    return sizeof(PendingTree) + pending.tree.nodesCount() * NODE_BYTES;
+}
+
+} // end namespace
+
+QByteArray PackTabChanges(const std::vector<TabChange> &changes)
+{
+    SnapshotWriter writer;
+    writer.writeUInt( changes.size() );
+    for(const auto& tab: changes)
+    {
+        writer.writeString( tab.name );
+        writer.writeBool( tab.existed_before );
+        writer.writeBool( tab.exists_after );
+        writer.writeUInt( tab.nodes.size() );
+        for(const auto& node: tab.nodes)
+        {
+            writer.writeUuid( node.uuid );
+            WriteRecord( writer, node.before );
+            WriteRecord( writer, node.after );
+        }
+        WritePendingTree( writer, tab.pending_before );
+        WritePendingTree( writer, tab.pending_after );
+    }
+    return qCompress( writer.data() );
+}
+
+bool UnpackTabChanges(const QByteArray &packed, std::vector<TabChange> &changes)
+{
+    changes.clear();
+
+    SnapshotReader reader( qUncompress(packed) );
+    const quint64 tabs = reader.readUInt();
+    for(quint64 t = 0; t < tabs && reader.isValid(); t++)
+    {
+        TabChange tab;
+        tab.name           = reader.readString();
+        tab.existed_before = reader.readBool();
+        tab.exists_after   = reader.readBool();
+
+        const quint64 nodes = reader.readUInt();
+        for(quint64 n = 0; n < nodes && reader.isValid(); n++)
+        {
+            NodeChange node;
+            node.uuid   = reader.readUuid();
+            node.before = ReadRecord( reader );
+            node.after  = ReadRecord( reader );
+            tab.nodes.push_back( std::move(node) );
+        }
+        tab.pending_before = ReadPendingTree( reader );
+        tab.pending_after  = ReadPendingTree( reader );
+        changes.push_back( std::move(tab) );
+    }
+
+    if( !reader.isValid() )
+    {
+        qWarning() << "Corrupted undo step";
+        changes.clear();
+        return false;
+    }
+    return true;
+}
+
+size_t EstimateMemoryUsage(const std::vector<TabChange> &changes)
+{
+    size_t bytes = 0;
+    for(const auto& tab: changes)
+    {
+        bytes += sizeof(TabChange) + tab.nodes.capacity() * sizeof(NodeChange);
+        for(const auto& node: tab.nodes)
+        {
+            if( node.after )
+            {
+                bytes += RecordBytes( *node.after );
+            }
+            else if( node.before )
+            {
+                bytes += RecordBytes( *node.before );
+            }
+        }
+        // like the records: shared with the next change of the tab
+        if( tab.pending_after )
+        {
+            bytes += PendingTreeBytes( *tab.pending_after );
+        }
+        else if( tab.pending_before && !tab.exists_after )
+        {
+            bytes += PendingTreeBytes( *tab.pending_before );
+        }
+    }
+    return bytes;
+}
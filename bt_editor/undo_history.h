@@ -0,0 +1,134 @@
+#ifndef UNDO_HISTORY_H
+#define UNDO_HISTORY_H
+
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QPointer>
+#include <QString>
+#include <QUuid>
+
+#include <nodes/internal/QUuidStdHash.hpp>
+
+#include "bt_editor_base.h"
+
+class GraphicContainer;
+
+// Connection of one of the input ports of a node.
+struct NodeLink
+{
+    int in_port;
+    QUuid out_node;
+    int out_port;
+
+    bool operator ==(const NodeLink& other) const
+    {
+        return in_port == other.in_port && out_node == other.out_node &&
+               out_port == other.out_port;
+    }
+    bool operator !=(const NodeLink& other) const { return !( *this == other); }
+};
+
+// A node as seen by undo/redo: what Node::save() writes (UUID, model and
+// position) and the connections of its input ports. Every connection
+// belongs to the record of the node on its input side.
+struct NodeRecord
+{
+    QJsonObject json;
+    std::vector<NodeLink> inputs;
+
+    bool operator ==(const NodeRecord& other) const
+    {
+        return json == other.json && inputs == other.inputs;
+    }
+    bool operator !=(const NodeRecord& other) const { return !( *this == other); }
+};
+
+// Records never change once created: the same one is shared by the
+// recorder and by all the undo steps that refer to it.
+typedef std::shared_ptr<const NodeRecord> NodeRecordPtr;
+
+// A null 'before' means that the node was created, a null 'after' that it
+// was deleted.
+struct NodeChange
+{
+    QUuid uuid;
+    NodeRecordPtr before;
+    NodeRecordPtr after;
+};
+
+// A non-null pending tree means that the tab was (or becomes) pending on
+// that side, see GraphicContainer::setPendingTree(): its nodes are not in
+// the change.
+struct TabChange
+{
+    QString name;
+    bool existed_before;
+    bool exists_after;
+    std::vector<NodeChange> nodes;
+    PendingTreePtr pending_before;
+    PendingTreePtr pending_after;
+};
+
+// Older undo steps are kept compressed, see SnapshotWriter. Packed changes
+// don't refer to the shared records, so they don't keep them alive.
+QByteArray PackTabChanges(const std::vector<TabChange>& changes);
+
+// False, and no changes, if the data is truncated or corrupt.
+bool UnpackTabChanges(const QByteArray& packed, std::vector<TabChange>& changes);
+
+// Approximate memory used by the records of the changes. A record is shared
+// by the step that created it and by the one that replaced it; it is counted
+// only in the first one, unless the node was deleted.
+size_t EstimateMemoryUsage(const std::vector<TabChange>& changes);
+
+// Remembers the state of every tab, node by node, as it was at the last
+// commit(). commit() returns what changed since then, looking only at the
+// nodes that each GraphicContainer reports as changed, so that its cost
+// depends on the size of the edit, not on the size of the project.
+class UndoRecorder
+{
+public:
+    typedef std::map<QString, GraphicContainer*> Tabs;
+
+    std::vector<TabChange> commit(const Tabs& tabs);
+
+    // Like commit(), but compares every node and doesn't change the
+    // recorded state.
+    std::vector<TabChange> compare(const Tabs& tabs) const;
+
+    // The nodes of a pending tab have just been built: that is its recorded
+    // state now, not a change.
+    void rebase(const GraphicContainer& container);
+
+private:
+    struct TabRecord
+    {
+        TabRecord(): exists(false) {}
+
+        // a tab with the same name but another container is a new tab
+        QPointer<GraphicContainer> container;
+        bool exists;
+        std::unordered_map<QUuid, NodeRecordPtr> nodes;
+        // while it is set, there are no nodes
+        PendingTreePtr pending;
+    };
+
+    static void diffNodes(const TabRecord& record,
+                          const GraphicContainer& container,
+                          const std::vector<QUuid>& uuids,
+                          TabChange& change);
+
+    static void applyNodes(const TabChange& change, TabRecord& record);
+
+    static void addRemovedTab(const QString& name, const TabRecord& record,
+                              std::vector<TabChange>& changes);
+
+    std::map<QString, TabRecord> _tabs;
+};
+
+#endif // UNDO_HISTORY_H
@@ -1,5 +1,6 @@
 #include "utils.h"
 #include <set>
+#include <algorithm>
 #include <QDebug>
 #include <QDomDocument>
 #include <QMessageBox>
@@ -20,7 +21,7 @@ QtNodes::Node* findRoot(const QtNodes::FlowScene &scene)
 
     for (auto& it: scene.nodes() )
     {
-        Node* node = it.second.get();
+        Node* node = it.get();
         if( node->nodeDataModel()->nPorts( PortType::In ) == 0 )
         {
             if( !root ) root = node;
@@ -49,9 +50,9 @@ std::vector<Node*> getChildren(const QtNodes::FlowScene &scene,
     const auto& conn_out = parent_node.nodeState().connections(PortType::Out, 0);
     children.reserve( conn_out.size() );
 
-    for( auto& it: conn_out)
+    for( QtNodes::Connection* conn: conn_out)
     {
-        auto child_node = it.second->getNode(PortType::In);
+        auto child_node = conn->getNode(PortType::In);
         if( child_node )
         {
             children.push_back( child_node );
@@ -84,161 +85,19 @@ std::vector<Node*> getChildren(const QtNodes::FlowScene &scene,
 }
 
 
-//---------------------------------------------------
-
-void RecursiveNodeReorder(AbsBehaviorTree& tree, PortLayout layout)
+void NodeReorder(QtNodes::FlowScene &scene, AbsBehaviorTree & tree)
 {
-    std::function<void(unsigned, AbstractTreeNode*)> recursiveStep;
-
-    std::vector<QPointF> layer_cursor;
-    std::vector< std::vector<AbstractTreeNode*> > nodes_by_level(1);
-
-    const qreal LEVEL_SPACING = 80;
-    const qreal NODE_SPACING  = 40;
-
-    recursiveStep = [&](unsigned current_layer, AbstractTreeNode* node)
-    {
-        node->pos = layer_cursor[current_layer];
-        nodes_by_level[current_layer].push_back( node );
-
-        //------------------------------------
-        if( node->children_index.size() == 0 )
-        {
-            return;
-        }
-        qreal recommended_pos = NODE_SPACING * 0.5;
-
-        current_layer++;
-
-        if( layout == PortLayout::Vertical)
-        {
-            recommended_pos += (node->pos.x() + node->size.width()*0.5)  ;
-            for(int index: node->children_index)
-            {
-                const auto& child_node = tree.nodes()[index];
-                recommended_pos -=  (child_node.size.width() + NODE_SPACING) * 0.5;
-            }
-
-            if( current_layer >= layer_cursor.size())
-            {
-                QPointF new_cursor( recommended_pos,
-                                    node->pos.y() + LEVEL_SPACING );
-                layer_cursor.push_back( new_cursor );
-                nodes_by_level.push_back( std::vector<AbstractTreeNode*>() );
-            }
-            else{
-                recommended_pos = std::max( recommended_pos, layer_cursor[current_layer].x() );
-                layer_cursor[current_layer].setX(recommended_pos);
-            }
-        }//------------------------------------
-        else
-        {
-            recommended_pos += node->pos.y() + node->size.height()*0.5;
-            for(int index: node->children_index)
-            {
-                const auto& child_node = tree.nodes()[index];
-                recommended_pos -=  (child_node.size.height() + NODE_SPACING) * 0.5;
-            }
-
-            if( current_layer >= layer_cursor.size())
-            {
-                QPointF new_cursor( node->pos.x() + LEVEL_SPACING,
-                                    recommended_pos);
-                layer_cursor.push_back( new_cursor );
-                nodes_by_level.push_back( std::vector<AbstractTreeNode*>() );
-            }
-            else{
-                recommended_pos = std::max( recommended_pos, layer_cursor[current_layer].y() );
-                layer_cursor[current_layer].setY(recommended_pos);
-            }
-        }
-        //------------------------------------
-
-        auto initial_pos = layer_cursor[current_layer];
-
-        for(int index: node->children_index)
-        {
-            AbstractTreeNode* child_node = tree.node(index);
-
-            recursiveStep(current_layer, child_node);
-            if( layout == PortLayout::Vertical)
-            {
-                layer_cursor[current_layer]+= QPointF( child_node->size.width() + NODE_SPACING, 0 );
-            }
-            else{
-                layer_cursor[current_layer]+= QPointF( 0, child_node->size.height() + NODE_SPACING );
-            }
-        }
-
-        auto final_pos = layer_cursor[current_layer];
-
-        if( node->children_index.size() > 0)
-        {
-            auto first_child = tree.node( node->children_index.front() );
-            auto last_child = tree.node( node->children_index.back() );
-
-            initial_pos = QPointF( first_child->pos.x() + first_child->size.width()*0.5,
-                                   first_child->pos.y() + first_child->size.height()*0.5);
-
-            final_pos   = QPointF( last_child->pos.x() + last_child->size.width()*0.5,
-                                   last_child->pos.y() + last_child->size.height()*0.5);
-        }
-
-        // rebalance father
-        QPointF pos_offset(0,0);
-        if( layout == PortLayout::Vertical)
-        {
-            double new_x = (final_pos.x() + initial_pos.x()) * 0.5 - node->size.width()*0.5;
-            double diff = node->pos.x() - new_x;
-            pos_offset = QPointF( - diff, 0 );
-        }
-        else{
-            double new_y = (final_pos.y() + initial_pos.y()) * 0.5 - node->size.height()*0.5;
-            double diff = node->pos.y() - new_y;
-            pos_offset = QPointF( 0, - diff );
-        }
-
-        node->pos += pos_offset;
-        layer_cursor[current_layer -1 ] += pos_offset;
-    };
-
-    auto root_node = tree.rootNode();
-    layer_cursor.push_back(QPointF( -root_node->size.width()*0.5,
-                                    -root_node->size.height()*0.5));
-    recursiveStep(0, root_node);
-
-    if( layout == PortLayout::Vertical)
+    if( tree.nodesCount() == 0)
     {
-        qreal offset = root_node->size.height() + LEVEL_SPACING;
-        for(unsigned i=1; i< nodes_by_level.size(); i++ )
-        {
-            qreal max_height = 0;
-            for(auto node: nodes_by_level[i])
-            {
-                max_height = std::max( max_height, node->size.height() );
-                node->pos.setY( offset );
-            }
-            offset += max_height + LEVEL_SPACING;
-        }
-    }
-    else{
-        qreal offset = root_node->size.width() + LEVEL_SPACING;
-        for(unsigned i=1; i< nodes_by_level.size(); i++ )
-        {
-            qreal max_width = 0;
-            for(auto node: nodes_by_level[i])
-            {
-                max_width = std::max( max_width, node->size.width() );
-                node->pos.setX( offset );
-            }
-            offset += max_width + LEVEL_SPACING;
-        }
+        return;
     }
+
+    ComputeTreeLayout(tree, scene.layout() );
+    ApplyTreeLayout(scene, tree);
 }
 
-void NodeReorder(QtNodes::FlowScene &scene, AbsBehaviorTree & tree)
+void ApplyTreeLayout(QtNodes::FlowScene &scene, const AbsBehaviorTree &tree)
 {
-
     for (const auto& abs_node: tree.nodes())
     {
         Node* node =  abs_node.graphic_node;
@@ -248,17 +107,17 @@ void NodeReorder(QtNodes::FlowScene &scene, AbsBehaviorTree & tree)
         }
     }
 
-    if( tree.nodesCount() == 0)
-    {
-        return;
-    }
-
-    RecursiveNodeReorder(tree, scene.layout() );
+    // each connection is recomputed once, after all the nodes moved
+    QtNodes::ConnectionBatchGuard connection_batch( scene );
 
     for (const auto& abs_node: tree.nodes())
     {
         Node* node =  abs_node.graphic_node;
-        scene.setNodePosition( *node, abs_node.pos );
+        // most nodes keep their place after a local edit
+        if( scene.getNodePosition( *node ) != abs_node.pos )
+        {
+            scene.setNodePosition( *node, abs_node.pos );
+        }
     }
 }
 
@@ -289,7 +148,7 @@ AbsBehaviorTree BuildTreeFromScene(const QtNodes::FlowScene *scene,
 
         auto bt_model = dynamic_cast<BehaviorTreeDataModel*>(node->nodeDataModel());
 
-        abs_node.model = bt_model->model();
+        abs_node.model = bt_model->sharedModel();
         abs_node.instance_name = bt_model->instanceName();
         abs_node.pos  = scene->getNodePosition(*node) ;
         abs_node.size = scene->getNodeSize(*node);
@@ -311,80 +170,6 @@ AbsBehaviorTree BuildTreeFromScene(const QtNodes::FlowScene *scene,
     return tree;
 }
 
-AbsBehaviorTree BuildTreeFromXML(const QDomElement& bt_root, const NodeModels& models )
-{
-    AbsBehaviorTree tree;
-
-    if( bt_root.tagName() != "BehaviorTree" )
-    {
-        throw std::runtime_error( "Expecting a node called <BehaviorTree>");
-    }
-
-    //-------------------------------------
-    std::function<void(AbstractTreeNode* parent, QDomElement)> recursiveStep;
-    recursiveStep = [&](AbstractTreeNode* parent, QDomElement xml_node)
-    {
-        // The nodes with a ID used that QString to insert into the registry()
-        QString modelID = xml_node.tagName();
-        if( xml_node.hasAttribute("ID") )
-        {
-            modelID = xml_node.attribute("ID");
-        }
-
-        AbstractTreeNode tree_node;
-
-        auto model_it = models.find(modelID);
-        if( model_it ==  models.end() )
-        {
-             throw std::runtime_error( (QString("This model has not been registered: ") + modelID).toStdString() );
-        }
-        tree_node.model = model_it->second;
-
-        if( xml_node.hasAttribute("name") )
-        {
-            tree_node.instance_name = ( xml_node.attribute("name") );
-        }
-        else{
-            tree_node.instance_name = modelID;
-        }
-
-        auto attributes = xml_node.attributes();
-        for( int attr=0; attr < attributes.size(); attr++ )
-        {
-            auto attribute = attributes.item(attr).toAttr();
-            if( attribute.name() != "ID" && attribute.name() != "name")
-            {
-                tree_node.ports_mapping.insert( { attribute.name(), attribute.value() } );
-            }
-        }
-
-        auto added_node = tree.addNode(parent, std::move(tree_node));
-
-        for (QDomElement  child = xml_node.firstChildElement( )  ;
-             !child.isNull();
-             child = child.nextSiblingElement( ) )
-        {
-            recursiveStep( added_node, child );
-        }
-    };
-
-    auto first_child = bt_root.firstChildElement();
-    if( first_child.tagName() == "Root")
-    {
-        QMessageBox::question(nullptr,
-                              "Fix your file!",
-                              "Please remove the node <Root> from your <BehaviorTree>",
-                              QMessageBox::Ok );
-        first_child = first_child.firstChildElement();
-    }
-
-    // start recursion
-    recursiveStep( nullptr, first_child );
-
-    return tree;
-}
-
-
 std::pair<AbsBehaviorTree, std::unordered_map<int, int>>
 BuildTreeFromFlatbuffers(const Serialization::BehaviorTree *fb_behavior_tree)
 {
@@ -393,14 +178,18 @@ BuildTreeFromFlatbuffers(const Serialization::BehaviorTree *fb_behavior_tree)
 
     AbstractTreeNode abs_root;
     abs_root.instance_name = "Root";
-    abs_root.model.registration_ID = "Root";
-    abs_root.model.registration_ID = "Root";
+    {
+        NodeModel root_model;
+        root_model.type = NodeType::UNDEFINED;
+        root_model.registration_ID = "Root";
+        abs_root.model = InternNodeModel( root_model );
+    }
     abs_root.children_index.push_back( 1 );
 
     tree.addNode( nullptr, std::move(abs_root) );
 
     //-----------------------------------------
-    NodeModels models;
+    std::map<QString, NodeModelPtr> models;
 
     for( const Serialization::NodeModel* model_node: *(fb_behavior_tree->node_models()) )
     {
@@ -419,7 +208,7 @@ BuildTreeFromFlatbuffers(const Serialization::BehaviorTree *fb_behavior_tree)
             model.ports.insert( { port_name, std::move(port_model) } );
         }
 
-        models.insert( { model.registration_ID, std::move(model)} );
+        models.insert( { model.registration_ID, InternNodeModel(model) } );
     }
 
     //-----------------------------------------
@@ -525,13 +314,13 @@ getStyleFromStatus(NodeStatus status, NodeStatus prev_status)
 QtNodes::Node *GetParentNode(QtNodes::Node *node)
 {
     using namespace QtNodes;
-    auto conn_in = node->nodeState().connections(PortType::In, 0);
+    const auto& conn_in = node->nodeState().connections(PortType::In, 0);
     if( conn_in.size() == 0)
     {
         return nullptr;
     }
     else{
-        return conn_in.begin()->second->getNode(PortType::Out);
+        return conn_in.front()->getNode(PortType::Out);
     }
 }
 
@@ -616,3 +405,173 @@ BT::PortDirection convert(Serialization::PortDirection direction)
     }
     return BT::PortDirection::INOUT;
 }
+
+std::shared_ptr<DataModelRegistry> CreateModelRegistry(const NodeModels& models)
+{
+    namespace util = QtNodes::detail;
+
+    auto registry = std::make_shared<DataModelRegistry>();
+    for(const auto& it: models)
+    {
+        NodeModelPtr model = InternNodeModel( it.second );
+        QString category = QString::fromStdString( BT::toStr(model->type) );
+        if( it.first == "Root")
+        {
+            category = "Root";
+        }
+        DataModelRegistry::RegistryItemCreator creator = [model]() -> DataModelRegistry::RegistryItemPtr
+        {
+            if( model->type == NodeType::SUBTREE)
+            {
+                return util::make_unique<SubtreeNodeModel>(model);
+            }
+            return util::make_unique<BehaviorTreeDataModel>(model);
+        };
+        registry->registerModel( category, creator, it.first );
+    }
+    return registry;
+}
+
+namespace
+{
+
+// 'cut_depth' is lowered to the position in 'stack' of the SubTrees that
+// had to stay collapsed, 'met' gets every SubTree met.
+std::shared_ptr<const AbsBehaviorTree> FlattenStep(const QString& ID,
+                                                   const SubtreeLookup& lookup,
+                                                   FlatSubtreeCache& cache,
+                                                   QStringList& stack,
+                                                   QStringList* cycles,
+                                                   int& cut_depth,
+                                                   QSet<QString>& met)
+{
+    met.insert( ID );
+
+    const int depth = stack.indexOf( ID );
+    if( depth >= 0 )
+    {
+        const QString chain = ( stack.mid( depth ) << ID ).join(" > ");
+        if( cycles && !cycles->contains( chain ) )
+        {
+            cycles->push_back( chain );
+        }
+        cut_depth = std::min( cut_depth, depth );
+        return nullptr;
+    }
+
+    auto cached = cache.find( ID );
+    if( cached != cache.end() )
+    {
+        bool reusable = true;
+        for(const QString& subtree: cached->second.subtrees)
+        {
+            reusable = reusable && !stack.contains( subtree );
+        }
+        if( reusable )
+        {
+            met.unite( cached->second.subtrees );
+            return cached->second.tree;
+        }
+    }
+
+    const auto tree = lookup( ID );
+    if( !tree || tree->nodesCount() == 0 )
+    {
+        cache[ID] = FlatSubtree{ nullptr, QSet<QString>() << ID };
+        return nullptr;
+    }
+
+    int first = 0;
+    if( tree->rootNode()->model->registration_ID == "Root" )
+    {
+        if( tree->rootNode()->children_index.size() != 1 )
+        {
+            cache[ID] = FlatSubtree{ nullptr, QSet<QString>() << ID };
+            return nullptr;
+        }
+        first = tree->rootNode()->children_index.front();
+    }
+
+    const int own_depth = stack.size();
+    int inner_cut = INT_MAX;
+    QSet<QString> inner_met;
+    inner_met.insert( ID );
+    stack.push_back( ID );
+
+    auto flat = std::make_shared<AbsBehaviorTree>();
+    auto& flat_nodes = flat->nodes();
+
+    // pre-order, without recursion: node of 'tree', parent in 'flat'
+    std::vector<std::pair<int,int>> pending = { {first, -1} };
+    while( !pending.empty() )
+    {
+        const auto current = pending.back();
+        pending.pop_back();
+
+        const AbstractTreeNode& source = *tree->node( current.first );
+        const int index = int( flat_nodes.size() );
+        flat_nodes.push_back( source );
+        AbstractTreeNode& copy = flat_nodes.back();
+        copy.index = index;
+        copy.children_index.clear();
+        copy.graphic_node = nullptr;
+        if( current.second >= 0 )
+        {
+            flat_nodes[ current.second ].children_index.push_back( index );
+        }
+
+        if( source.model->type == NodeType::SUBTREE && source.children_index.empty() )
+        {
+            const auto inlined = FlattenStep( source.model->registration_ID,
+                                              lookup, cache, stack, cycles,
+                                              inner_cut, inner_met );
+            if( inlined )
+            {
+                // already flattened: appended as it is, root first
+                flat_nodes[index].children_index.push_back( int( flat_nodes.size() ) );
+                const int offset = int( flat_nodes.size() );
+                for(const auto& inlined_node: inlined->nodes())
+                {
+                    flat_nodes.push_back( inlined_node );
+                    AbstractTreeNode& moved = flat_nodes.back();
+                    moved.index += offset;
+                    for(int& child: moved.children_index)
+                    {
+                        child += offset;
+                    }
+                }
+            }
+            continue;
+        }
+
+        for(auto it = source.children_index.rbegin(); it != source.children_index.rend(); ++it)
+        {
+            pending.push_back( { *it, index } );
+        }
+    }
+
+    stack.pop_back();
+    met.unite( inner_met );
+    if( inner_cut < own_depth )
+    {
+        // cut short by a SubTree that contains this one: not kept
+        cut_depth = std::min( cut_depth, inner_cut );
+    }
+    else{
+        cache[ID] = FlatSubtree{ flat, inner_met };
+    }
+    return flat;
+}
+
+} // end namespace
+
+std::shared_ptr<const AbsBehaviorTree> FlattenSubtree(const QString& ID,
+                                                      const SubtreeLookup& lookup,
+                                                      FlatSubtreeCache& cache,
+                                                      QStringList* cycles)
+{
+    QStringList stack;
+    int cut_depth = INT_MAX;
+    QSet<QString> met;
+    return FlattenStep( ID, lookup, cache, stack, cycles, cut_depth, met );
+}
@@ -2,11 +2,18 @@
 #define NODE_UTILS_H
 
 #include <QDomDocument>
+#include <QSet>
+#include <QStringList>
+#include <climits>
+#include <functional>
+#include <map>
 #include <nodes/NodeData>
 #include <nodes/FlowScene>
 #include <nodes/NodeStyle>
+#include <nodes/DataModelRegistry>
 
 #include "bt_editor_base.h"
+#include "tree_layout.h"
 #include <behaviortree_cpp_v3/flatbuffers/BT_logger_generated.h>
 #include <behaviortree_cpp_v3/flatbuffers/bt_flatbuffer_helper.h>
 
@@ -22,9 +29,15 @@ AbsBehaviorTree BuildTreeFromScene(const QtNodes::FlowScene *scene,
 std::pair<AbsBehaviorTree, std::unordered_map<int, int> >
 BuildTreeFromFlatbuffers(const Serialization::BehaviorTree* bt );
 
-AbsBehaviorTree BuildTreeFromXML(const QDomElement &bt_root, const NodeModels &models);
 
-void NodeReorder(QtNodes::FlowScene &scene, AbsBehaviorTree &abstract_tree );
+// Moves the nodes of the scene according to the tree layout, see
+// ComputeTreeLayout(). GraphicContainer::nodeReorder() arranges its scene
+// incrementally instead.
+void NodeReorder(QtNodes::FlowScene &scene, AbsBehaviorTree &abstract_tree);
+
+// Moves the nodes of the scene to the positions already stored in the tree,
+// e.g. by a ComputeTreeLayout() that ran in another thread.
+void ApplyTreeLayout(QtNodes::FlowScene &scene, const AbsBehaviorTree &abstract_tree);
 
 std::pair<QtNodes::NodeStyle, QtNodes::ConnectionStyle>
 getStyleFromStatus(NodeStatus status, NodeStatus prev_status);
@@ -41,5 +54,38 @@ BT::NodeStatus convert(Serialization::NodeStatus type);
 
 BT::PortDirection convert(Serialization::PortDirection direction);
 
+// A registry with all these models, for scenes that don't belong to
+// MainWindow (e.g. rendering or comparing files).
+std::shared_ptr<QtNodes::DataModelRegistry> CreateModelRegistry(const NodeModels& models);
+
+// Tree of a SubTree, with or without the "Root" node. Null if unknown.
+typedef std::function<std::shared_ptr<const AbsBehaviorTree>(const QString& ID)> SubtreeLookup;
+
+struct FlatSubtree
+{
+    std::shared_ptr<const AbsBehaviorTree> tree;
+    // every SubTree met while flattening it, itself included
+    QSet<QString> subtrees;
+};
+
+typedef std::map<QString, FlatSubtree> FlatSubtreeCache;
+
+// The tree of a SubTree, without "Root", in which every collapsed SubTree
+// node (one without children) has the flattened tree of its own SubTree as
+// only child. Null if the SubTree is unknown or empty.
+//
+// A SubTree that contains itself, directly or not, stays collapsed where it
+// comes back, and the chain ("A > B > A") is added to 'cycles'.
+//
+// The flattened trees are kept in 'cache', which can be shared by several
+// calls with the same lookup. Only what doesn't depend on where the SubTree
+// is used is kept: not a tree cut short because of one of the SubTrees that
+// contain it, and a kept tree is not reused inside one of the SubTrees it
+// meets. The result of B in "A > B > A" is the same whatever comes first.
+std::shared_ptr<const AbsBehaviorTree> FlattenSubtree(const QString& ID,
+                                                      const SubtreeLookup& lookup,
+                                                      FlatSubtreeCache& cache,
+                                                      QStringList* cycles = nullptr);
+
 
 #endif // NODE_UTILS_H
@@ -1,7 +1,13 @@
 #include "groot_test_base.h"
 #include "bt_editor/sidepanel_editor.h"
+#include "bt_editor/tree_diff.h"
+#include "bt_editor/snapshot_codec.h"
+#include "bt_editor/undo_history.h"
+#include "bt_editor/XML_utilities.hpp"
 #include <QAction>
+#include <QJsonArray>
 #include <QLineEdit>
+#include <cmath>
 
 class EditorTest : public GrootTestBase
 {
@@ -25,8 +31,15 @@ private slots:
     void editText();
     void loadModelLess();
     void longNames();
+    void treeLayout();
     void clearModels();
     void undoWithSubtreeExpanded();
+    void undoSubtreeCollapse();
+    void treeDiff();
+    void flattenSubtrees();
+    void treeTopology();
+    void snapshotCodec();
+    void treeIndex();
 };
 
 
@@ -460,7 +473,7 @@ void EditorTest::modifyCustomModel()
     auto jump_abs_node = abs_tree.findFirstNode( jump_model.registration_ID );
     QVERIFY( jump_abs_node != nullptr);
     sleepAndRefresh( 500 );
-    QCOMPARE( jump_abs_node->model, jump_model );
+    QCOMPARE( *jump_abs_node->model, jump_model );
 
     sleepAndRefresh( 500 );
 }
@@ -560,12 +573,50 @@ void EditorTest::longNames()
     auto abs_tree = getAbstractTree();
     QCOMPARE( abs_tree.nodesCount(), size_t(4) );
     auto sequence = abs_tree.node(1);
-    QCOMPARE( sequence->model.registration_ID, QString("Sequence"));
+    QCOMPARE( sequence->model->registration_ID, QString("Sequence"));
 
     // second child on the right side.
     int short_index = sequence->children_index[1];
     auto short_node = abs_tree.node(short_index);
-    QCOMPARE( short_node->model.registration_ID, QString("short") );
+    QCOMPARE( short_node->model->registration_ID, QString("short") );
+}
+
+void EditorTest::treeLayout()
+{
+    QString file_xml = readFile(":/crossdoor_with_subtree.xml");
+    main_win->on_actionClear_triggered();
+    main_win->loadFromXML( file_xml );
+
+    auto abs_tree = getAbstractTree("MainTree");
+    QVERIFY( abs_tree.nodesCount() > 1 );
+
+    const bool vertical =
+        main_win->getTabByName("MainTree")->scene()->layout() == QtNodes::PortLayout::Vertical;
+    auto center = [vertical](const AbstractTreeNode* node)
+    {
+        const QPointF c = QRectF( node->pos, node->size ).center();
+        return vertical ? c.x() : c.y();
+    };
+
+    for (const auto& node_a: abs_tree.nodes())
+    {
+        const QRectF rect_a( node_a.pos, node_a.size );
+        for (const auto& node_b: abs_tree.nodes())
+        {
+            if( &node_a != &node_b )
+            {
+                QVERIFY( !rect_a.intersects( QRectF( node_b.pos, node_b.size ) ) );
+            }
+        }
+
+        // parents are centered on their children
+        if( !node_a.children_index.empty() )
+        {
+            const qreal middle = ( center( abs_tree.node( node_a.children_index.front() ) ) +
+                                   center( abs_tree.node( node_a.children_index.back() ) ) ) * 0.5;
+            QVERIFY( qAbs( center( &node_a ) - middle ) < 1.0 );
+        }
+    }
 }
 
 void EditorTest::clearModels()
@@ -633,6 +684,356 @@ void EditorTest::undoWithSubtreeExpanded()
      sleepAndRefresh( 500 );
 }
 
+void EditorTest::undoSubtreeCollapse()
+{
+    QString file_xml = readFile(":/crossdoor_with_subtree.xml");
+    main_win->on_actionClear_triggered();
+    main_win->loadFromXML( file_xml );
+
+    auto container = main_win->getTabByName("MainTree");
+    auto clickSubtree = [this]()
+    {
+        auto abs_tree = getAbstractTree("MainTree");
+        auto subtree_node = abs_tree.findFirstNode("DoorClosed")->graphic_node;
+        auto subtree_model = dynamic_cast<SubtreeNodeModel*>( subtree_node->nodeDataModel() );
+        QTest::mouseClick( subtree_model->expandButton(), Qt::LeftButton );
+        sleepAndRefresh( 200 );
+    };
+
+    const size_t collapsed_count = container->scene()->nodes().size();
+    clickSubtree();
+    const size_t expanded_count = container->scene()->nodes().size();
+    QVERIFY( expanded_count > collapsed_count );
+
+    clickSubtree();
+    QCOMPARE( container->scene()->nodes().size(), collapsed_count );
+
+    // the expanded nodes come back, attached to the SubTree...
+    main_win->onUndoInvoked();
+    container = main_win->getTabByName("MainTree");
+    QCOMPARE( container->scene()->nodes().size(), expanded_count );
+    QCOMPARE( getAbstractTree("MainTree").nodesCount(), expanded_count );
+    QVERIFY( container->containsValidTree() );
+
+    // ...and go away again
+    main_win->onRedoInvoked();
+    container = main_win->getTabByName("MainTree");
+    QCOMPARE( container->scene()->nodes().size(), collapsed_count );
+    QCOMPARE( getAbstractTree("MainTree").nodesCount(), collapsed_count );
+    QVERIFY( container->containsValidTree() );
+
+    sleepAndRefresh( 500 );
+}
+
+void EditorTest::treeDiff()
+{
+    const QString before_xml =
+            "<root main_tree_to_execute=\"MainTree\">"
+            "  <BehaviorTree ID=\"MainTree\">"
+            "    <Sequence name=\"seq\">"
+            "      <AlwaysSuccess name=\"a\"/>"
+            "      <AlwaysFailure name=\"b\"/>"
+            "      <AlwaysSuccess name=\"c\"/>"
+            "    </Sequence>"
+            "  </BehaviorTree>"
+            "</root>";
+
+    const QString after_xml =
+            "<root main_tree_to_execute=\"MainTree\">"
+            "  <BehaviorTree ID=\"MainTree\">"
+            "    <Sequence name=\"seq\">"
+            "      <AlwaysSuccess name=\"a\"/>"
+            "      <AlwaysFailure name=\"b_renamed\"/>"
+            "      <AlwaysFailure name=\"d\"/>"
+            "    </Sequence>"
+            "  </BehaviorTree>"
+            "</root>";
+
+    auto before = ReadXMLTrees( before_xml, BuiltinNodeModels() ).trees.front().second;
+    auto after  = ReadXMLTrees( after_xml, BuiltinNodeModels() ).trees.front().second;
+
+    TreeDiff diff = DiffTrees( before, after );
+
+    // seq, a, b, c
+    QCOMPARE( diff.before[0] == DiffStatus::SAME, true );
+    QCOMPARE( diff.before[1] == DiffStatus::SAME, true );
+    QCOMPARE( diff.before[2] == DiffStatus::CHANGED, true );
+    QCOMPARE( diff.before[3] == DiffStatus::REMOVED, true );
+    QCOMPARE( diff.matches[2], 2 );
+    QCOMPARE( diff.matches[3], -1 );
+    // seq, a, b_renamed, d
+    QCOMPARE( diff.after[2] == DiffStatus::CHANGED, true );
+    QCOMPARE( diff.after[3] == DiffStatus::ADDED, true );
+
+    diff = DiffTrees( before, before );
+    for(DiffStatus status: diff.before)
+    {
+        QCOMPARE( status == DiffStatus::SAME, true );
+    }
+}
+
+void EditorTest::flattenSubtrees()
+{
+    const QString xml =
+            "<root main_tree_to_execute=\"A\">"
+            "  <BehaviorTree ID=\"A\">"
+            "    <Sequence>"
+            "      <SubTree ID=\"B\"/>"
+            "      <SubTree ID=\"B\"/>"
+            "      <AlwaysSuccess/>"
+            "    </Sequence>"
+            "  </BehaviorTree>"
+            "  <BehaviorTree ID=\"B\">"
+            "    <Sequence>"
+            "      <AlwaysFailure/>"
+            "      <SubTree ID=\"A\"/>"
+            "    </Sequence>"
+            "  </BehaviorTree>"
+            "</root>";
+
+    std::map<QString, std::shared_ptr<const AbsBehaviorTree>> trees;
+    for(const auto& it: ReadXMLTrees( xml, BuiltinNodeModels() ).trees)
+    {
+        trees[it.first] = std::make_shared<const AbsBehaviorTree>( it.second );
+    }
+    auto lookup = [&trees](const QString& ID) -> std::shared_ptr<const AbsBehaviorTree>
+    {
+        auto it = trees.find(ID);
+        return it != trees.end() ? it->second : nullptr;
+    };
+
+    FlatSubtreeCache cache;
+    QStringList cycles;
+    auto flat = FlattenSubtree( "A", lookup, cache, &cycles );
+
+    QVERIFY( flat );
+    // Sequence, twice [SubTree B, Sequence, AlwaysFailure, SubTree A], AlwaysSuccess
+    QCOMPARE( flat->nodesCount(), size_t(10) );
+    QCOMPARE( flat->findNodesByID("B").size(), size_t(2) );
+    for(auto subtree_node: flat->findNodesByID("B"))
+    {
+        QCOMPARE( subtree_node->children_index.size(), size_t(1) );
+    }
+    // the recursion stops at the second A
+    for(auto subtree_node: flat->findNodesByID("A"))
+    {
+        QCOMPARE( subtree_node->children_index.empty(), true );
+    }
+    QCOMPARE( cycles, QStringList() << "A > B > A" );
+    // B was cut short because of A: not kept
+    QCOMPARE( cache.count("B"), size_t(0) );
+    QCOMPARE( cache.count("A"), size_t(1) );
+
+    // B on its own goes down to the second B, even after A
+    flat = FlattenSubtree( "B", lookup, cache, &cycles );
+    QVERIFY( flat );
+    // Sequence, AlwaysFailure, SubTree A, Sequence, twice SubTree B, AlwaysSuccess
+    QCOMPARE( flat->nodesCount(), size_t(7) );
+    QCOMPARE( flat->findNodesByID("A").front()->children_index.size(), size_t(1) );
+    for(auto subtree_node: flat->findNodesByID("B"))
+    {
+        QCOMPARE( subtree_node->children_index.empty(), true );
+    }
+    QCOMPARE( cycles, QStringList() << "A > B > A" << "B > A > B" );
+
+    FlatSubtreeCache fresh_cache;
+    auto flat_first = FlattenSubtree( "B", lookup, fresh_cache );
+    QCOMPARE( *flat_first == *flat, true );
+}
+
+void EditorTest::treeTopology()
+{
+    QString file_xml = readFile(":/crossdoor_with_subtree.xml");
+    main_win->on_actionClear_triggered();
+    main_win->loadFromXML( file_xml );
+
+    auto container = main_win->getTabByName("MainTree");
+    auto scene = container->scene();
+    const TreeTopology& topology = container->topology();
+
+    // the same as a full scan of the scene
+    QCOMPARE( topology.size(), scene->nodes().size() );
+    QCOMPARE( topology.root(), findRoot( *scene ) );
+    for (const auto& node: scene->nodes())
+    {
+        auto children = getChildren( *scene, *node, false );
+        QCOMPARE( topology.children( *node ).size(), children.size() );
+        for (auto child: children)
+        {
+            QCOMPARE( topology.parent( *child ), node.get() );
+        }
+    }
+    QCOMPARE( container->getSubtreeNodesRecursively( *topology.root() ).size(),
+              scene->nodes().size() );
+    QVERIFY( container->containsValidTree() );
+
+    // a node without parent: no root, not a tree
+    auto tree = getAbstractTree("MainTree");
+    auto door_node = tree.findFirstNode("DoorClosed")->graphic_node;
+    auto connection = door_node->nodeState().connections( PortType::In, 0 ).front();
+    scene->deleteConnection( *connection );
+
+    QCOMPARE( topology.parent( *door_node ), static_cast<QtNodes::Node*>(nullptr) );
+    QCOMPARE( topology.root(), static_cast<QtNodes::Node*>(nullptr) );
+    QVERIFY( !container->containsValidTree() );
+
+    scene->removeNode( *door_node );
+    QCOMPARE( topology.size(), scene->nodes().size() );
+    QCOMPARE( topology.root(), findRoot( *scene ) );
+
+    main_win->on_actionClear_triggered();
+}
+
+void EditorTest::snapshotCodec()
+{
+    QJsonObject json;
+    json["port"] = 3;
+    json["negative"] = -7;
+    json["fraction"] = 0.25;
+    json["big"] = 1e20;
+    json["name"] = "node";
+    json["list"] = QJsonArray() << true << false << QJsonValue() << "node";
+
+    const QUuid uuid = QUuid::createUuid();
+
+    SnapshotWriter writer;
+    writer.writeBool( true );
+    writer.writeUInt( 300 );
+    writer.writeInt( -5 );
+    writer.writeString( "node" );
+    writer.writeUuid( uuid );
+    writer.writeJson( json );
+    writer.writeJson( QJsonValue( -0.0 ) );
+    const QByteArray data = writer.data();
+
+    SnapshotReader reader( data );
+    QVERIFY( reader.isValid() );
+    QCOMPARE( reader.readBool(), true );
+    QCOMPARE( reader.readUInt(), quint64(300) );
+    QCOMPARE( reader.readInt(), qint64(-5) );
+    QCOMPARE( reader.readString(), QString("node") );
+    QCOMPARE( reader.readUuid(), uuid );
+    QVERIFY( reader.readJson().toObject() == json );
+    const double zero = reader.readJson().toDouble();
+    QCOMPARE( zero, 0.0 );
+    QVERIFY( std::signbit( zero ) );
+    QVERIFY( reader.isValid() );
+
+    // truncated: the reader notices when it gets to the end
+    SnapshotReader truncated( data.left( data.size() - 4 ) );
+    truncated.readBool();
+    truncated.readUInt();
+    truncated.readInt();
+    truncated.readString();
+    truncated.readUuid();
+    truncated.readJson();
+    truncated.readJson();
+    QVERIFY( !truncated.isValid() );
+
+    // another magic number or version
+    QByteArray corrupt = data;
+    corrupt[0] = corrupt[0] ^ 0xFF;
+    QVERIFY( !SnapshotReader( corrupt ).isValid() );
+
+    //------------------------------
+    const QString xml =
+            "<root main_tree_to_execute=\"MainTree\">"
+            "  <BehaviorTree ID=\"MainTree\">"
+            "    <Sequence name=\"seq\">"
+            "      <SetBlackboard name=\"set\" output_key=\"key\" value=\"42\"/>"
+            "      <AlwaysFailure name=\"fail\"/>"
+            "    </Sequence>"
+            "  </BehaviorTree>"
+            "</root>";
+
+    auto pending = std::make_shared<PendingTree>();
+    pending->tree = ReadXMLTrees( xml, BuiltinNodeModels() ).trees.front().second;
+    pending->uuid_seed = QUuid::createUuid();
+
+    auto record = std::make_shared<NodeRecord>();
+    record->json = json;
+    record->inputs.push_back( { 0, uuid, 0 } );
+
+    TabChange tab;
+    tab.name = "MainTree";
+    tab.existed_before = true;
+    tab.exists_after = false;
+    tab.nodes.push_back( { uuid, record, NodeRecordPtr() } );
+    tab.pending_after = pending;
+
+    const QByteArray packed = PackTabChanges( { tab } );
+    std::vector<TabChange> unpacked;
+    QVERIFY( UnpackTabChanges( packed, unpacked ) );
+
+    QCOMPARE( unpacked.size(), size_t(1) );
+    const TabChange& copy = unpacked.front();
+    QCOMPARE( copy.name, tab.name );
+    QCOMPARE( copy.existed_before, true );
+    QCOMPARE( copy.exists_after, false );
+    QCOMPARE( copy.nodes.size(), size_t(1) );
+    QCOMPARE( copy.nodes.front().uuid, uuid );
+    QVERIFY( copy.nodes.front().before == nullptr );
+    QVERIFY( *copy.nodes.front().after == *record );
+    QVERIFY( copy.pending_before == nullptr );
+    QCOMPARE( copy.pending_after->uuid_seed, pending->uuid_seed );
+    QCOMPARE( copy.pending_after->tree == pending->tree, true );
+    for(size_t i = 0; i < pending->tree.nodesCount(); i++)
+    {
+        const AbstractTreeNode& node = *pending->tree.node(i);
+        const AbstractTreeNode& node_copy = *copy.pending_after->tree.node(i);
+        QVERIFY( node_copy.children_index == node.children_index );
+        QCOMPARE( node_copy.ports_mapping == node.ports_mapping, true );
+        QCOMPARE( *node_copy.model == *node.model, true );
+    }
+
+    // truncated or corrupt: nothing rather than half of it
+    QVERIFY( !UnpackTabChanges( packed.left( packed.size() / 2 ), unpacked ) );
+    QCOMPARE( unpacked.size(), size_t(0) );
+    QByteArray raw = qUncompress( packed );
+    QVERIFY( !UnpackTabChanges( qCompress( raw.left( raw.size() - 4 ) ), unpacked ) );
+    QCOMPARE( unpacked.size(), size_t(0) );
+    raw[0] = raw[0] ^ 0xFF;
+    QVERIFY( !UnpackTabChanges( qCompress( raw ), unpacked ) );
+    QCOMPARE( unpacked.size(), size_t(0) );
+}
+
+void EditorTest::treeIndex()
+{
+    const QString xml =
+            "<root main_tree_to_execute=\"MainTree\">"
+            "  <BehaviorTree ID=\"MainTree\">"
+            "    <Sequence name=\"seq\">"
+            "      <AlwaysSuccess name=\"a\"/>"
+            "      <AlwaysFailure name=\"b\"/>"
+            "    </Sequence>"
+            "  </BehaviorTree>"
+            "</root>";
+
+    AbsBehaviorTree tree = ReadXMLTrees( xml, BuiltinNodeModels() ).trees.front().second;
+    const AbsBehaviorTree copy = tree;
+
+    // the pointer is taken before the index is built...
+    AbstractTreeNode* node_b = tree.node(2);
+    QVERIFY( tree.findFirstNode("b") == node_b );
+    QCOMPARE( tree.parentIndex(2), 0 );
+    QVERIFY( tree == copy );
+
+    // ...and the node is modified afterwards
+    node_b->instance_name = "b_renamed";
+    QVERIFY( tree != copy );
+    QVERIFY( tree.findFirstNode("b") == nullptr );
+    QVERIFY( tree.findFirstNode("b_renamed") == node_b );
+    QVERIFY( tree.subtreeHash(0) != copy.subtreeHash(0) );
+
+    node_b->instance_name = "b";
+    QVERIFY( tree == copy );
+    QCOMPARE( tree.hash(), copy.hash() );
+
+    // a new child
+    node_b->children_index.push_back( 1 );
+    QCOMPARE( tree.parentIndex(1), 2 );
+}
+
 QTEST_MAIN(EditorTest)
 
 #include "editor_test.moc"
@@ -41,10 +41,9 @@ void GrootTestBase::testDragObject(QGraphicsView *view, const QPoint &screen_pos
 
 AbsBehaviorTree GrootTestBase::getAbstractTree(const QString &name)
 {
-    if(name.isEmpty() )
-        return BuildTreeFromScene( main_win->currentTabInfo()->scene() );
-    else
-        return BuildTreeFromScene( main_win->getTabByName(name)->scene() );
+    auto container = name.isEmpty() ? main_win->currentTabInfo() : main_win->getTabByName(name);
+    container->materialize();
+    return BuildTreeFromScene( container->scene() );
 }
 
 void GrootTestBase::testMessageBox(int deplay_ms, TestLocation location,